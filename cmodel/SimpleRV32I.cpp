@@ -1,338 +1,424 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
 #include "SimpleRV32I.h"
+#include "SimpleRV32I_dump.h"
 #include "SimpleRV32I_utils.h"
 
-/*                                      RV32I instruction format
- *('S' - Sign Bit, 'X' - normal bit, '-->' - right fill, '<--' - left fill) : for getting 32bit immediates
- *===========================================================================================================
- *
- * |`````````````````{31:12,0-->}```````````|```11:7````|`````6:0``````|
- * |S x x x x x x x x x x x x x x x x x x x | x x x x x | x x x x x x x|   U-Type Instruction
- * |___________________IMM__________________|_____RD____|____OPCODE____|
- *
- *===========================================================================================================
- *
- * |``````{<--S,20,10:1,11,19:12,0-->}``````|```11:7````|`````6:0``````|
- * |S x x x x x x x x x x x x x x x x x x x | x x x x x | x x x x x x x|   J-Type Instruction
- * |___________________IMM__________________|_____RD____|____OPCODE____|
- *
- *===========================================================================================================
- *
- * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
- * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   R-Type Instruction
- * |____FUNCT7____|____RS2____|_____RS1___|_FUNCT3|_____RD____|____OPCODE____|
- *
- *===========================================================================================================
- *
- * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
- * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   I-Type Instruction
- * |____FUNCT7____|___SHAMT___|_____RS1___|_FUNCT3|_____RD____|____OPCODE____|
- *
- *===========================================================================================================
- *
- * |````````{S,11:0}````````|```19:15```|`14:12`|```11:7````|`````6:0``````|
- * |S x x x x x x x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   I-Type Instruction
- * |__________IMM___________|_____RS1___|_FUNCT3|_____RD____|____OPCODE____|
- *
- *===========================================================================================================
- *
- * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
- * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   S-Type Instruction
- * |__IMM[11:5]___|____RS2____|_____RS1___|_FUNCT3|_IMM[4:0]__|____OPCODE____|
- *
- *===========================================================================================================
- *
- * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
- * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   B-Type Instruction
- * |__IMM[12,10:5]|____RS2____|_____RS1___|_FUNCT3|IMM[4:1,11]|____OPCODE____|
- *
- *===========================================================================================================
- *
- */
 
-RV32I_INST::RV32I_INST() {
-    opcode = 0;
-    rd = 0;
-    rs1 = 0;
-    rs2 = 0;
-    funct3 = 0;
-    funct7 = 0;
-    shamt = 0;
-    imm = 0;
+SimpleRV32I::SimpleRV32I(int memSize, rv32i_engine engine, rv32i_mem_layout layout) {
+    mem_size = memSize;
+    imem = new RV32I_MEM();
+    dmem = (layout == MEM_UNIFIED) ? imem : new RV32I_MEM();
+    mem_shared = false;
+    hart_id = 0;
+    init(engine);
 }
 
 
 /*
- * takes a 32bit rv32i instruction as input
- * and decodes various fields within the instruction
+ * a further hart for primary's system (see RV32I_SMP): it shares primary's
+ * memory, which has to outlive it, takes its engine and configuration and
+ * starts at its pc, with its registers 0
  * */
-void RV32I_INST::decodeInst(uint32_t inst) {
-    this->inst = inst;
-    opcode  = inst & 0x0000007f;
-    rd      = (inst >> 7)  & 0x00000001f;
-    rs1     = (inst >> 15) & 0x00000001f;
-    rs2     = (inst >> 20) & 0x00000001f;
-    funct3  = (inst >> 12) & 0x000000007;
-    funct7  = (inst >> 25) & 0x00000007f;
-    shamt   = (inst >> 20) & 0x00000001f;
-
-    //extract immediate value
-    switch(getType()) {
-        case U_TYPE:    
-                        imm = inst & 0xfffff000;
-                        break;
-        case B_TYPE:    
-                        imm |= ((inst >> 7) & 0x0000001e);
-                        imm |= ((inst >> 20) & 0x00007e0);
-                        imm |= ((inst << 4) & 0x0000800);
-                        imm |= ((((int32_t)inst) >> 20) & 0xfffff000);
-                        break;
-        case I_TYPE:
-                        if((opcode == 0b0010011) && ((funct3 == 0x01) || (funct3 == 0x05))) {
-                            imm |= ((inst >> 20) & 0x0000001f);
-                            imm |= ((((int32_t)inst) >> 20) & 0xffffffe0);
-                        }else{
-                            imm |= ((inst >> 20) & 0x00000fff);
-                            imm |= ((((int32_t)inst) >> 20) & 0xfffff000);
-                        }
-                        break;
-        case S_TYPE: 
-                        imm |= ((inst >> 7) & 0x0000001f);
-                        imm |= ((((int32_t)inst) >> 20) & 0xffffffe0);
-                        break;
-        case J_TYPE: 
-                        imm |= (inst & 0x000ff000);
-                        imm |= ((inst >> 9) &  0x00000800);
-                        imm |= ((inst >> 20) &  0x000007fe);
-                        break;
-        case INVALID_TYPE: 
-                        std::cerr << "Invalid rv32I instruction/opcode: " << std::hex << inst << "/" << opcode << std::endl;
-                        exit(1);
-                        break;
+SimpleRV32I::SimpleRV32I(SimpleRV32I *primary, uint32_t hartId) {
+    mem_size = primary->mem_size;
+    imem = primary->imem;
+    dmem = primary->dmem;
+    mem_shared = true;
+    hart_id = hartId;
+    init(primary->engine);
+    configureJit(primary->jit_cache_size, primary->jit_threshold);
+    configureCounters(primary->costs, primary->time_div);
+    configureIsa(primary->isa_ext);
+    image_end = primary->image_end;
+    PC = primary->PC;
+}
+
+
+//state common to the constructors, memory has been set up
+void SimpleRV32I::init(rv32i_engine engine) {
+    jit_cache = NULL;
+    jit_cache_size = RV32I_JIT_CACHE_SIZE;
+    jit_cache_used = 0;
+    jit_threshold = RV32I_JIT_THRESHOLD;
+    block_len = RV32I_MAX_BLOCK_LEN;
+    trace = NULL;
+    probe = NULL;
+    profiler = NULL;
+    syscalls = NULL;
+    break_map = NULL;
+    watch_map = NULL;
+    dirty_map = NULL;
+    break_watch = false;
+    watch_addr = 0;
+    break_ignore = false;
+    this->engine = engine;
+
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        code_dir[i] = NULL;
     }
+    cur_code_base = RV32I_TLB_INVALID;
+    cur_code_page = NULL;
+    isa_ext = 0;
+    configureCounters();
+    reset();
+}
+
+SimpleRV32I::~SimpleRV32I() {
+    invalidateDecodeCache();
+    flushJitCache();
+    delete trace;
+    delete [] break_map;
+    delete [] watch_map;
+    delete [] dirty_map;
+    if(mem_shared) return;
+    if(dmem != imem) delete dmem;
+    delete imem;
 }
 
 
 /*
- *returns the type of the instruction: I/J/R/S/B/U
+ * puts the model back in its just constructed state: registers and PC are
+ * 0 and only [0, mem_size) is mapped, all zero
+ * page buffers and the native code cache are kept for reuse, so a reset is
+ * much cheaper than a new model
  * */
-rv32i_op_type RV32I_INST::getType() {
-    rv32i_op_type type;
-    switch(opcode) {
-        case 0b0110111:
-        case 0b0010111:     
-                            type = U_TYPE;
-                            break;
-        case 0b1100011:     
-                            type = B_TYPE;
-                            break;
-        case 0b0000011:
-        case 0b0010011:     
-        case 0b1110011:
-        case 0b1100111:     
-                            type = I_TYPE;
-                            break;
-        case 0b0100011:     
-                            type = S_TYPE;
-                            break;
-        case 0b0110011:     
-                            type = R_TYPE;
-                            break;
-        case 0b1101111:     
-                            type = J_TYPE;
-                            break;
-        default:            
-                            type = INVALID_TYPE;
-                            break;
+void SimpleRV32I::reset() {
+    //guest memory: [0, mem_size) is mapped in both views, anything else has to be mapped explicitly
+    //(a hart sharing another one's memory leaves it alone)
+    if(!mem_shared) {
+        imem->reset();
+        if(dmem != imem) {
+            dmem->reset();
+            imem->map(0, mem_size, RV32I_PERM_RX);
+            dmem->map(0, mem_size, RV32I_PERM_RW);
+        } else {
+            imem->map(0, mem_size, RV32I_PERM_RWX);
+        }
     }
-    return type;
-}
+    invalidateDecodeCache();
+    flushTlb();
+    if(trace) trace->clear();
 
+    image_end = mem_size;
+
+    //initialize PC/status/registers to 0
+    PC = 0;
+    status = RV32I_STATUS_RUNNING;
+    trap_cause = 0;
+    trap_value = 0;
+    instret = 0;
+    cycle = 0;
+    cycle_off = 0;
+    instret_off = 0;
+    mscratch = 0;
+    misa_ext = isa_ext;
+    resv_addr = RV32I_RESV_NONE;
+
+    for(int i=0; i<32; i++) {
+        regs[i] = 0;
+    }
+}
 
 
 /*
- * Returns the exact mnemonic operation to be performed
- */
-rv32i_operation   RV32I_INST::getOperation() {
-    rv32i_operation op;
-    switch(getType()) {
-        case U_TYPE:    
-                        if(opcode == 0b0110111) op = LUI;
-                        if(opcode == 0b0010111) op = AUIPC;
-                        break;
-        case B_TYPE:    
-                        if(funct3 == 0b000) op = BEQ;
-                        if(funct3 == 0b001) op = BNE;
-                        if(funct3 == 0b100) op = BLT;
-                        if(funct3 == 0b101) op = BGE;
-                        if(funct3 == 0b110) op = BLTU;
-                        if(funct3 == 0b111) op = BGEU;
-                        break;
-        case I_TYPE:
-                        switch(opcode) {
-                            case 0b0000011:
-                                            if(funct3 == 0b000) op = LB;
-                                            if(funct3 == 0b001) op = LH;
-                                            if(funct3 == 0b010) op = LW;
-                                            if(funct3 == 0b100) op = LBU;
-                                            if(funct3 == 0b101) op = LHU;
-                                            break;
-                            case 0b0010011:
-                                            if(funct3 == 0b000) op = ADDI;
-                                            if(funct3 == 0b010) op = SLTI;
-                                            if(funct3 == 0b011) op = SLTIU;
-                                            if(funct3 == 0b100) op = XORI;
-                                            if(funct3 == 0b110) op = ORI;
-                                            if(funct3 == 0b111) op = ANDI;
-                                            if(funct3 == 0b001) op = SLLI;
-                                            if(funct3 == 0b101) {
-                                                if(funct7 == 0b0000000) op = SRLI;
-                                                if(funct7 == 0b0100000) op = SRAI;
-                                            }
-                                            break;
-                            case 0b1100111: op = JALR;
-                                            break;
-                            case 0b1110011: //TODO: understand these category of instructions
-                                            //CSRRW
-                                            //CSRRS
-                                            //CSRRC
-                                            //CSRRWI
-                                            //CSRRSI
-                                            //CSRRCI
-                                            if(funct3 == 0) {
-                                                if(imm == 0) op = ECALL;
-                                                if(imm == 1) op = EBREAK;
-                                            }
-                                            break;
-                        }
-                        break;
-        case S_TYPE: 
-                        if(funct3 == 0b000) op = SB;
-                        if(funct3 == 0b001) op = SH;
-                        if(funct3 == 0b010) op = SW;
-                        break;
-        case J_TYPE:    
-                        op = JAL; 
-                        break;
-        case R_TYPE:
-                        if(funct3 == 0b000) {
-                            if(funct7 == 0b0000000) op = ADD;
-                            if(funct7 == 0b0100000) op = SUB;
-                        }
-                        if(funct3 == 0b001) op = SLL;
-                        if(funct3 == 0b010) op = SLT;
-                        if(funct3 == 0b011) op = SLTU;
-                        if(funct3 == 0b100) op = XOR;
-                        if(funct3 == 0b101) {
-                            if(funct7 == 0b0000000) op = SRL;
-                            if(funct7 == 0b0100000) op = SRA;
-                        }
-                        if(funct3 == 0b110) op = OR;
-                        if(funct3 == 0b111) op = AND;
-                        break;
-    
+ * returns a new model in the same state as this one (e.g. a golden image
+ * with the program and data loaded), without copying guest memory: pages
+ * are shared copy on write, so the cost does not depend on the image size
+ * this model must not run while it is being forked, forks are independent
+ * of it (and of each other) afterwards
+ * */
+SimpleRV32I *SimpleRV32I::fork() {
+    return fork(engine);
+}
+
+//the same, on another engine
+SimpleRV32I *SimpleRV32I::fork(rv32i_engine engine) {
+    SimpleRV32I *cpu = new SimpleRV32I(mem_size, engine, (dmem == imem) ? MEM_UNIFIED : MEM_SPLIT);
+    cpu->configureJit(jit_cache_size, jit_threshold);
+    cpu->configureCounters(costs, time_div);
+    cpu->configureIsa(isa_ext);
+    cpu->imem->fork(imem);
+    if(dmem != imem) cpu->dmem->fork(dmem);
+    cpu->invalidateDecodeCache();
+    cpu->flushTlb();
+
+    cpu->PC = PC;
+    cpu->status = status;
+    cpu->trap_cause = trap_cause;
+    cpu->trap_value = trap_value;
+    cpu->instret = instret;
+    cpu->cycle = cycle;
+    cpu->cycle_off = cycle_off;
+    cpu->instret_off = instret_off;
+    cpu->mscratch = mscratch;
+    cpu->misa_ext = misa_ext;
+    cpu->hart_id = hart_id;
+    cpu->image_end = image_end;
+    for(int i=0; i<32; i++) {
+        cpu->regs[i] = regs[i];
     }
-    debug_printf(DEBUG_MEDIUM,"RV32I_INST::getOperation> inst(%08x) => op(%d) %s:%d\n",inst,op,__FILE__, __LINE__);
-    
-    return op;
+    return cpu;
 }
 
 
-SimpleRV32I::SimpleRV32I(int memSize) {
-    inst_mem = NULL;
-    data_mem = NULL;
-    inst_mem = new uint8_t[memSize];
-    mem_size = memSize;
-    if(inst_mem == NULL) {
-       std::cerr << "Unable to allocate instruction memory: " <<  memSize << " words" << std::endl;
-       exit(1);
+/*
+ * maps [base, base+size) into the data view (both views for MEM_UNIFIED)
+ * pages are allocated when first touched
+ * */
+bool SimpleRV32I::mapMemory(uint32_t base, uint32_t size, uint8_t perms) {
+    return dmem->map(base, size, perms);
+}
+
+
+/*
+ * raises a guest exception: the model stops with RV32I_STATUS_TRAP and PC
+ * left at the faulting instruction
+ * */
+void SimpleRV32I::trap(uint32_t cause, uint32_t value) {
+    status = RV32I_STATUS_TRAP;
+    trap_cause = cause;
+    trap_value = value;
+    debug_printf(DEBUG_LOW,"SimpleRV32I::trap> pc(%08x) cause(%d) value(%08x) %s:%d\n",PC,cause,value,__FILE__, __LINE__);
+}
+
+
+/*
+ * empties both TLBs
+ * */
+void SimpleRV32I::flushTlb() {
+    for(int i=0; i<RV32I_TLB_SIZE; i++) {
+        tlb_rd[i].tag = RV32I_TLB_INVALID;
+        tlb_wr[i].tag = RV32I_TLB_INVALID;
     }
-    data_mem = new uint8_t[memSize];
-    if(data_mem == NULL) {
-       std::cerr << "Unable to allocate data memory: " <<  memSize << " words" << std::endl;
-       exit(1);
+    tlb_gen = dmem->tlb_gen;
+}
+
+
+/*
+ * starts/stops recording the data pages stored to (see takeDirtyPages())
+ * */
+void SimpleRV32I::trackDirtyPages(bool on) {
+    delete [] dirty_map;
+    dirty_map = NULL;
+    dirty_pages.clear();
+    if(on) {
+        dirty_map = new uint64_t[RV32I_BREAK_MAP_WORDS]();
+        for(int i=0; i<RV32I_TLB_SIZE; i++) {
+            tlb_wr[i].tag = RV32I_TLB_INVALID;
+        }
     }
+}
 
-    //initialize memory/PC/status/registers to 0
-    for(int i=0; i<memSize; i++) {
-        inst_mem[i] = 0;
-        data_mem[i] = 0;
+
+/*
+ * moves the page numbers of the data pages stored to since tracking started
+ * or since the last call to pages, and starts over: the write TLB is
+ * emptied, so the next store to each page is seen again
+ * */
+void SimpleRV32I::takeDirtyPages(std::vector<uint32_t> &pages) {
+    pages.clear();
+    if(dirty_map == NULL) return;
+    for(size_t i=0; i<dirty_pages.size(); i++) {
+        dirty_map[dirty_pages[i] >> 6] &= ~(1ull << (dirty_pages[i] & 63));
+    }
+    pages.swap(dirty_pages);
+    for(int i=0; i<RV32I_TLB_SIZE; i++) {
+        tlb_wr[i].tag = RV32I_TLB_INVALID;
     }
+}
 
-    PC = 0;
-    status = 0;
 
-    for(int i=0; i<32; i++) {
-        regs[i] = 0;
+/*
+ * drops state that guest memory changes made stale: the code caches after a
+ * code page was written, the TLBs after mappings/page states changed
+ * */
+void SimpleRV32I::memorySync() {
+    if(imem->code_gen != code_gen) {
+        debug_printf(DEBUG_MEDIUM,"SimpleRV32I::memorySync> code written, flushing code caches %s:%d\n",__FILE__, __LINE__);
+        invalidateDecodeCache();
     }
+    if(dmem->tlb_gen != tlb_gen) flushTlb();
 }
 
-SimpleRV32I::~SimpleRV32I() {
-    delete [] inst_mem;
-    delete [] data_mem;
+
+/*
+ * load slow path: fills the read TLB from the page tables, handles
+ * misaligned and page crossing accesses, traps on unmapped/unreadable pages
+ * pages with watchpoints stay out of the TLB, so their accesses are checked here
+ * */
+bool SimpleRV32I::loadSlow(uint32_t addr, void *value, uint32_t size) {
+    uint32_t off = addr & RV32I_PAGE_MASK;
+    uint8_t *host = dmem->access(addr, RV32I_PERM_R);
+    if(host == NULL) {
+        trap(RV32I_CAUSE_LOAD_FAULT, addr);
+        return false;
+    }
+    if(!watched(addr, size)) {
+        rv32i_tlb_entry *e = &tlb_rd[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)];
+        e->tag = addr & ~RV32I_PAGE_MASK;
+        e->addend = (uintptr_t)host - e->tag;
+    } else if(hitWatchpoint(addr, size, RV32I_WATCH_READ)) {
+        return false;
+    }
+    if(off + size <= RV32I_PAGE_SIZE) {
+        memcpy(value, host + off, size);
+        return true;
+    }
+    //crosses into the next page
+    uint8_t *next = dmem->access(addr + size - 1, RV32I_PERM_R);
+    if(next == NULL) {
+        trap(RV32I_CAUSE_LOAD_FAULT, addr);
+        return false;
+    }
+    memcpy(value, host + off, RV32I_PAGE_SIZE - off);
+    memcpy((uint8_t*)value + RV32I_PAGE_SIZE - off, next, size - (RV32I_PAGE_SIZE - off));
+    return true;
 }
 
 
 /*
- * loads a program binary from a ascii hexadecimal format file (.txt file)
- * each line in the input file will correspond to a 32bit value
+ * store slow path: fills the write TLB from the page tables, unless the page
+ * holds cached code, in which case the code caches are invalidated, or is
+ * reserved by an LR, in which case the reservations on the written sets break
+ * pages shared with a fork are copied first (see RV32I_MEM::fork())
+ * handles misaligned and page crossing accesses, traps on unmapped/read only pages
  * */
-void SimpleRV32I::loadProgram(std::string file) {
-    std::ifstream inFile;
-    inFile.open(file);
-    std::string line;
-    int i = 0;
-
-    if(!inFile.is_open()) {
-        std::cout << "Unable to open file: " << file << std::endl;
+bool SimpleRV32I::storeSlow(uint32_t addr, const void *value, uint32_t size) {
+    uint32_t off = addr & RV32I_PAGE_MASK;
+    uint32_t first = (off + size <= RV32I_PAGE_SIZE) ? size : RV32I_PAGE_SIZE - off;
+    uint8_t *host = dmem->access(addr, RV32I_PERM_W);
+    uint8_t *next = NULL;
+    if((host == NULL) || ((first < size) && ((next = dmem->access(addr + size - 1, RV32I_PERM_W)) == NULL))) {
+        trap(RV32I_CAUSE_STORE_FAULT, addr);
+        return false;
     }
+    bool watch = watched(addr, size);
+    if(watch && hitWatchpoint(addr, size, RV32I_WATCH_WRITE)) return false;
+    //the page may just have been copied away from a fork, reads must follow it
+    tlb_rd[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)].tag = RV32I_TLB_INVALID;
+    tlb_rd[((addr + size - 1) >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)].tag = RV32I_TLB_INVALID;
+    markDirty(addr);
+    markDirty(addr + size - 1);
+    uint8_t flags = dmem->getFlags(addr);
+    if((flags | (next ? dmem->getFlags(addr + size - 1) : 0)) & RV32I_PAGE_RESERVED) {
+        //before the write: an SC that got in first is ordered before it
+        dmem->resvSet(addr)->fetch_add(1);
+        dmem->resvSet(addr + size - 1)->fetch_add(1);
+    }
+    if(flags & RV32I_PAGE_CODE) {
+        dmem->codeWrite(addr);
+    } else if(!watch && !(flags & RV32I_PAGE_RESERVED)) {
+        rv32i_tlb_entry *e = &tlb_wr[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)];
+        e->tag = addr & ~RV32I_PAGE_MASK;
+        e->addend = (uintptr_t)host - e->tag;
+    }
+    memcpy(host + off, value, first);
+    if(first < size) {
+        dmem->codeWrite(addr + size - 1);
+        memcpy(next, (const uint8_t*)value + first, size - first);
+    }
+    return true;
+}
 
-    while(std::getline(inFile, line)) {
-        std::stringstream s;
-        uint32_t data;
-        s << std::hex << line;
-        s >> data;
-        if(i == mem_size) {
-            std::cerr << "Insufficient memory" << std::endl;
-            exit(1);
+
+/*
+ * returns the code page holding pc, allocating it on first use
+ * NULL if pc cannot be fetched from
+ * */
+rv32i_code_page *SimpleRV32I::getCodePage(uint32_t pc) {
+    uint32_t d = pc >> (RV32I_PAGE_BITS + RV32I_DIR_BITS);
+    uint32_t p = (pc >> RV32I_PAGE_BITS) & (RV32I_DIR_SIZE - 1);
+    if((code_dir[d] != NULL) && (code_dir[d][p] != NULL)) return code_dir[d][p];
+    if(imem->access(pc, RV32I_PERM_X) == NULL) return NULL;
+    if(code_dir[d] == NULL) {
+        code_dir[d] = new rv32i_code_page*[RV32I_DIR_SIZE];
+        for(int i=0; i<RV32I_DIR_SIZE; i++) {
+            code_dir[d][i] = NULL;
         }
-        *((uint32_t*)(inst_mem + i)) = data;
-        i += 4;
     }
-    inFile.close();
+    rv32i_code_page *cp = new rv32i_code_page;
+    for(int i=0; i<RV32I_PAGE_WORDS; i++) {
+        cp->dec[i].valid = 0;
+        cp->blocks[i] = NULL;
+    }
+    cp->base = pc & ~RV32I_PAGE_MASK;
+    code_dir[d][p] = cp;
+    code_pages.push_back(cp);
+    imem->markCode(pc);
+    return cp;
 }
 
+
 /*
- * loads a data from a ascii hexadecimal format file (.txt file)
- * each line in the input file will correspond to a 32bit value
+ * drops every decode cache entry and translated block
+ * must be called whenever the instruction memory is written
+ * */
+void SimpleRV32I::invalidateDecodeCache() {
+    flushBlocks();
+    for(size_t i=0; i<code_pages.size(); i++) {
+        delete code_pages[i];
+    }
+    code_pages.clear();
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        delete [] code_dir[i];
+        code_dir[i] = NULL;
+    }
+    cur_code_base = RV32I_TLB_INVALID;
+    cur_code_page = NULL;
+    code_gen = imem->code_gen;
+}
+
+
+/*
+ * decodes the instruction at pc and stores the result in the decode cache
+ * the operation, register fields and final immediate are resolved once here,
+ * so step() does not need to decode the same instruction word again
+ * returns NULL if pc cannot be fetched from
  * */
+rv32i_decoded *SimpleRV32I::fillDecodeCache(uint32_t pc) {
+    if(pc & 0x3) return NULL;
+    rv32i_code_page *cp = getCodePage(pc);
+    if(cp == NULL) return NULL;
+    cur_code_base = cp->base;
+    cur_code_page = cp;
+    rv32i_decoded *d = &cp->dec[(pc & RV32I_PAGE_MASK) >> 2];
+    if(d->valid) return d;
+
+    RV32I_INST inst = RV32I_INST();
+    uint32_t instruction = *((uint32_t*)(imem->access(pc, RV32I_PERM_X) + (pc & RV32I_PAGE_MASK))); //fetch
+    inst.decodeInst(instruction); //decode
+    d->op = (inst.ext & ~misa_ext) ? ILLEGAL : inst.op; //extensions turned off make their encodings illegal
+    d->rd = inst.rd;
+    d->rs1 = inst.rs1;
+    d->rs2 = inst.rs2;
+    d->imm = inst.imm;
+    d->inst = instruction;
+    d->valid = 1;
+    return d;
+}
 
-void SimpleRV32I::loadData(std::string file) {
-    std::ifstream inFile;
-    inFile.open(file);
-    std::string line;
-    int i = 0;
 
-    if(!inFile.is_open()) {
-        std::cout << "Unable to open file: " << file << std::endl;
-    }
+/*
+ * loads a program binary from a ascii hexadecimal format file (.txt file)
+ * each line in the input file will correspond to a 32bit value
+ * */
+bool SimpleRV32I::loadProgram(std::string file) {
+    bool ok = loadHex(file, imem);
+    invalidateDecodeCache();
+    return ok;
+}
 
-    while(std::getline(inFile, line)) {
-        std::stringstream s;
-        uint32_t data;
-        s << std::hex << line;
-        s >> data;
-        if(i == mem_size) {
-            std::cerr << "Insufficient memory" << std::endl;
-            exit(1);
-        }
-        *((uint32_t*)(data_mem + i)) = data;
-        i += 4;
-    }
-    inFile.close();
+/*
+ * loads a data from a ascii hexadecimal format file (.txt file)
+ * each line in the input file will correspond to a 32bit value
+ * */
+
+bool SimpleRV32I::loadData(std::string file) {
+    return loadHex(file, dmem);
 }
 
 /*
@@ -340,21 +426,27 @@ void SimpleRV32I::loadData(std::string file) {
  * each line in the input file will correspond to a 32bit value
  * */
 
-void SimpleRV32I::dumpData(std::string file) {
+bool SimpleRV32I::dumpData(std::string file) {
     std::ofstream outFile;
     outFile.open(file);
 
     if(!outFile.is_open()) {
-        std::cout << "Unable to open file: " << file << std::endl;
-    }
-
-    for(int i=0; i< mem_size; i+=4) {
-        uint32_t data = *((uint32_t*)(data_mem + i));
-        outFile << "0x" << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
     }
 
+    dumpData(outFile);
     outFile.close();
+    return !outFile.fail();
+}
 
+void SimpleRV32I::dumpData(std::ostream &out) {
+    uint32_t words[RV32I_PAGE_SIZE / 4];
+    for(uint32_t i=0; i + 4 <= mem_size; i+=RV32I_PAGE_SIZE) {
+        uint32_t n = std::min(mem_size - i, (uint32_t)RV32I_PAGE_SIZE) / 4;
+        if(!dmem->read(i, words, 4*n)) memset(words, 0, sizeof(words)); //unmapped
+        writeHexWords(out, words, n);
+    }
 }
 
 /*
@@ -362,59 +454,88 @@ void SimpleRV32I::dumpData(std::string file) {
  * each line in the input file will correspond to a 32bit value
  * */
 
-void SimpleRV32I::dumpRegs(std::string file) {
+bool SimpleRV32I::dumpRegs(std::string file) {
     std::ofstream outFile;
     outFile.open(file);
 
     if(!outFile.is_open()) {
-        std::cout << "Unable to open file: " << file << std::endl;
-    }
-
-    for(int i=0; i< 32; i++) {
-        uint32_t data = regs[i];
-        outFile << "0x" << std::hex << std::setw(8) << std::setfill('0') << data << std::endl;
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
     }
 
+    dumpRegs(outFile);
     outFile.close();
+    return !outFile.fail();
+}
+
+void SimpleRV32I::dumpRegs(std::ostream &out) {
+    writeHexWords(out, regs, 32);
+}
+
+/*
+ * copies guest memory (data view) out/in, ignoring permissions, for
+ * embedders inspecting or patching a model between runs
+ * returns false if part of the range is not mapped
+ * */
+bool SimpleRV32I::readMemory(uint32_t addr, void *buf, uint32_t len) {
+    if((uint64_t)addr + len > 0x100000000ULL) return false;
+    return dmem->read(addr, buf, len);
+}
+
+bool SimpleRV32I::writeMemory(uint32_t addr, const void *buf, uint32_t len) {
+    if((uint64_t)addr + len > 0x100000000ULL) return false;
+    for(uint64_t a=addr & ~RV32I_PAGE_MASK; a<(uint64_t)addr + len; a+=RV32I_PAGE_SIZE) {
+        markDirty(a);
+    }
+    return dmem->write(addr, buf, len); //code pages written are caught up with by syncMemory()
 }
 
 /*
- * steps through the loaded program
+ * steps through the loaded program, one instruction, counted in instret if
+ * it retires
  */
 int SimpleRV32I::step() {
     if(!status) {
-        inst = RV32I_INST();
-        uint32_t instruction = *((uint32_t*)(inst_mem + PC)); //fetch
-        inst.decodeInst(instruction); //decode
-        debug_printf(DEBUG_LOW,"SimpleRV32I::step> %08x %s:%d\n",instruction,__FILE__, __LINE__);
-        switch(inst.getOperation()) { //execute
+        syncMemory();
+        rv32i_decoded *d = decodeAt(PC); //fetch + decode, once per instruction word
+        if(d == NULL) {
+            trap((PC & 0x3) ? RV32I_CAUSE_FETCH_MISALIGNED : RV32I_CAUSE_FETCH_FAULT, PC);
+            return status;
+        }
+        const rv32i_decoded &inst = *d;
+        uint32_t pc = PC;
+        uint32_t addr = regs[inst.rs1] + inst.imm; //load/store address
+        uint32_t data = regs[inst.rs2];     //store data, for the trace (an AMO writes rd, which may be rs2)
+        bool stored = true;                 //false for an SC.W that failed, for the probe
+        debug_printf(DEBUG_LOW,"SimpleRV32I::step> %08x %s:%d\n",inst.inst,__FILE__, __LINE__);
+        switch(inst.op) { //execute
             case LUI:       regs[inst.rd] = inst.imm; PC = PC+4; break;
             case AUIPC:     regs[inst.rd] = PC + inst.imm; PC = PC+4; break;
             case JAL:       regs[inst.rd] = PC+4; PC = PC + inst.imm; break; 
-            case JALR:      regs[inst.rd] = PC+4; PC = (((int32_t)regs[inst.rs1]) + inst.imm) & ~1; break;
+            case JALR:      { uint32_t target = (((int32_t)regs[inst.rs1]) + inst.imm) & ~1; regs[inst.rd] = PC+4; PC = target; } break;
             case BEQ:       PC = PC + ((regs[inst.rs1] == regs[inst.rs2]) ? inst.imm : 4); break; 
             case BNE:       PC = PC + ((regs[inst.rs1] != regs[inst.rs2]) ? inst.imm : 4); break;
             case BLT:       PC = PC + ((((int32_t)regs[inst.rs1]) < ((int32_t)regs[inst.rs2])) ? inst.imm : 4); break;
             case BGE:       PC = PC + ((((int32_t)regs[inst.rs1]) >= ((int32_t)regs[inst.rs2])) ? inst.imm : 4); break;
             case BLTU:      PC = PC + (((uint32_t)(regs[inst.rs1]) <  ((uint32_t)(regs[inst.rs2]))) ? inst.imm : 4); break;
             case BGEU:      PC = PC + (((uint32_t)(regs[inst.rs1]) >= ((uint32_t)(regs[inst.rs2]))) ? inst.imm : 4); break;
-            case LB:        regs[inst.rd]=(int32_t)(*((int8_t*)(data_mem + regs[inst.rs1] + inst.imm))); PC = PC+4; break;
-            case LH:        regs[inst.rd]=(int32_t)(*((int16_t*)(data_mem + regs[inst.rs1] + inst.imm))); PC = PC+4; break;
-            case LW:        regs[inst.rd]=(int32_t)(*((int32_t*)(data_mem + regs[inst.rs1] + inst.imm))); PC = PC+4; break;
-            case LBU:       regs[inst.rd]=(*((uint8_t*)(data_mem + regs[inst.rs1] + inst.imm))); PC = PC+4; break;
-            case LHU:       regs[inst.rd]=(*((uint16_t*)(data_mem + regs[inst.rs1] + inst.imm))); PC = PC+4; break;
-            case SB:        *((uint8_t*)(data_mem + regs[inst.rs1] + inst.imm)) = (uint8_t)(regs[inst.rs2] & 0x000000ff);  PC = PC+4; break;
-            case SH:        *((uint16_t*)(data_mem + regs[inst.rs1] + inst.imm)) = (uint16_t)(regs[inst.rs2] & 0x0000ffff);  PC = PC+4; break;
-            case SW:        *((uint32_t*)(data_mem + regs[inst.rs1] + inst.imm)) = (uint32_t)(regs[inst.rs2] & 0xffffffff);  PC = PC+4; break;
+            case LB:        { int8_t v;   if(load(addr, &v)) { regs[inst.rd] = (int32_t)v; PC = PC+4; } } break;
+            case LH:        { int16_t v;  if(load(addr, &v)) { regs[inst.rd] = (int32_t)v; PC = PC+4; } } break;
+            case LW:        { int32_t v;  if(load(addr, &v)) { regs[inst.rd] = v; PC = PC+4; } } break;
+            case LBU:       { uint8_t v;  if(load(addr, &v)) { regs[inst.rd] = v; PC = PC+4; } } break;
+            case LHU:       { uint16_t v; if(load(addr, &v)) { regs[inst.rd] = v; PC = PC+4; } } break;
+            case SB:        if(store(addr, (uint8_t)(regs[inst.rs2] & 0x000000ff))) PC = PC+4; break;
+            case SH:        if(store(addr, (uint16_t)(regs[inst.rs2] & 0x0000ffff))) PC = PC+4; break;
+            case SW:        if(store(addr, (uint32_t)(regs[inst.rs2] & 0xffffffff))) PC = PC+4; break;
             case ADDI:      regs[inst.rd] = regs[inst.rs1] + inst.imm; PC = PC+4; break; 
             case SLTI:      regs[inst.rd] = ((int32_t)regs[inst.rs1] < ((int32_t)inst.imm)) ? 1 : 0; PC = PC+4; break;
             case SLTIU:     regs[inst.rd] = ((uint32_t)regs[inst.rs1] < ((uint32_t)inst.imm)) ? 1 : 0; PC = PC+4; break;
             case XORI:      regs[inst.rd] = regs[inst.rs1] ^ inst.imm; PC = PC+4; break;
             case ORI:       regs[inst.rd] = regs[inst.rs1] | inst.imm; PC = PC+4; break;
             case ANDI:      regs[inst.rd] = regs[inst.rs1] & inst.imm; PC = PC+4; break;
-            case SLLI:      regs[inst.rd] = regs[inst.rs1] << inst.shamt; PC = PC+4; break;
-            case SRLI:      regs[inst.rd] = regs[inst.rs1] >> inst.shamt; PC = PC+4; break;
-            case SRAI:      regs[inst.rd] = ((int32_t)regs[inst.rs1]) >> inst.shamt; PC = PC+4; break;
+            case SLLI:      regs[inst.rd] = regs[inst.rs1] << inst.imm; PC = PC+4; break;
+            case SRLI:      regs[inst.rd] = regs[inst.rs1] >> inst.imm; PC = PC+4; break;
+            case SRAI:      regs[inst.rd] = ((int32_t)regs[inst.rs1]) >> inst.imm; PC = PC+4; break;
             case ADD:       regs[inst.rd] = regs[inst.rs1] + regs[inst.rs2]; PC = PC+4; break; 
             case SUB:       regs[inst.rd] = regs[inst.rs1] - regs[inst.rs2]; PC = PC+4; break;
             case SLL:       regs[inst.rd] = regs[inst.rs1] << (regs[inst.rs2] & 0x0000001f); PC = PC+4; break;
@@ -425,18 +546,90 @@ int SimpleRV32I::step() {
             case SRA:       regs[inst.rd] = ((int32_t)regs[inst.rs1]) >> (regs[inst.rs2] & 0x0000001f); PC = PC+4; break;
             case OR:        regs[inst.rd] = regs[inst.rs1] | regs[inst.rs2]; PC = PC+4; break; 
             case AND:       regs[inst.rd] = regs[inst.rs1] & regs[inst.rs2]; PC = PC+4; break; 
-            case ECALL:    status=1; break; 
-            case EBREAK:   status=1; break;
-            case CSRRW:     
-            case CSRRS:     
-            case CSRRC:     
-            case CSRRWI:        
-            case CSRRSI:        
-            case CSRRCI:        
-            default:       std::cerr << "Unimplemented" << std::endl; exit(1); break;
+            case MUL:       regs[inst.rd] = rv32i_mulDiv(MUL, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case MULH:      regs[inst.rd] = rv32i_mulDiv(MULH, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case MULHSU:    regs[inst.rd] = rv32i_mulDiv(MULHSU, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case MULHU:     regs[inst.rd] = rv32i_mulDiv(MULHU, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case DIV:       regs[inst.rd] = rv32i_mulDiv(DIV, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case DIVU:      regs[inst.rd] = rv32i_mulDiv(DIVU, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case REM:       regs[inst.rd] = rv32i_mulDiv(REM, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case REMU:      regs[inst.rd] = rv32i_mulDiv(REMU, regs[inst.rs1], regs[inst.rs2]); PC = PC+4; break;
+            case LR_W:
+            case SC_W:
+            case AMOSWAP_W:
+            case AMOADD_W:
+            case AMOXOR_W:
+            case AMOAND_W:
+            case AMOOR_W:
+            case AMOMIN_W:
+            case AMOMAX_W:
+            case AMOMINU_W:
+            case AMOMAXU_W: stored = execAmo(inst); break;
+            case FENCE:     std::atomic_thread_fence(std::memory_order_seq_cst); PC = PC+4; break;
+            case FENCE_I:   code_gen = imem->code_gen - 1; PC = PC+4; break; //the code caches (in use here) go at the next syncMemory()
+            case ECALL:     if(syscalls && syscalls->call(this)) {
+                                syncMemory(); //the syscall may have written guest memory
+                                PC = PC+4;
+                            } else {
+                                status=RV32I_STATUS_HALT;
+                            }
+                            break;
+            case EBREAK:   status=RV32I_STATUS_HALT; break;
+            case CSRRW:
+            case CSRRS:
+            case CSRRC:
+            case CSRRWI:
+            case CSRRSI:
+            case CSRRCI:    execCsr(inst); break;
+            default:        trap(RV32I_CAUSE_ILLEGAL_INST, inst.inst); break; //ILLEGAL
         }   
+        if(!RV32I_STATUS_STOPPED(status)) { //a trapping instruction does not retire
+            cycle += op_cost[inst.op];
+            instret++;
+        }
+        if(trace) {
+            rv32i_trace_record *t = trace->next();
+            t->pc = pc;
+            t->inst = inst.inst;
+            t->rd_value = inst.rd ? regs[inst.rd] : 0;
+            t->addr = addr;
+            t->data = data;
+            t->status = status;
+        }
+        if(probe) probeStep(inst.op, pc, addr, stored);
+        if(profiler && !RV32I_STATUS_STOPPED(status)) {
+            profiler->step(pc, ((inst.op == JAL) || (inst.op == JALR)) ? rv32i_link_kind(inst.op == JALR, inst.rd, inst.rs1) : RV32I_LINK_NONE);
+        }
     }
     regs[0] = 0; //x0 register is always hardwired to 0.
     return status;
 }
 
+
+/*
+ * runs the loaded program on the engine selected at construction time,
+ * until it completes, maxInstructions instructions have been retired or it
+ * reaches a breakpoint/watchpoint
+ * tracing and probes see every instruction, so they run through step() whatever the engine
+ * a model stopped at a breakpoint/watchpoint resumes with the instruction it
+ * stopped at, which does not stop it again
+ * */
+int SimpleRV32I::run(uint64_t maxInstructions) {
+    if(status == RV32I_STATUS_BREAK) {
+        if(maxInstructions == 0) return status;
+        status = RV32I_STATUS_RUNNING;
+        break_ignore = true;
+        step();
+        break_ignore = false;
+        if(RV32I_STATUS_STOPPED(status)) return status;
+        maxInstructions--;
+    }
+    if(((engine == ENGINE_BLOCK) || (engine == ENGINE_JIT)) && !trace && !probe) {
+        runBlocks(maxInstructions);
+    } else {
+        for(uint64_t start = instret; (instret - start < maxInstructions) && !status && !breakAt(PC); ) {
+            step();
+        }
+    }
+    return status;
+}
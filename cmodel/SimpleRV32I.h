@@ -1,6 +1,14 @@
 #ifndef __SIMPLERV32I_H__
 #define __SIMPLERV32I_H__
 #include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <set>
+#include "SimpleRV32I_mem.h"
+#include "SimpleRV32I_trace.h"
+#include "SimpleRV32I_probe.h"
+#include "SimpleRV32I_profile.h"
+#include "SimpleRV32I_syscall.h"
 
 typedef enum {
     U_TYPE,
@@ -50,6 +58,27 @@ typedef enum {
     SRA,
     OR,
     AND,
+    MUL,                //RV32M, see configureIsa()
+    MULH,
+    MULHSU,
+    MULHU,
+    DIV,
+    DIVU,
+    REM,
+    REMU,
+    LR_W,               //RV32A, see configureIsa() and execAmo()
+    SC_W,
+    AMOSWAP_W,
+    AMOADD_W,
+    AMOXOR_W,
+    AMOAND_W,
+    AMOOR_W,
+    AMOMIN_W,
+    AMOMAX_W,
+    AMOMINU_W,
+    AMOMAXU_W,
+    FENCE,
+    FENCE_I,            //Zifencei
     ECALL,
     EBREAK,
     CSRRW,
@@ -57,10 +86,39 @@ typedef enum {
     CSRRC,
     CSRRWI,
     CSRRSI,
-    CSRRCI
+    CSRRCI,
+    ILLEGAL             //not an RV32I/Zicsr encoding, step() raises an illegal instruction trap
 } rv32i_operation;
 
+#define RV32I_NUM_OPS   (ILLEGAL + 1)
 
+/*
+ * RV32M multiply/divide, with the results the spec gives for a division by
+ * zero (quotient all ones, remainder the dividend) and for the signed
+ * overflow -2^31 / -1 (quotient -2^31, remainder 0)
+ * */
+static inline uint32_t rv32i_mulDiv(int op, uint32_t a, uint32_t b) {
+    switch(op) {
+        case MUL:       return a * b;
+        case MULH:      return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+        case MULHSU:    return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+        case MULHU:     return (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+        case DIV:       if(b == 0) return 0xffffffff;
+                        if((a == 0x80000000) && (b == 0xffffffff)) return a;
+                        return (uint32_t)((int32_t)a / (int32_t)b);
+        case DIVU:      return b ? a / b : 0xffffffff;
+        case REM:       if(b == 0) return a;
+                        if((a == 0x80000000) && (b == 0xffffffff)) return 0;
+                        return (uint32_t)((int32_t)a % (int32_t)b);
+        default:        return b ? a % b : a; //REMU
+    }
+}
+
+
+/*
+ * an instruction decoded by a lookup in a table generated at compile time
+ * from the encodings of RV32I and its extensions (SimpleRV32I_decode.cpp)
+ * */
 class RV32I_INST {
     public:
         uint8_t     opcode;
@@ -70,33 +128,407 @@ class RV32I_INST {
         uint8_t     rd;
         uint8_t     rs1;
         uint8_t     rs2;
-        int32_t     imm;
+        int32_t     imm;            //shift amount for SLLI/SRLI/SRAI, CSR number for the CSR ops
         uint32_t    inst;
+        rv32i_operation op;         //ILLEGAL for anything that is not an encoding of the table
+        rv32i_op_type   type;
+        uint32_t    ext;            //RV32I_MISA_* extension op needs, 0 for RV32I/Zicsr/Zifencei
 
-        rv32i_op_type     getType();
-        rv32i_operation   getOperation();
+        rv32i_op_type     getType() { return type; }
+        rv32i_operation   getOperation() { return op; }
         void decodeInst(uint32_t inst);
-        RV32I_INST(); 
+        RV32I_INST();
 };
 
+/*
+ * predecoded form of an instruction, as held in the decode cache
+ * (one entry per 32bit word of instruction memory)
+ * */
+typedef struct {
+    rv32i_operation op;
+    uint8_t     rd;
+    uint8_t     rs1;
+    uint8_t     rs2;
+    uint8_t     valid;
+    int32_t     imm;    //final immediate (shift amount for SLLI/SRLI/SRAI, CSR number for CSR*)
+    uint32_t    inst;   //raw instruction word
+} rv32i_decoded;
+
+/*
+ * execution engines, selected when the model is constructed
+ * */
+typedef enum {
+    ENGINE_INTERP,      //reference interpreter: decode cache + switch, one step() per instruction
+    ENGINE_BLOCK,       //basic block translation with direct threaded dispatch
+    ENGINE_JIT          //ENGINE_BLOCK, with hot blocks translated to native x86-64 code
+} rv32i_engine;
+
+/*
+ * one translated instruction within a basic block
+ * for AUIPC/branches/JAL the imm field already holds the absolute result/target
+ * */
+typedef struct {
+    const void  *handler;
+    uint8_t     rd;
+    uint8_t     rs1;
+    uint8_t     rs2;
+    int32_t     imm;
+} rv32i_block_op;
+
+/*
+ * a translated basic block: straight line code ending at a JAL/JALR/B*,
+ * ECALL/EBREAK, an instruction the translator leaves to step(), or the
+ * block length limit
+ * */
+typedef struct rv32i_block {
+    uint32_t    pc;                 //address of the first instruction
+    uint32_t    n;                  //number of guest instructions retired by a full run of the block
+    struct rv32i_block *next[2];    //chained successors: [0] fall through/not taken, [1] taken
+    rv32i_block_op *ops;            //n ops followed by the exit op
+    uint32_t    cycles;             //cost of a full run of the block, see configureCounters()
+    uint8_t     link;               //RV32I_LINK_* of the exit (call/return)
+    uint64_t    *profile;           //execution counter, if a profiler is attached
+    uint32_t    count;              //executions so far, used to find hot blocks
+    const void  *jit;               //native translation, NULL until the block gets hot
+} rv32i_block;
+
+#define RV32I_MAX_BLOCK_LEN 256
+
+/*
+ * decode cache and block map for one page of instruction memory
+ * blocks never cross a page boundary, so a page can be dropped on its own
+ * */
+#define RV32I_PAGE_WORDS    (RV32I_PAGE_SIZE/4)
+typedef struct {
+    rv32i_decoded   dec[RV32I_PAGE_WORDS];
+    rv32i_block     *blocks[RV32I_PAGE_WORDS];
+    uint32_t        base;       //guest address of the page
+} rv32i_code_page;
+
+#define RV32I_JIT_CACHE_SIZE    (16*1024*1024)  //default size of the native code cache, in bytes
+#define RV32I_JIT_THRESHOLD     64              //default number of executions before a block is compiled
+
+/*
+ * guest memory layout: separate instruction/data address spaces (the
+ * original Harvard model) or one address space for both
+ * */
+typedef enum {
+    MEM_SPLIT,
+    MEM_UNIFIED
+} rv32i_mem_layout;
+
+//model status, as returned by step()/run()
+#define RV32I_STATUS_RUNNING    0
+#define RV32I_STATUS_HALT       1   //ECALL/EBREAK
+#define RV32I_STATUS_TRAP       2   //guest exception, see getTrapCause()/getTrapValue()
+#define RV32I_STATUS_BREAK      3   //breakpoint/watchpoint, the next run() resumes
+
+//TRAP/BREAK stop before the instruction at PC, which does not retire
+#define RV32I_STATUS_STOPPED(s) ((s) >= RV32I_STATUS_TRAP)
+
+//trap causes (mcause exception codes)
+#define RV32I_CAUSE_FETCH_MISALIGNED    0
+#define RV32I_CAUSE_FETCH_FAULT         1
+#define RV32I_CAUSE_ILLEGAL_INST        2
+#define RV32I_CAUSE_LOAD_MISALIGNED     4   //LR only, other loads/stores may be misaligned
+#define RV32I_CAUSE_LOAD_FAULT          5
+#define RV32I_CAUSE_STORE_MISALIGNED    6   //SC/AMO only
+#define RV32I_CAUSE_STORE_FAULT         7
+
+/*
+ * instruction classes of the cycle cost model, each class costs a
+ * configurable number of cycles (default 1), see configureCounters()
+ * */
+typedef enum {
+    COST_ALU,           //LUI/AUIPC, register and immediate arithmetic
+    COST_LOAD,
+    COST_STORE,
+    COST_BRANCH,        //conditional branches, taken or not
+    COST_JUMP,          //JAL/JALR
+    COST_SYSTEM,        //ECALL/EBREAK/CSR*
+    COST_CLASSES
+} rv32i_cost_class;
+
+#define RV32I_TIME_DIVIDER  1   //default cycles per tick of the time CSR
+
+/*
+ * why runUntil() returned
+ * */
+typedef enum {
+    STOP_ECALL,
+    STOP_EBREAK,
+    STOP_BUDGET,        //maxInstructions retired
+    STOP_BREAKPOINT,    //PC reached a breakpoint, the instruction there has not run
+    STOP_WATCHPOINT,    //the instruction at PC accesses a watched range, it has not run
+    STOP_FAULT          //guest trap
+} rv32i_stop_reason;
+
+typedef struct {
+    rv32i_stop_reason reason;
+    uint32_t    pc;         //where the model stopped, the next instruction to run for STOP_BUDGET
+    uint32_t    addr;       //STOP_WATCHPOINT: address accessed, STOP_FAULT: trap value
+    uint32_t    cause;      //STOP_FAULT: trap cause
+    uint64_t    retired;    //instructions retired by this run
+} rv32i_stop;
+
+//watchpoint kinds, accesses that stop the model
+#define RV32I_WATCH_READ    RV32I_PERM_R
+#define RV32I_WATCH_WRITE   RV32I_PERM_W
+#define RV32I_WATCH_ACCESS  (RV32I_WATCH_READ | RV32I_WATCH_WRITE)
+
+typedef struct {
+    uint32_t    addr;
+    uint32_t    len;
+    uint8_t     kind;       //RV32I_WATCH_*
+} rv32i_watchpoint;
+
+//page bitmaps of breakpoints/watchpoints, one bit per guest page
+#define RV32I_BREAK_MAP_WORDS   ((1 << (32 - RV32I_PAGE_BITS)) / 64)
+
+//misa extension bits the model implements (I is always there), see configureIsa()
+#define RV32I_MISA_A            (1 << 0)
+#define RV32I_MISA_I            (1 << 8)
+#define RV32I_MISA_M            (1 << 12)
+
+#define RV32I_RESV_NONE         0xffffffff  //no LR reservation
+
+//CSR numbers (Zicsr), anything not listed is an illegal instruction
+#define RV32I_CSR_MSCRATCH      0x340
+#define RV32I_CSR_MISA          0x301
+#define RV32I_CSR_MCYCLE        0xb00
+#define RV32I_CSR_MINSTRET      0xb02
+#define RV32I_CSR_MCYCLEH       0xb80
+#define RV32I_CSR_MINSTRETH     0xb82
+#define RV32I_CSR_CYCLE         0xc00
+#define RV32I_CSR_TIME          0xc01
+#define RV32I_CSR_INSTRET       0xc02
+#define RV32I_CSR_CYCLEH        0xc80
+#define RV32I_CSR_TIMEH         0xc81
+#define RV32I_CSR_INSTRETH      0xc82
+#define RV32I_CSR_MVENDORID     0xf11
+#define RV32I_CSR_MARCHID       0xf12
+#define RV32I_CSR_MIMPID        0xf13
+#define RV32I_CSR_MHARTID       0xf14
+
 class SimpleRV32I {
+    friend class RV32I_LOCKSTEP;    //runs the instructions of many models at once
+    friend class RV32I_TIMING;      //steps the instructions it times
+    friend class RV32I_SMP;         //runs harts sharing one memory
+    friend class RV32I_DIFF;        //compares the models it runs
+
     private:
         uint32_t regs[32];
         uint32_t mem_size;
-        uint8_t *inst_mem;
-        uint8_t *data_mem;
-        RV32I_INST inst;
+        RV32I_MEM *imem;    //instruction view
+        RV32I_MEM *dmem;    //data view, same object as imem for MEM_UNIFIED
+        rv32i_tlb_entry tlb_rd[RV32I_TLB_SIZE];
+        rv32i_tlb_entry tlb_wr[RV32I_TLB_SIZE];
+        bool mem_shared;    //imem/dmem belong to another hart, see SimpleRV32I(SimpleRV32I*, uint32_t)
+        uint32_t hart_id;   //mhartid
+        uint32_t resv_addr; //LR.W reservation, RV32I_RESV_NONE if there is none
+        uint32_t resv_value;    //value LR.W read
+        uint32_t resv_gen;      //generation of the reservation set LR.W saw, see RV32I_MEM::resvSet()
+        uint32_t code_gen;  //imem->code_gen the code caches were built against
+        uint32_t tlb_gen;   //dmem->tlb_gen the write TLB was filled against
+        rv32i_code_page **code_dir[RV32I_DIR_SIZE];
+        std::vector<rv32i_code_page*> code_pages;
+        uint32_t cur_code_base;
+        rv32i_code_page *cur_code_page;
+        rv32i_engine engine;
         uint8_t status;
         uint32_t PC;
+        uint32_t trap_cause;
+        uint32_t trap_value;
+        uint64_t instret;   //instructions retired, counted by step() and per block by the block engines
+        uint64_t cycle;     //cost model cycles, kept per block by the block engines
+        int64_t cycle_off;  //mcycle/minstret writes, as offsets from cycle/instret
+        int64_t instret_off;
+        uint32_t mscratch;
+        uint32_t isa_ext;   //RV32I_MISA_* extensions besides I selected by configureIsa()
+        uint32_t misa_ext;  //the ones enabled now (misa is writable), M encodings are illegal without RV32I_MISA_M
+        uint32_t costs[COST_CLASSES];
+        uint32_t op_cost[RV32I_NUM_OPS];
+        uint32_t time_div;
+        RV32I_TRACE *trace; //NULL unless tracing is enabled
+        RV32I_PROBE *probe; //NULL unless a probe is attached
+        RV32I_PROFILER *profiler;   //NULL unless a profiler is attached
+        RV32I_SYSCALLS *syscalls;   //NULL: ECALL halts
+        uint32_t image_end;     //end of the loaded image, where the heap starts
+        uint64_t *break_map;    //pages holding a breakpoint, NULL if there is none
+        uint64_t *watch_map;    //pages holding a watched range (kept out of the TLBs), NULL if there is none
+        std::set<uint32_t> breakpoints;
+        std::vector<rv32i_watchpoint> watchpoints;
+        bool break_watch;       //RV32I_STATUS_BREAK is a watchpoint hit, at watch_addr
+        uint32_t watch_addr;
+        bool break_ignore;      //resuming: the instruction at PC runs without stopping again
+        uint64_t *dirty_map;    //pages stored to since takeDirtyPages(), NULL unless tracking
+        std::vector<uint32_t> dirty_pages;  //their page numbers, in the order they were first stored to
+
+        rv32i_code_page *getCodePage(uint32_t pc);
+        rv32i_decoded *fillDecodeCache(uint32_t pc);
+        void invalidateDecodeCache();
+        rv32i_block *translateBlock(uint32_t pc, const void * const *handlers);
+        rv32i_block *lookupBlock(uint32_t pc, const void * const *handlers);
+        void flushBlocks();
+        void runBlocks(uint64_t maxInstructions);
+        uint8_t *jit_cache;
+        uint32_t jit_cache_size;
+        uint32_t jit_cache_used;
+        uint32_t jit_threshold;
+        uint32_t block_len;     //most instructions per translated block, RV32I_DIFF sets 1 to single out one
+        void compileBlock(rv32i_block *blk);
+        void flushJitCache();
+        bool loadHex(std::string file, RV32I_MEM *mem);
+        bool loadElfImage(const uint8_t *image, size_t size, const std::string &name);
+        uint32_t blockCycles(uint32_t pc, uint32_t n);
+        bool csrRead(uint32_t csr, uint32_t *value);
+        bool csrWrite(uint32_t csr, uint32_t value, uint32_t cost);
+        void execCsr(const rv32i_decoded &inst);
+        uint32_t *amoAccess(uint32_t addr, bool write);
+        bool execAmo(const rv32i_decoded &inst);
+        void init(rv32i_engine engine);
+        void probeStep(rv32i_operation op, uint32_t pc, uint32_t addr, bool stored);
+        bool hitBreakpoint(uint32_t pc);
+        bool hitWatchpoint(uint32_t addr, uint32_t size, uint8_t kind);
+        void updateBreakMaps(bool code, bool data);
+
+        void trap(uint32_t cause, uint32_t value);
+        void flushTlb();
+        void memorySync();
+        bool loadSlow(uint32_t addr, void *value, uint32_t size);
+        bool storeSlow(uint32_t addr, const void *value, uint32_t size);
+
+        /*
+         * returns the decoded instruction at pc, NULL if it cannot be fetched
+         * */
+        inline rv32i_decoded *decodeAt(uint32_t pc) {
+            if((pc & ~(uint32_t)(RV32I_PAGE_MASK & ~0x3)) == cur_code_base) {
+                rv32i_decoded *d = &cur_code_page->dec[(pc & RV32I_PAGE_MASK) >> 2];
+                if(d->valid) return d;
+            }
+            return fillDecodeCache(pc);
+        }
+
+        static inline bool pageBit(const uint64_t *map, uint32_t addr) {
+            uint32_t page = addr >> RV32I_PAGE_BITS;
+            return (map[page >> 6] >> (page & 63)) & 1;
+        }
+
+        inline bool isBreakpoint(uint32_t pc) {
+            return break_map && pageBit(break_map, pc) && breakpoints.count(pc);
+        }
+
+        /*
+         * stops the model (RV32I_STATUS_BREAK) if there is a breakpoint at pc,
+         * one bit test when the page has none
+         * */
+        inline bool breakAt(uint32_t pc) {
+            return break_map && pageBit(break_map, pc) && hitBreakpoint(pc);
+        }
+
+        /*
+         * records a store to the page holding addr, from the store slow paths
+         * and writeMemory():
+         * write TLB entries are dropped whenever the pages are taken, so the
+         * first store to a page after that goes the slow way
+         * */
+        inline void markDirty(uint32_t addr) {
+            if(dirty_map && !pageBit(dirty_map, addr)) {
+                uint32_t page = addr >> RV32I_PAGE_BITS;
+                dirty_map[page >> 6] |= 1ull << (page & 63);
+                dirty_pages.push_back(page);
+            }
+        }
+
+        //true if an access to [addr, addr+size) may hit a watchpoint
+        inline bool watched(uint32_t addr, uint32_t size) {
+            return watch_map && (pageBit(watch_map, addr) || pageBit(watch_map, addr + size - 1));
+        }
+
+        /*
+         * catches up with writes to code pages and pages leaving the write
+         * TLB, done between instructions/blocks
+         * */
+        inline void syncMemory() {
+            if((imem->code_gen != code_gen) || (dmem->tlb_gen != tlb_gen)) memorySync();
+        }
+
+        /*
+         * guest loads/stores: one TLB compare and an add, anything else
+         * (TLB miss, misaligned, unmapped, no permission) goes the slow way
+         * a failed access has raised a trap
+         * */
+        template<typename T> inline bool load(uint32_t addr, T *value) {
+            const rv32i_tlb_entry *e = &tlb_rd[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)];
+            if(e->tag == (addr & ~(uint32_t)(RV32I_PAGE_MASK & ~(sizeof(T) - 1)))) {
+                *value = *((T*)(e->addend + addr));
+                return true;
+            }
+            return loadSlow(addr, value, sizeof(T));
+        }
+
+        template<typename T> inline bool store(uint32_t addr, T value) {
+            const rv32i_tlb_entry *e = &tlb_wr[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)];
+            if(e->tag == (addr & ~(uint32_t)(RV32I_PAGE_MASK & ~(sizeof(T) - 1)))) {
+                *((T*)(e->addend + addr)) = value;
+                return true;
+            }
+            return storeSlow(addr, &value, sizeof(T));
+        }
 
     public:
-        SimpleRV32I(int=4000);
+        SimpleRV32I(int=4000, rv32i_engine=ENGINE_INTERP, rv32i_mem_layout=MEM_SPLIT);
+        SimpleRV32I(SimpleRV32I *primary, uint32_t hartId);
         ~SimpleRV32I();
-        void loadProgram(std::string="code.txt");
-        void loadData(std::string="data.txt");
-        void dumpData(std::string="data_out.txt");
-        void dumpRegs(std::string="regs_out.txt");
+        void reset();
+        SimpleRV32I *fork();
+        SimpleRV32I *fork(rv32i_engine engine);
+        bool loadProgram(std::string="code.txt");
+        bool loadData(std::string="data.txt");
+        bool loadElf(std::string file);
+        bool loadElf(const void *image, size_t size);
+        bool loadBinary(std::string file, uint32_t addr=0);
+        bool loadBinary(const void *image, size_t size, uint32_t addr=0);
+        bool mapMemory(uint32_t base, uint32_t size, uint8_t perms=RV32I_PERM_RW);
+        bool saveCheckpoint(std::string file);
+        bool loadCheckpoint(std::string file);
+        bool dumpData(std::string="data_out.txt");
+        bool dumpRegs(std::string="regs_out.txt");
+        void dumpData(std::ostream &out);
+        void dumpRegs(std::ostream &out);
+        bool saveDump(std::string file, bool diff=false);
         int step();
+        int run(uint64_t maxInstructions=UINT64_MAX);
+        rv32i_stop runUntil(uint64_t maxInstructions=UINT64_MAX);
+        rv32i_stop runUntilPc(uint32_t pc, uint64_t maxInstructions=UINT64_MAX);
+        void addBreakpoint(uint32_t pc);
+        void removeBreakpoint(uint32_t pc);
+        void addWatchpoint(uint32_t addr, uint32_t len, uint8_t kind=RV32I_WATCH_ACCESS);
+        void removeWatchpoint(uint32_t addr, uint32_t len);
+        void clearBreakpoints();
+        void configureJit(uint32_t codeCacheSize=RV32I_JIT_CACHE_SIZE, uint32_t hotThreshold=RV32I_JIT_THRESHOLD);
+        void configureCounters(const uint32_t *classCosts=NULL, uint32_t timeDivider=RV32I_TIME_DIVIDER);
+        void configureIsa(uint32_t extensions=0);
+        void enableTrace(uint64_t records=RV32I_TRACE_SIZE);
+        bool saveTrace(std::string file);
+        void attachProbe(RV32I_PROBE *probe);
+        void attachProfiler(RV32I_PROFILER *profiler);
+        void attachSyscalls(RV32I_SYSCALLS *syscalls);
+        void trackDirtyPages(bool on);
+        void takeDirtyPages(std::vector<uint32_t> &pages);
+        bool readMemory(uint32_t addr, void *buf, uint32_t len);
+        bool writeMemory(uint32_t addr, const void *buf, uint32_t len);
+        uint32_t getPC() { return PC; }
+        void setPC(uint32_t pc) { PC = pc; }
+        uint8_t getStatus() { return status; }
+        uint32_t getReg(int i) { return regs[i & 31]; }
+        void setReg(int i, uint32_t value) { if(i & 31) regs[i & 31] = value; }
+        uint32_t getTrapCause() { return trap_cause; }
+        uint32_t getTrapValue() { return trap_value; }
+        uint64_t getInstret() { return instret; }
+        uint64_t getCycles() { return cycle; }
+        uint32_t getImageEnd() { return image_end; }
+        uint32_t getHartId() { return hart_id; }
 };
 
 
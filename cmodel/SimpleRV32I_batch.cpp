@@ -0,0 +1,562 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <unistd.h>
+#include "SimpleRV32I_batch.h"
+#include "SimpleRV32I_utils.h"
+
+
+//true if file starts with the ELF magic
+bool isElf(const std::string &file) {
+    char magic[4] = {0};
+    std::ifstream in(file.c_str(), std::ios::binary);
+    in.read(magic, 4);
+    return (magic[0] == 0x7f) && (magic[1] == 'E') && (magic[2] == 'L') && (magic[3] == 'F');
+}
+
+static bool hasSuffix(const std::string &s, const char *suffix) {
+    size_t m = strlen(suffix);
+    return (s.size() >= m) && !s.compare(s.size() - m, m, suffix);
+}
+
+static bool readFile(const std::string &file, std::string *contents) {
+    std::ifstream in(file.c_str(), std::ios::binary);
+    if(!in.is_open()) return false;
+    std::ostringstream s;
+    s << in.rdbuf();
+    *contents = s.str();
+    return true;
+}
+
+/*
+ * compares a dump with the expected file, returns an empty string if they
+ * match, otherwise a description of the first difference
+ * */
+static std::string compareDump(const char *what, const std::string &got, const std::string &expected) {
+    if(got == expected) return "";
+    size_t i = 0, line = 1;
+    while((i < got.size()) && (i < expected.size()) && (got[i] == expected[i])) {
+        if(got[i] == '\n') line++;
+        i++;
+    }
+    size_t g = got.rfind('\n', i ? i - 1 : 0), e = expected.rfind('\n', i ? i - 1 : 0);
+    g = ((g == std::string::npos) || (i == 0)) ? 0 : g + 1;
+    e = ((e == std::string::npos) || (i == 0)) ? 0 : e + 1;
+    std::ostringstream s;
+    s << what << " line " << std::dec << line << ": got '" << got.substr(g, got.find('\n', g) - g)
+      << "' expected '" << expected.substr(e, expected.find('\n', e) - e) << "'";
+    return s.str();
+}
+
+static const char *engineName(rv32i_engine engine) {
+    switch(engine) {
+        case ENGINE_BLOCK:  return "block";
+        case ENGINE_JIT:    return "jit";
+        default:            return "interp";
+    }
+}
+
+
+/*
+ * parses <base>:<size>[:perms] into a region, perms is any of r/w/x
+ * (default: rw)
+ * */
+bool parseRegion(const char *arg, uint32_t *base, uint32_t *size, uint8_t *perms) {
+    char *end;
+    *base = strtoul(arg, &end, 0);
+    if(*end != ':') return false;
+    *size = strtoul(end + 1, &end, 0);
+    *perms = RV32I_PERM_RW;
+    if(*end == ':') {
+        *perms = 0;
+        for(end++; *end; end++) {
+            if(*end == 'r') *perms |= RV32I_PERM_R;
+            else if(*end == 'w') *perms |= RV32I_PERM_W;
+            else if(*end == 'x') *perms |= RV32I_PERM_X;
+            else return false;
+        }
+    }
+    return *end == 0;
+}
+
+
+/*
+ * parses <addr>[:<len>[:kind]] into a watchpoint, kind is any of r/w
+ * (default: 4 bytes, rw)
+ * */
+bool parseWatchpoint(const char *arg, rv32i_watchpoint *w) {
+    char *end;
+    w->addr = strtoul(arg, &end, 0);
+    w->len = 4;
+    w->kind = RV32I_WATCH_ACCESS;
+    if(*end == ':') w->len = strtoul(end + 1, &end, 0);
+    if(*end == ':') {
+        w->kind = 0;
+        for(end++; *end; end++) {
+            if(*end == 'r') w->kind |= RV32I_WATCH_READ;
+            else if(*end == 'w') w->kind |= RV32I_WATCH_WRITE;
+            else return false;
+        }
+    }
+    return (*end == 0) && w->len && w->kind;
+}
+
+
+/*
+ * parses <class>=<cycles>[,<class>=<cycles>]... into a cost table, classes
+ * are alu/load/store/branch/jump/system, the ones not given are left as they are
+ * */
+bool parseCosts(const char *arg, uint32_t *costs) {
+    static const char * const names[COST_CLASSES] = { "alu", "load", "store", "branch", "jump", "system" };
+    std::stringstream fields(arg);
+    std::string field;
+    while(std::getline(fields, field, ',')) {
+        size_t eq = field.find('=');
+        int c;
+        for(c=0; c<COST_CLASSES; c++) {
+            if(field.substr(0, eq) == names[c]) break;
+        }
+        if((eq == std::string::npos) || (c == COST_CLASSES)) return false;
+        costs[c] = strtoul(field.c_str() + eq + 1, NULL, 0);
+    }
+    return true;
+}
+
+
+/*
+ * parses an ISA string, rv32i followed by the extensions (m, a), into
+ * RV32I_MISA_* bits
+ * */
+bool parseIsa(const char *arg, uint32_t *extensions) {
+    if(strncmp(arg, "rv32i", 5)) return false;
+    *extensions = 0;
+    for(arg += 5; *arg; arg++) {
+        uint32_t bit = (*arg == 'm') ? RV32I_MISA_M : ((*arg == 'a') ? RV32I_MISA_A : 0);
+        if(!bit || (*extensions & bit)) return false;
+        *extensions |= bit;
+    }
+    return true;
+}
+
+
+/*
+ * loads a program (ELF, raw .bin image or hex text) and, if data is not
+ * empty, a hex text data image, the same way for single runs and batch jobs
+ * returns false if one of the files cannot be read or loaded (the other one is loaded)
+ * */
+bool loadImage(SimpleRV32I &cpu, const std::string &program, const std::string &data) {
+    bool ok = true;
+    if(access(program.c_str(), R_OK)) ok = false;
+    else if(isElf(program)) ok = cpu.loadElf(program);
+    else if(hasSuffix(program, ".bin")) ok = cpu.loadBinary(program);
+    else ok = cpu.loadProgram(program);
+    if(data.empty()) return ok;
+    if(access(data.c_str(), R_OK)) return false;
+    return cpu.loadData(data) && ok;
+}
+
+
+RV32I_BATCH::RV32I_BATCH(const rv32i_batch_options &opts) {
+    this->opts = opts;
+    queues = NULL;
+    nqueues = 0;
+    memset(&lockstep_stats, 0, sizeof(lockstep_stats));
+}
+
+RV32I_BATCH::~RV32I_BATCH() {
+    delete [] queues;
+    for(size_t i=0; i<goldens.size(); i++) {
+        delete goldens[i].cpu;
+    }
+}
+
+
+/*
+ * reads the job list, returns false (after reporting the line) on a
+ * malformed manifest
+ * */
+bool RV32I_BATCH::loadManifest(std::string file) {
+    std::ifstream in(file.c_str());
+    std::string line;
+    std::string dir;
+    int lineNo = 0;
+
+    if(!in.is_open()) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    if(file.rfind('/') != std::string::npos) dir = file.substr(0, file.rfind('/') + 1);
+
+    while(std::getline(in, line)) {
+        lineNo++;
+        if(line.find('#') != std::string::npos) line.erase(line.find('#'));
+        std::istringstream fields(line);
+        std::string field;
+        rv32i_job job;
+        job.max = UINT64_MAX;
+        job.layout = MEM_SPLIT;
+        bool any = false;
+
+        while(fields >> field) {
+            size_t eq = field.find('=');
+            std::string key = field.substr(0, eq);
+            std::string value = (eq == std::string::npos) ? "" : field.substr(eq + 1);
+            std::string path = (value.empty() || (value[0] == '/')) ? value : dir + value;
+            uint32_t base, size;
+            uint8_t perms;
+            any = true;
+            if((eq == std::string::npos) || value.empty()) key = "";
+            if(key == "name") job.name = value;
+            else if(key == "program") job.program = path;
+            else if(key == "checkpoint") job.checkpoint = path;
+            else if(key == "data") job.data = path;
+            else if(key == "expect_data") job.expect_data = path;
+            else if(key == "expect_regs") job.expect_regs = path;
+            else if(key == "max") job.max = strtoull(value.c_str(), NULL, 0);
+            else if(key == "unified") job.layout = (value == "0") ? MEM_SPLIT : MEM_UNIFIED;
+            else if((key == "map") && parseRegion(value.c_str(), &base, &size, &perms)) job.regions.push_back(value);
+            else {
+                std::cerr << file << ":" << lineNo << ": invalid field '" << field << "'" << std::endl;
+                return false;
+            }
+        }
+        if(!any) continue;
+        if(job.program.empty() == job.checkpoint.empty()) {
+            std::cerr << file << ":" << lineNo << ": a job needs either a program or a checkpoint" << std::endl;
+            return false;
+        }
+        if(job.name.empty()) job.name = job.program.empty() ? job.checkpoint : job.program;
+        job.golden = -1;
+        job.lockstep = false;
+        jobs.push_back(job);
+    }
+
+    //jobs with the same inputs share a golden model, lockstep jobs the same inputs but their data
+    std::map<std::string, std::vector<size_t> > inputs;
+    for(size_t i=0; i<jobs.size(); i++) {
+        bool lockstep = opts.lockstep && jobs[i].checkpoint.empty() && (jobs[i].layout == MEM_SPLIT);
+        std::string key = (lockstep ? "lockstep\n" : "") + jobs[i].program + "\n" + jobs[i].checkpoint + "\n" +
+                          (lockstep ? "" : jobs[i].data) + "\n" + (char)('0' + jobs[i].layout);
+        for(size_t r=0; r<jobs[i].regions.size(); r++) {
+            key += "\n" + jobs[i].regions[r];
+        }
+        inputs[key].push_back(i);
+    }
+    std::deque<rv32i_golden>().swap(goldens);
+    for(std::map<std::string, std::vector<size_t> >::iterator it = inputs.begin(); it != inputs.end(); it++) {
+        if(it->second.size() < 2) continue;
+        goldens.emplace_back();
+        goldens.back().cpu = NULL;
+        for(size_t j=0; j<it->second.size(); j++) {
+            jobs[it->second[j]].golden = goldens.size() - 1;
+            jobs[it->second[j]].lockstep = !it->first.compare(0, 9, "lockstep\n");
+        }
+    }
+    debug_printf(DEBUG_LOW,"RV32I_BATCH::loadManifest> %d jobs %s:%d\n",(int)jobs.size(),__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * loads the job's memory regions and inputs (but its data unless withData)
+ * into a new (or reset) model, returns false (with the reason in error) if
+ * they cannot be loaded
+ * */
+bool RV32I_BATCH::prepare(const rv32i_job &job, SimpleRV32I *cpu, std::string *error, bool withData) {
+    cpu->configureJit(opts.jit_cache_size, opts.jit_threshold);
+    cpu->configureCounters(opts.costs, opts.time_div);
+    cpu->configureIsa(opts.isa_ext);
+    for(size_t r=0; r < opts.regions.size() + job.regions.size(); r++) {
+        const std::string &region = (r < opts.regions.size()) ? opts.regions[r] : job.regions[r - opts.regions.size()];
+        uint32_t base, size;
+        uint8_t perms;
+        if(!parseRegion(region.c_str(), &base, &size, &perms) || !cpu->mapMemory(base, size, perms)) {
+            *error = "invalid memory region " + region;
+            return false;
+        }
+    }
+    if(!job.checkpoint.empty() && !cpu->loadCheckpoint(job.checkpoint)) {
+        *error = "unable to restore " + job.checkpoint;
+        return false;
+    } else if(job.checkpoint.empty() && !loadImage(*cpu, job.program, withData ? job.data : "")) {
+        *error = "unable to read " + job.program + ((job.data.empty() || !withData) ? "" : " or " + job.data);
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * records the result of job i, run on cpu from start instructions retired
+ * (a checkpoint carries the instructions it was taken after)
+ * */
+void RV32I_BATCH::checkJob(size_t i, SimpleRV32I *cpu, uint64_t start) {
+    const rv32i_job &job = jobs[i];
+    rv32i_job_result &res = results[i];
+    int status = cpu->getStatus();
+    std::ostringstream data, regs;
+    std::string expected;
+
+    res.instret = cpu->getInstret() - start;
+    cpu->dumpData(data);
+    cpu->dumpRegs(regs);
+    if(!opts.out_dir.empty()) {
+        std::ofstream(opts.out_dir + "/" + job.name + ".data_out.txt") << data.str();
+        std::ofstream(opts.out_dir + "/" + job.name + ".regs_out.txt") << regs.str();
+    }
+
+    if(status == RV32I_STATUS_TRAP) {
+        std::ostringstream s;
+        s << "cause " << std::dec << cpu->getTrapCause() << " value 0x" << std::hex << cpu->getTrapValue()
+          << " pc 0x" << cpu->getPC();
+        res.status = JOB_TRAP;
+        res.detail = s.str();
+    } else if(status == RV32I_STATUS_RUNNING) {
+        res.status = JOB_LIMIT;
+        res.detail = "no halt after " + std::to_string(job.max) + " instructions";
+    } else if(!job.expect_data.empty() && !readFile(job.expect_data, &expected)) {
+        res.status = JOB_ERROR;
+        res.detail = "unable to read " + job.expect_data;
+    } else if(!job.expect_data.empty() && !(res.detail = compareDump("data", data.str(), expected)).empty()) {
+        res.status = JOB_FAIL;
+    } else if(!job.expect_regs.empty() && !readFile(job.expect_regs, &expected)) {
+        res.status = JOB_ERROR;
+        res.detail = "unable to read " + job.expect_regs;
+    } else if(!job.expect_regs.empty() && !(res.detail = compareDump("regs", regs.str(), expected)).empty()) {
+        res.status = JOB_FAIL;
+    }
+}
+
+
+/*
+ * runs job i and records its result, jobs sharing their inputs with other
+ * jobs run on a fork of a golden model loaded once for all of them, the
+ * others on a reset of the worker's model from a previous job (spare,
+ * one per memory layout)
+ * */
+void RV32I_BATCH::runJob(size_t i, SimpleRV32I **spare) {
+    const rv32i_job &job = jobs[i];
+    rv32i_job_result &res = results[i];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SimpleRV32I *cpu;
+
+    res.status = JOB_PASS;
+    res.instret = 0;
+    if(job.golden >= 0) {
+        rv32i_golden &g = goldens[job.golden];
+        std::call_once(g.once, [&]() {
+            g.cpu = new SimpleRV32I(4000, opts.engine, job.layout);
+            if(!prepare(job, g.cpu, &g.error)) {
+                delete g.cpu;
+                g.cpu = NULL;
+            }
+        });
+        if(g.cpu == NULL) {
+            res.status = JOB_ERROR;
+            res.detail = g.error;
+        }
+        cpu = g.cpu ? g.cpu->fork() : NULL;
+    } else {
+        cpu = spare[job.layout];
+        spare[job.layout] = NULL;
+        if(cpu == NULL) cpu = new SimpleRV32I(4000, opts.engine, job.layout);
+        else cpu->reset();
+        if(!prepare(job, cpu, &res.detail)) res.status = JOB_ERROR;
+    }
+
+    if(res.status == JOB_PASS) {
+        uint64_t start = cpu->getInstret();
+        cpu->run(job.max);
+        checkJob(i, cpu, start);
+    }
+    if(cpu != NULL) {
+        delete spare[job.layout];
+        spare[job.layout] = cpu;
+    }
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    debug_printf(DEBUG_MEDIUM,"RV32I_BATCH::runJob> %s status(%d) %s:%d\n",job.name.c_str(),res.status,__FILE__, __LINE__);
+}
+
+
+/*
+ * runs the jobs of a lockstep group together, each on a fork of the golden
+ * model (program only) with its data loaded; every job of the group is
+ * given the time the whole group took
+ * */
+void RV32I_BATCH::runLockstep(const std::vector<size_t> &group) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    rv32i_golden &g = goldens[jobs[group[0]].golden];
+    std::vector<SimpleRV32I*> cpus;
+    std::vector<uint64_t> limits;
+    std::vector<size_t> lanes;
+
+    std::call_once(g.once, [&]() {
+        g.cpu = new SimpleRV32I(4000, opts.engine, MEM_SPLIT);
+        if(!prepare(jobs[group[0]], g.cpu, &g.error, false)) {
+            delete g.cpu;
+            g.cpu = NULL;
+        }
+    });
+    for(size_t k=0; k<group.size(); k++) {
+        const rv32i_job &job = jobs[group[k]];
+        rv32i_job_result &res = results[group[k]];
+        res.status = JOB_PASS;
+        res.instret = 0;
+        if(g.cpu == NULL) {
+            res.status = JOB_ERROR;
+            res.detail = g.error;
+        } else if(!job.data.empty() && access(job.data.c_str(), R_OK)) {
+            res.status = JOB_ERROR;
+            res.detail = "unable to read " + job.data;
+        } else {
+            SimpleRV32I *cpu = g.cpu->fork();
+            if(!job.data.empty() && !cpu->loadData(job.data)) {
+                res.status = JOB_ERROR;
+                res.detail = "unable to load " + job.data;
+                delete cpu;
+                continue;
+            }
+            cpus.push_back(cpu);
+            limits.push_back(job.max);
+            lanes.push_back(group[k]);
+        }
+    }
+
+    if(!cpus.empty()) {
+        RV32I_LOCKSTEP lockstep(g.cpu);
+        lockstep.run(cpus.data(), limits.data(), cpus.size());
+        const rv32i_lockstep_stats &s = lockstep.getStats();
+        std::lock_guard<std::mutex> guard(stats_lock);
+        lockstep_stats.lanes += s.lanes;
+        lockstep_stats.issued += s.issued;
+        lockstep_stats.retired += s.retired;
+        lockstep_stats.scalar += s.scalar;
+        lockstep_stats.detached += s.detached;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for(size_t k=0; k<lanes.size(); k++) {
+        checkJob(lanes[k], cpus[k], 0);
+        delete cpus[k];
+    }
+    for(size_t k=0; k<group.size(); k++) {
+        results[group[k]].seconds = seconds;
+    }
+    debug_printf(DEBUG_MEDIUM,"RV32I_BATCH::runLockstep> %d jobs from %s %s:%d\n",(int)group.size(),jobs[group[0]].name.c_str(),__FILE__, __LINE__);
+}
+
+
+/*
+ * takes the next item for worker id: its own queue first (newest item), then
+ * the oldest item of the other queues; false once every queue is empty
+ * (no items are added while the batch runs, so empty stays empty)
+ * */
+bool RV32I_BATCH::nextJob(int id, size_t *item) {
+    for(int k=0; k<nqueues; k++) {
+        rv32i_job_queue &q = queues[(id + k) % nqueues];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if(q.items.empty()) continue;
+        if(k == 0) {
+            *item = q.items.back();
+            q.items.pop_back();
+        } else {
+            *item = q.items.front();
+            q.items.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void RV32I_BATCH::worker(int id) {
+    SimpleRV32I *spare[2] = { NULL, NULL };
+    size_t item;
+    while(nextJob(id, &item)) {
+        if(jobs[items[item][0]].lockstep) runLockstep(items[item]);
+        else runJob(items[item][0], spare);
+    }
+    delete spare[0];
+    delete spare[1];
+}
+
+
+/*
+ * runs every job, returns the wall clock time taken in seconds
+ * */
+double RV32I_BATCH::run() {
+    //lockstep jobs are gathered in groups of up to RV32I_LOCKSTEP_WIDTH, in manifest order
+    std::map<int, size_t> open;    //golden -> item still taking lanes
+    items.clear();
+    for(size_t i=0; i<jobs.size(); i++) {
+        if(jobs[i].lockstep && open.count(jobs[i].golden) && (items[open[jobs[i].golden]].size() < RV32I_LOCKSTEP_WIDTH)) {
+            items[open[jobs[i].golden]].push_back(i);
+            continue;
+        }
+        if(jobs[i].lockstep) open[jobs[i].golden] = items.size();
+        items.push_back(std::vector<size_t>(1, i));
+    }
+
+    int threads = opts.threads;
+    if(threads <= 0) threads = std::thread::hardware_concurrency();
+    if(threads <= 0) threads = 1;
+    if((size_t)threads > items.size()) threads = items.size() ? items.size() : 1;
+    opts.threads = threads;
+
+    delete [] queues;
+    nqueues = threads;
+    queues = new rv32i_job_queue[nqueues];
+    results.assign(jobs.size(), rv32i_job_result());
+    //dealt so that each worker starts from the front of the manifest
+    for(size_t i=items.size(); i-- > 0; ) {
+        queues[i % nqueues].items.push_back(i);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for(int t=1; t<threads; t++) {
+        pool.push_back(std::thread(&RV32I_BATCH::worker, this, t));
+    }
+    worker(0);
+    for(size_t t=0; t<pool.size(); t++) {
+        pool[t].join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*
+ * writes the per job results and the totals, returns true if every job passed
+ * */
+bool RV32I_BATCH::report(std::ostream &out, double seconds) {
+    static const char * const names[] = { "PASS", "FAIL", "TRAP", "LIMIT", "ERROR" };
+    uint64_t count[5] = {0};
+    uint64_t instret = 0;
+
+    out << "# rv32i_sim batch: " << jobs.size() << " jobs, " << opts.threads << " threads, engine "
+        << engineName(opts.engine) << std::endl;
+    for(size_t i=0; i<jobs.size(); i++) {
+        const rv32i_job_result &res = results[i];
+        count[res.status]++;
+        instret += res.instret;
+        out << std::left << std::setw(6) << names[res.status] << jobs[i].name << " instret " << std::dec << res.instret
+            << " time " << std::fixed << std::setprecision(6) << res.seconds;
+        if(!res.detail.empty()) out << " (" << res.detail << ")";
+        out << std::endl;
+    }
+    out << "# pass " << count[JOB_PASS] << " fail " << count[JOB_FAIL] << " trap " << count[JOB_TRAP]
+        << " limit " << count[JOB_LIMIT] << " error " << count[JOB_ERROR] << std::endl;
+    out << "# " << instret << " instructions in " << std::fixed << std::setprecision(3) << seconds << " s: "
+        << std::setprecision(2) << (seconds > 0 ? instret / seconds / 1e6 : 0) << " MIPS, "
+        << (seconds > 0 ? jobs.size() / seconds : 0) << " jobs/s" << std::endl;
+    if(lockstep_stats.lanes) {
+        out << "# lockstep (" << RV32I_LOCKSTEP::vectorIsa() << "): " << lockstep_stats.lanes << " lanes, " << lockstep_stats.issued
+            << " instructions issued for " << lockstep_stats.retired << " retired (" << std::setprecision(2)
+            << (lockstep_stats.issued ? (double)lockstep_stats.retired / lockstep_stats.issued : 0) << " lanes per issue), "
+            << lockstep_stats.scalar << " scalar, " << lockstep_stats.detached << " lanes detached" << std::endl;
+    }
+    return count[JOB_PASS] == jobs.size();
+}
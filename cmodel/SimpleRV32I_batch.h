@@ -0,0 +1,130 @@
+#ifndef __SIMPLERV32I_BATCH_H__
+#define __SIMPLERV32I_BATCH_H__
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_lockstep.h"
+
+/*
+ * Batch regression runner
+ *
+ * Runs every job of a manifest on a pool of worker threads, each job on its
+ * own SimpleRV32I instance, and compares the final data memory / register
+ * dumps with the expected ones. Jobs are dealt round robin to per worker
+ * queues, a worker that runs out of jobs steals from the other end of
+ * another worker's queue, so a few long jobs do not leave cores idle.
+ * Jobs with the same inputs load them once into a golden model and each
+ * run on a copy on write fork of it, other jobs reuse (reset()) the
+ * worker's model from its previous job.
+ * With lockstep set, jobs that only differ in their data (same program,
+ * memory regions and split layout) share a golden model with the program
+ * loaded, and run RV32I_LOCKSTEP_WIDTH at a time as the lanes of an
+ * RV32I_LOCKSTEP group, each lane a fork with its data loaded.
+ *
+ * Manifest: one job per line, whitespace separated key=value fields, '#'
+ * starts a comment. Relative paths are relative to the manifest.
+ *   name=<id>              job name in the report (default: program)
+ *   program=<file>         ELF, .bin or hex text program
+ *   checkpoint=<file>      start from a checkpoint instead (one of the two is required)
+ *   data=<file>            hex text data image (default: none)
+ *   expect_data=<file>     expected data_out.txt (optional)
+ *   expect_regs=<file>     expected regs_out.txt (optional)
+ *   max=<n>                instruction limit (default: none)
+ *   map=<base>:<size>[:p]  extra data region, may be repeated
+ *   unified=1              one address space for instructions and data
+ * */
+
+typedef struct {
+    std::string name;
+    std::string program;
+    std::string checkpoint;
+    std::string data;
+    std::string expect_data;
+    std::string expect_regs;
+    uint64_t    max;
+    rv32i_mem_layout layout;
+    std::vector<std::string> regions;
+    int         golden;     //index of the golden model shared with jobs with the same inputs, -1 if none
+    bool        lockstep;   //runs as a lane of a lockstep group, golden has the program only
+} rv32i_job;
+
+typedef enum {
+    JOB_PASS,
+    JOB_FAIL,       //output mismatch
+    JOB_TRAP,       //guest trap
+    JOB_LIMIT,      //instruction limit reached before the program completed
+    JOB_ERROR       //inputs could not be loaded
+} rv32i_job_status;
+
+typedef struct {
+    rv32i_job_status status;
+    std::string detail;
+    uint64_t    instret;
+    double      seconds;
+} rv32i_job_result;
+
+typedef struct {
+    rv32i_engine engine;
+    uint32_t    jit_cache_size;
+    uint32_t    jit_threshold;
+    uint32_t    costs[COST_CLASSES];    //cycle cost table, see SimpleRV32I::configureCounters()
+    uint32_t    time_div;
+    uint32_t    isa_ext;            //extensions besides RV32I, see SimpleRV32I::configureIsa()
+    int         threads;            //0: one per host cpu
+    std::string out_dir;            //if set, <out_dir>/<name>.data_out.txt/.regs_out.txt are written
+    std::vector<std::string> regions;   //mapped for every job
+    bool        lockstep;           //run jobs that only differ in their data with RV32I_LOCKSTEP
+} rv32i_batch_options;
+
+//inputs loaded once, forked by every job using them
+typedef struct {
+    std::once_flag once;
+    SimpleRV32I *cpu;
+    std::string error;
+} rv32i_golden;
+
+//per worker queue of work items: the owner pops from the back, thieves from the front
+typedef struct {
+    std::mutex  lock;
+    std::deque<size_t> items;
+} rv32i_job_queue;
+
+bool isElf(const std::string &file);
+bool parseRegion(const char *arg, uint32_t *base, uint32_t *size, uint8_t *perms);
+bool parseCosts(const char *arg, uint32_t *costs);
+bool parseIsa(const char *arg, uint32_t *extensions);
+bool parseWatchpoint(const char *arg, rv32i_watchpoint *w);
+bool loadImage(SimpleRV32I &cpu, const std::string &program, const std::string &data);
+
+class RV32I_BATCH {
+    private:
+        rv32i_batch_options opts;
+        std::vector<rv32i_job> jobs;
+        std::vector<rv32i_job_result> results;
+        std::deque<rv32i_golden> goldens;
+        std::vector<std::vector<size_t> > items;   //units of work: a job, or the jobs of a lockstep group
+        rv32i_job_queue *queues;
+        int nqueues;
+        rv32i_lockstep_stats lockstep_stats;
+        std::mutex stats_lock;
+
+        bool prepare(const rv32i_job &job, SimpleRV32I *cpu, std::string *error, bool withData=true);
+        bool nextJob(int id, size_t *item);
+        void checkJob(size_t i, SimpleRV32I *cpu, uint64_t start);
+        void runJob(size_t i, SimpleRV32I **spare);
+        void runLockstep(const std::vector<size_t> &group);
+        void worker(int id);
+
+    public:
+        RV32I_BATCH(const rv32i_batch_options &opts);
+        ~RV32I_BATCH();
+        bool loadManifest(std::string file);
+        double run();
+        bool report(std::ostream &out, double seconds);
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include <iostream>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*
+ * Basic block execution engine (ENGINE_BLOCK)
+ *
+ * Guest code is split into basic blocks ending at JAL/JALR/B*, ECALL/EBREAK,
+ * or an instruction left to the reference step(). Each block is translated
+ * once, from the decode cache, into an array of handler addresses plus
+ * operands and run with direct threaded dispatch (computed goto): every
+ * handler jumps straight to the handler of the next op. Block exits chain
+ * directly to the successor block, so control only leaves runBlocks() when
+ * the program completes or the instruction budget runs out.
+ * */
+
+
+/*
+ * drops every translated block, along with their native translations
+ * */
+void SimpleRV32I::flushBlocks() {
+    jit_cache_used = 0;
+    for(size_t i=0; i<code_pages.size(); i++) {
+        rv32i_code_page *cp = code_pages[i];
+        for(int j=0; j<RV32I_PAGE_WORDS; j++) {
+            if(cp->blocks[j] != NULL) {
+                delete [] cp->blocks[j]->ops;
+                delete cp->blocks[j];
+                cp->blocks[j] = NULL;
+            }
+        }
+    }
+}
+
+
+/*
+ * handler indices used by the translator, beyond the ones given by rv32i_operation
+ * */
+enum {
+    H_NOP = ILLEGAL + 1,     //instruction whose only effect is a write to x0
+    H_FALLTHROUGH,          //block ends without a control transfer, continue at the next address
+    H_INTERP,               //leave the instruction at this address to step()
+    H_COUNT
+};
+
+
+/*
+ * translates the basic block starting at pc, blocks end at the page boundary
+ * and after block_len instructions
+ * */
+rv32i_block *SimpleRV32I::translateBlock(uint32_t pc, const void * const *handlers) {
+    rv32i_block_op ops[RV32I_MAX_BLOCK_LEN + 1];
+    uint32_t n = 0;
+    uint32_t addr = pc;
+    uint8_t link = RV32I_LINK_NONE;
+    bool done = false;
+
+    while(!done) {
+        if((n == block_len) || ((n > 0) && (!(addr & RV32I_PAGE_MASK) || isBreakpoint(addr)))) {
+            ops[n].handler = handlers[H_FALLTHROUGH];
+            break;
+        }
+        rv32i_decoded *d = decodeAt(addr);
+        rv32i_block_op *op = &ops[n];
+        op->handler = handlers[d->op];
+        op->rd = d->rd;
+        op->rs1 = d->rs1;
+        op->rs2 = d->rs2;
+        op->imm = d->imm;
+        switch(d->op) {
+            case AUIPC:     op->imm = addr + d->imm; break;
+            case JAL:       op->imm = addr + d->imm; link = rv32i_link_kind(false, d->rd, d->rs1); done = true; break;
+            case BEQ:
+            case BNE:
+            case BLT:
+            case BGE:
+            case BLTU:
+            case BGEU:      op->imm = addr + d->imm; done = true; break;
+            case JALR:      link = rv32i_link_kind(true, d->rd, d->rs1); done = true; break;
+            case ECALL:     if(!syscalls) { done = true; break; }
+                            //the syscall is handled by step()
+                            op->handler = handlers[H_INTERP]; op->imm = addr; done = true; n--; break;
+            case EBREAK:    done = true; break;
+            case LB:
+            case LH:
+            case LW:
+            case LBU:
+            case LHU:
+            case SB:
+            case SH:
+            case SW:        break;
+            case FENCE:     break;
+            case LR_W:
+            case SC_W:
+            case AMOSWAP_W:
+            case AMOADD_W:
+            case AMOXOR_W:
+            case AMOAND_W:
+            case AMOOR_W:
+            case AMOMIN_W:
+            case AMOMAX_W:
+            case AMOMINU_W:
+            case AMOMAXU_W:
+            case FENCE_I:
+            case CSRRW:
+            case CSRRS:
+            case CSRRC:
+            case CSRRWI:
+            case CSRRSI:
+            case CSRRCI:
+            case ILLEGAL:   op->handler = handlers[H_INTERP]; op->imm = addr; done = true; n--; break;
+            default:        if(d->rd == 0) op->handler = handlers[H_NOP]; break;
+        }
+        n++;
+        addr += 4;
+    }
+
+    rv32i_block *blk = new rv32i_block;
+    blk->pc = pc;
+    blk->n = n;
+    blk->next[0] = NULL;
+    blk->next[1] = NULL;
+    blk->cycles = blockCycles(pc, n);
+    blk->link = link;
+    blk->profile = profiler ? profiler->blockCounter(pc, n) : NULL;
+    blk->count = 0;
+    blk->jit = NULL;
+    blk->ops = new rv32i_block_op[n + 1];
+    for(uint32_t i=0; i<=n; i++) {
+        blk->ops[i] = ops[i];
+    }
+    debug_printf(DEBUG_MEDIUM,"SimpleRV32I::translateBlock> pc(%08x) n(%d) %s:%d\n",pc,n,__FILE__, __LINE__);
+    return blk;
+}
+
+
+/*
+ * returns the translated block starting at pc, translating it on first use
+ * NULL if pc cannot be fetched from, which step() then reports
+ * */
+rv32i_block *SimpleRV32I::lookupBlock(uint32_t pc, const void * const *handlers) {
+    if(decodeAt(pc) == NULL) return NULL;
+    rv32i_block **slot = &cur_code_page->blocks[(pc & RV32I_PAGE_MASK) >> 2];
+    if(*slot == NULL) {
+        *slot = translateBlock(pc, handlers);
+    }
+    return *slot;
+}
+
+
+/*
+ * FENCE, out of line: inlined, the fence is a compiler barrier across the
+ * whole dispatch loop of runBlocks()
+ * */
+static __attribute__((noinline)) void hostFence() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+
+/*
+ * runs translated blocks until the program completes or maxInstructions
+ * instructions have been retired, a block is counted in instret as it is entered
+ * a block that does not fit in the remaining budget, and any instruction the
+ * translator leaves to the reference path, is executed through step()
+ * with ENGINE_JIT, blocks that get hot are compiled and then run natively
+ * the cost of a block is charged to the cycle counter when it is entered
+ * blocks end before breakpoints, which are checked when a block is entered
+ * */
+void SimpleRV32I::runBlocks(uint64_t maxInstructions) {
+    //handler addresses, in rv32i_operation order followed by the H_* helpers
+    static const void * const handlers[H_COUNT] = {
+        &&L_LUI, &&L_AUIPC, &&L_JAL, &&L_JALR,
+        &&L_BEQ, &&L_BNE, &&L_BLT, &&L_BGE, &&L_BLTU, &&L_BGEU,
+        &&L_LB, &&L_LH, &&L_LW, &&L_LBU, &&L_LHU,
+        &&L_SB, &&L_SH, &&L_SW,
+        &&L_ADDI, &&L_SLTI, &&L_SLTIU, &&L_XORI, &&L_ORI, &&L_ANDI, &&L_SLLI, &&L_SRLI, &&L_SRAI,
+        &&L_ADD, &&L_SUB, &&L_SLL, &&L_SLT, &&L_SLTU, &&L_XOR, &&L_SRL, &&L_SRA, &&L_OR, &&L_AND,
+        &&L_MUL, &&L_MULH, &&L_MULHSU, &&L_MULHU, &&L_DIV, &&L_DIVU, &&L_REM, &&L_REMU,
+        &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP,
+        &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP,
+        &&L_FENCE, &&L_INTERP,
+        &&L_ECALL, &&L_EBREAK,
+        &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP, &&L_INTERP,
+        &&L_INTERP,
+        &&L_NOP, &&L_FALLTHROUGH, &&L_INTERP
+    };
+    uint32_t *r = regs;
+    uint64_t end = (maxInstructions < UINT64_MAX - instret) ? instret + maxInstructions : UINT64_MAX;
+    rv32i_block *blk;
+    const rv32i_block_op *op;
+
+    #define NEXT        do { op++; goto *op->handler; } while(0)
+    #define CHAIN(slot) do { \
+                            if(blk->next[slot] == NULL) blk->next[slot] = lookupBlock(PC, handlers); \
+                            blk = blk->next[slot]; \
+                            goto next_block; \
+                        } while(0)
+    #define LOAD(type)  type v; if(!load(r[op->rs1] + op->imm, &v)) goto mem_fault
+    #define STORE(type) if(!store(r[op->rs1] + op->imm, (type)r[op->rs2])) goto mem_fault
+
+    syncMemory();
+    blk = lookupBlock(PC, handlers);
+
+next_block:
+    if((imem->code_gen != code_gen) || (dmem->tlb_gen != tlb_gen)) {
+        //code was written or TLB entries went stale: blk may be gone
+        memorySync();
+        blk = lookupBlock(PC, handlers);
+    }
+    while((blk == NULL) || (blk->n == 0) || (blk->n > end - instret)) {
+        //left to the reference path: unfetchable pc, interpreted instruction or budget tail
+        if(status || (instret == end) || breakAt(PC)) return;
+        step();
+        if(status) return;
+        syncMemory(); //the instruction may have changed what the code decodes to
+        blk = lookupBlock(PC, handlers);
+    }
+    if(breakAt(PC)) return;
+    if(engine == ENGINE_JIT) {
+        if((blk->jit == NULL) && (++blk->count == jit_threshold)) compileBlock(blk);
+        if(blk->jit != NULL) {
+            //returns the number of instructions retired and the next pc, a
+            //partial run leaves the instruction at pc to the reference path
+            uint64_t ret = ((uint64_t (*)(uint32_t*, rv32i_tlb_entry*, rv32i_tlb_entry*))blk->jit)(r, tlb_rd, tlb_wr);
+            uint32_t n = (uint32_t)(ret >> 32);
+            instret += n;
+            cycle += (n == blk->n) ? blk->cycles : blockCycles(blk->pc, n);
+            if(profiler) {
+                if(n == blk->n) profiler->block(blk->profile, blk->pc, n, blk->link);
+                else profiler->run(blk->pc, n);
+            }
+            PC = (uint32_t)ret;
+            blk = (n == blk->n) ? lookupBlock(PC, handlers) : NULL;
+            goto next_block;
+        }
+    }
+    if(profiler) profiler->block(blk->profile, blk->pc, blk->n, blk->link);
+    instret += blk->n;
+    cycle += blk->cycles;
+    op = blk->ops;
+    goto *op->handler;
+
+L_LUI:      r[op->rd] = op->imm; NEXT;
+L_AUIPC:    r[op->rd] = op->imm; NEXT;
+L_ADDI:     r[op->rd] = r[op->rs1] + op->imm; NEXT;
+L_SLTI:     r[op->rd] = ((int32_t)r[op->rs1] < (int32_t)op->imm) ? 1 : 0; NEXT;
+L_SLTIU:    r[op->rd] = (r[op->rs1] < (uint32_t)op->imm) ? 1 : 0; NEXT;
+L_XORI:     r[op->rd] = r[op->rs1] ^ op->imm; NEXT;
+L_ORI:      r[op->rd] = r[op->rs1] | op->imm; NEXT;
+L_ANDI:     r[op->rd] = r[op->rs1] & op->imm; NEXT;
+L_SLLI:     r[op->rd] = r[op->rs1] << op->imm; NEXT;
+L_SRLI:     r[op->rd] = r[op->rs1] >> op->imm; NEXT;
+L_SRAI:     r[op->rd] = ((int32_t)r[op->rs1]) >> op->imm; NEXT;
+L_ADD:      r[op->rd] = r[op->rs1] + r[op->rs2]; NEXT;
+L_SUB:      r[op->rd] = r[op->rs1] - r[op->rs2]; NEXT;
+L_SLL:      r[op->rd] = r[op->rs1] << (r[op->rs2] & 0x0000001f); NEXT;
+L_SLT:      r[op->rd] = (((int32_t)r[op->rs1]) < ((int32_t)r[op->rs2])) ? 1 : 0; NEXT;
+L_SLTU:     r[op->rd] = (r[op->rs1] < r[op->rs2]) ? 1 : 0; NEXT;
+L_XOR:      r[op->rd] = r[op->rs1] ^ r[op->rs2]; NEXT;
+L_SRL:      r[op->rd] = r[op->rs1] >> (r[op->rs2] & 0x0000001f); NEXT;
+L_SRA:      r[op->rd] = ((int32_t)r[op->rs1]) >> (r[op->rs2] & 0x0000001f); NEXT;
+L_OR:       r[op->rd] = r[op->rs1] | r[op->rs2]; NEXT;
+L_AND:      r[op->rd] = r[op->rs1] & r[op->rs2]; NEXT;
+L_MUL:      r[op->rd] = rv32i_mulDiv(MUL, r[op->rs1], r[op->rs2]); NEXT;
+L_MULH:     r[op->rd] = rv32i_mulDiv(MULH, r[op->rs1], r[op->rs2]); NEXT;
+L_MULHSU:   r[op->rd] = rv32i_mulDiv(MULHSU, r[op->rs1], r[op->rs2]); NEXT;
+L_MULHU:    r[op->rd] = rv32i_mulDiv(MULHU, r[op->rs1], r[op->rs2]); NEXT;
+L_DIV:      r[op->rd] = rv32i_mulDiv(DIV, r[op->rs1], r[op->rs2]); NEXT;
+L_DIVU:     r[op->rd] = rv32i_mulDiv(DIVU, r[op->rs1], r[op->rs2]); NEXT;
+L_REM:      r[op->rd] = rv32i_mulDiv(REM, r[op->rs1], r[op->rs2]); NEXT;
+L_REMU:     r[op->rd] = rv32i_mulDiv(REMU, r[op->rs1], r[op->rs2]); NEXT;
+L_NOP:      NEXT;
+L_FENCE:    hostFence(); NEXT;
+
+//loads may target x0, which has to read back as 0 for the rest of the block
+L_LB:       { LOAD(int8_t); r[op->rd] = (int32_t)v; r[0] = 0; } NEXT;
+L_LH:       { LOAD(int16_t); r[op->rd] = (int32_t)v; r[0] = 0; } NEXT;
+L_LW:       { LOAD(int32_t); r[op->rd] = v; r[0] = 0; } NEXT;
+L_LBU:      { LOAD(uint8_t); r[op->rd] = v; r[0] = 0; } NEXT;
+L_LHU:      { LOAD(uint16_t); r[op->rd] = v; r[0] = 0; } NEXT;
+L_SB:       STORE(uint8_t); NEXT;
+L_SH:       STORE(uint16_t); NEXT;
+L_SW:       STORE(uint32_t); NEXT;
+
+//block exits, the address of the instruction after the block is blk->pc + 4*blk->n
+L_JAL:      r[op->rd] = blk->pc + 4*blk->n; r[0] = 0; PC = op->imm; CHAIN(1);
+L_JALR:     PC = (((int32_t)r[op->rs1]) + op->imm) & ~1; r[op->rd] = blk->pc + 4*blk->n; r[0] = 0;
+            blk = lookupBlock(PC, handlers); goto next_block;
+L_BEQ:      if(r[op->rs1] == r[op->rs2]) { PC = op->imm; CHAIN(1); } PC = blk->pc + 4*blk->n; CHAIN(0);
+L_BNE:      if(r[op->rs1] != r[op->rs2]) { PC = op->imm; CHAIN(1); } PC = blk->pc + 4*blk->n; CHAIN(0);
+L_BLT:      if(((int32_t)r[op->rs1]) < ((int32_t)r[op->rs2])) { PC = op->imm; CHAIN(1); } PC = blk->pc + 4*blk->n; CHAIN(0);
+L_BGE:      if(((int32_t)r[op->rs1]) >= ((int32_t)r[op->rs2])) { PC = op->imm; CHAIN(1); } PC = blk->pc + 4*blk->n; CHAIN(0);
+L_BLTU:     if(r[op->rs1] < r[op->rs2]) { PC = op->imm; CHAIN(1); } PC = blk->pc + 4*blk->n; CHAIN(0);
+L_BGEU:     if(r[op->rs1] >= r[op->rs2]) { PC = op->imm; CHAIN(1); } PC = blk->pc + 4*blk->n; CHAIN(0);
+L_FALLTHROUGH:
+            PC = blk->pc + 4*blk->n; CHAIN(0);
+L_ECALL:
+L_EBREAK:   PC = blk->pc + 4*(blk->n - 1); status = 1; return;
+L_INTERP:   PC = op->imm; blk = NULL; goto next_block;
+
+//a load/store trapped, the model stops at the faulting instruction
+mem_fault:  PC = blk->pc + 4*(op - blk->ops);
+            instret -= blk->n - (op - blk->ops);
+            cycle -= blockCycles(PC, blk->n - (op - blk->ops));
+            if(profiler) profiler->partial(blk->profile, blk->pc, op - blk->ops, blk->n);
+            return;
+
+    #undef NEXT
+    #undef CHAIN
+    #undef LOAD
+    #undef STORE
+}
@@ -0,0 +1,168 @@
+#include <iostream>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*
+ * Breakpoints, watchpoints and runUntil()
+ *
+ * Both are looked up through a bitmap with one bit per guest page, so an
+ * unarmed model pays nothing and an armed one one bit test where it could
+ * stop: breakpoints are checked before step()ed instructions and when a
+ * translated block is entered (blocks end before a breakpoint), watchpoints
+ * in the load/store slow paths (pages holding a watched range are kept out
+ * of the TLBs, accesses to the other pages never leave the fast path).
+ * The model stops before the instruction, with RV32I_STATUS_BREAK; the next
+ * run resumes with it.
+ * */
+
+
+/*
+ * stops the model if pc holds a breakpoint (its page does)
+ * */
+bool SimpleRV32I::hitBreakpoint(uint32_t pc) {
+    if(!breakpoints.count(pc)) return false;
+    status = RV32I_STATUS_BREAK;
+    break_watch = false;
+    debug_printf(DEBUG_LOW,"SimpleRV32I::hitBreakpoint> pc(%08x) %s:%d\n",pc,__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * stops the model if a kind (RV32I_WATCH_*) access to [addr, addr+size)
+ * touches a watched range, unless it is resuming from that access
+ * */
+bool SimpleRV32I::hitWatchpoint(uint32_t addr, uint32_t size, uint8_t kind) {
+    if(break_ignore) return false;
+    for(size_t i=0; i<watchpoints.size(); i++) {
+        const rv32i_watchpoint &w = watchpoints[i];
+        if((w.kind & kind) && (addr - w.addr < w.len || w.addr - addr < size)) {
+            status = RV32I_STATUS_BREAK;
+            break_watch = true;
+            watch_addr = addr;
+            debug_printf(DEBUG_LOW,"SimpleRV32I::hitWatchpoint> pc(%08x) addr(%08x) %s:%d\n",PC,addr,__FILE__, __LINE__);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*
+ * rebuilds the page bitmaps after breakpoints (code) or watchpoints (data)
+ * changed: translated blocks have to end before the new breakpoints, and
+ * the TLBs must not reach watched pages
+ * */
+void SimpleRV32I::updateBreakMaps(bool code, bool data) {
+    if(code) {
+        delete [] break_map;
+        break_map = NULL;
+        if(!breakpoints.empty()) {
+            break_map = new uint64_t[RV32I_BREAK_MAP_WORDS]();
+            for(std::set<uint32_t>::iterator i=breakpoints.begin(); i!=breakpoints.end(); i++) {
+                uint32_t page = *i >> RV32I_PAGE_BITS;
+                break_map[page >> 6] |= 1ull << (page & 63);
+            }
+        }
+        flushBlocks();
+    }
+    if(data) {
+        delete [] watch_map;
+        watch_map = NULL;
+        if(!watchpoints.empty()) {
+            watch_map = new uint64_t[RV32I_BREAK_MAP_WORDS]();
+            for(size_t i=0; i<watchpoints.size(); i++) {
+                uint32_t last = (watchpoints[i].addr + watchpoints[i].len - 1) >> RV32I_PAGE_BITS;
+                for(uint32_t page = watchpoints[i].addr >> RV32I_PAGE_BITS; ; page++) {
+                    watch_map[page >> 6] |= 1ull << (page & 63);
+                    if(page == last) break;
+                }
+            }
+        }
+        flushTlb();
+    }
+}
+
+
+void SimpleRV32I::addBreakpoint(uint32_t pc) {
+    if(breakpoints.insert(pc).second) updateBreakMaps(true, false);
+}
+
+void SimpleRV32I::removeBreakpoint(uint32_t pc) {
+    if(breakpoints.erase(pc)) updateBreakMaps(true, false);
+}
+
+
+/*
+ * stops the model before a kind (RV32I_WATCH_*) access to any byte of [addr, addr+len)
+ * */
+void SimpleRV32I::addWatchpoint(uint32_t addr, uint32_t len, uint8_t kind) {
+    if(!len || !(kind & RV32I_WATCH_ACCESS)) return;
+    rv32i_watchpoint w;
+    w.addr = addr;
+    w.len = len;
+    w.kind = kind & RV32I_WATCH_ACCESS;
+    watchpoints.push_back(w);
+    updateBreakMaps(false, true);
+}
+
+void SimpleRV32I::removeWatchpoint(uint32_t addr, uint32_t len) {
+    for(size_t i=0; i<watchpoints.size(); i++) {
+        if((watchpoints[i].addr == addr) && (watchpoints[i].len == len)) {
+            watchpoints.erase(watchpoints.begin() + i);
+            updateBreakMaps(false, true);
+            return;
+        }
+    }
+}
+
+void SimpleRV32I::clearBreakpoints() {
+    bool code = !breakpoints.empty();
+    bool data = !watchpoints.empty();
+    breakpoints.clear();
+    watchpoints.clear();
+    updateBreakMaps(code, data);
+}
+
+
+/*
+ * run() with the reason it returned, see rv32i_stop
+ * */
+rv32i_stop SimpleRV32I::runUntil(uint64_t maxInstructions) {
+    rv32i_stop stop;
+    uint64_t start = instret;
+    run(maxInstructions);
+    stop.retired = instret - start;
+    stop.pc = PC;
+    stop.addr = 0;
+    stop.cause = 0;
+    switch(status) {
+        case RV32I_STATUS_HALT:     {
+                                        syncMemory();
+                                        rv32i_decoded *d = decodeAt(PC);
+                                        stop.reason = (d && (d->op == EBREAK)) ? STOP_EBREAK : STOP_ECALL;
+                                    }
+                                    break;
+        case RV32I_STATUS_TRAP:     stop.reason = STOP_FAULT;
+                                    stop.cause = trap_cause;
+                                    stop.addr = trap_value;
+                                    break;
+        case RV32I_STATUS_BREAK:    stop.reason = break_watch ? STOP_WATCHPOINT : STOP_BREAKPOINT;
+                                    if(break_watch) stop.addr = watch_addr;
+                                    break;
+        default:                    stop.reason = STOP_BUDGET; break;
+    }
+    return stop;
+}
+
+
+/*
+ * runUntil() with a breakpoint at pc for this run
+ * */
+rv32i_stop SimpleRV32I::runUntilPc(uint32_t pc, uint64_t maxInstructions) {
+    bool set = breakpoints.count(pc);
+    if(!set) addBreakpoint(pc);
+    rv32i_stop stop = runUntil(maxInstructions);
+    if(!set) removeBreakpoint(pc);
+    return stop;
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include "SimpleRV32I_cache.h"
+#include "SimpleRV32I_utils.h"
+
+
+/*
+ * parses <KiB>:<ways>:<line bytes>, the geometry has to give a power of two
+ * number of sets
+ * */
+bool parseCacheConfig(const char *arg, rv32i_cache_config *config) {
+    char *end;
+    config->size = strtoul(arg, &end, 0) * 1024;
+    if(*end != ':') return false;
+    config->ways = strtoul(end + 1, &end, 0);
+    if(*end != ':') return false;
+    config->line = strtoul(end + 1, &end, 0);
+    if(*end || !config->ways || !config->line || (config->line & (config->line - 1))) return false;
+    if(config->size % (config->ways * config->line)) return false;
+    uint32_t sets = config->size / (config->ways * config->line);
+    return sets && !(sets & (sets - 1));
+}
+
+
+RV32I_CACHE::RV32I_CACHE(const rv32i_cache_config &config) {
+    this->config = config;
+    sets = config.size / (config.ways * config.line);
+    line_bits = 0;
+    while((1u << line_bits) < config.line) line_bits++;
+    tags.assign(sets * config.ways, 0);
+    used.assign(sets * config.ways, 0);
+    clock = 0;
+    accesses = 0;
+    misses = 0;
+}
+
+
+/*
+ * looks up (and on a miss fills) every line of [addr, addr+size), returns
+ * true if all of them hit
+ * */
+bool RV32I_CACHE::access(uint32_t addr, uint32_t size) {
+    bool hit = true;
+    uint32_t last = (addr + size - 1) >> line_bits;
+    for(uint32_t line = addr >> line_bits; ; line++) {
+        uint32_t *way = &tags[(line & (sets - 1)) * config.ways];
+        uint64_t *age = &used[(line & (sets - 1)) * config.ways];
+        uint32_t victim = 0;
+        uint32_t w;
+        accesses++;
+        clock++;
+        for(w=0; w<config.ways; w++) {
+            if(way[w] == line + 1) break;
+            if(age[w] < age[victim]) victim = w;
+        }
+        if(w == config.ways) {
+            misses++;
+            hit = false;
+            way[victim] = line + 1;
+            w = victim;
+        }
+        age[w] = clock;
+        if(line == last) break;
+    }
+    return hit;
+}
+
+
+//invalidates every line, the access/miss counts are kept
+void RV32I_CACHE::flush() {
+    tags.assign(tags.size(), 0);
+}
+
+
+std::string RV32I_CACHE::describe() {
+    std::ostringstream s;
+    s << config.size / 1024 << "KiB " << config.ways << "-way " << config.line << "B lines";
+    return s.str();
+}
+
+
+RV32I_CACHE_MODEL::RV32I_CACHE_MODEL(const rv32i_cache_config &l1i, const rv32i_cache_config &l1d) : icache(l1i), dcache(l1d) {
+    loads = 0;
+    stores = 0;
+    load_misses = 0;
+    store_misses = 0;
+    branches = 0;
+    taken = 0;
+}
+
+
+void RV32I_CACHE_MODEL::consume(const rv32i_event *events, uint32_t n) {
+    for(uint32_t i=0; i<n; i++) {
+        const rv32i_event &e = events[i];
+        switch(e.info & RV32I_EVENT_TYPE) {
+            case RV32I_EVENT_FETCH:     icache.access(e.addr, RV32I_EVENT_SIZE(e.info)); break;
+            case RV32I_EVENT_LOAD:      loads++; if(!dcache.access(e.addr, RV32I_EVENT_SIZE(e.info))) load_misses++; break;
+            case RV32I_EVENT_STORE:     stores++; if(!dcache.access(e.addr, RV32I_EVENT_SIZE(e.info))) store_misses++; break;
+            case RV32I_EVENT_BRANCH:    branches++; if(e.info & RV32I_EVENT_TAKEN) taken++; break;
+        }
+    }
+}
+
+
+static std::string percent(uint64_t part, uint64_t total) {
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(2) << (total ? 100.0 * part / total : 0) << "%";
+    return s.str();
+}
+
+void RV32I_CACHE_MODEL::report(std::ostream &out) {
+    out << std::dec;
+    out << "L1I " << icache.describe() << ": " << icache.accesses << " accesses, " << icache.misses << " misses ("
+        << percent(icache.misses, icache.accesses) << ")" << std::endl;
+    out << "L1D " << dcache.describe() << ": " << dcache.accesses << " accesses, " << dcache.misses << " misses ("
+        << percent(dcache.misses, dcache.accesses) << "), loads " << loads << " (" << load_misses << " missed), stores "
+        << stores << " (" << store_misses << " missed)" << std::endl;
+    out << "branches: " << branches << ", " << taken << " taken (" << percent(taken, branches) << ")" << std::endl;
+}
@@ -0,0 +1,62 @@
+#ifndef __SIMPLERV32I_CACHE_H__
+#define __SIMPLERV32I_CACHE_H__
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SimpleRV32I_probe.h"
+
+/*
+ * L1 cache model: a probe consumer running the fetch stream through an
+ * instruction cache and the load/store stream through a data cache, both
+ * set associative with LRU replacement, write allocate. Accesses crossing a
+ * line boundary touch both lines. Also counts conditional branch outcomes.
+ * */
+
+typedef struct {
+    uint32_t    size;   //bytes
+    uint32_t    ways;
+    uint32_t    line;   //bytes, a power of two
+} rv32i_cache_config;
+
+#define RV32I_L1I_DEFAULT   { 32*1024, 4, 64 }
+#define RV32I_L1D_DEFAULT   { 32*1024, 8, 64 }
+
+class RV32I_CACHE {
+    private:
+        rv32i_cache_config config;
+        uint32_t    sets;
+        uint32_t    line_bits;
+        std::vector<uint32_t> tags;     //sets * ways, line address + 1 (0: invalid)
+        std::vector<uint64_t> used;     //last use of each way, for LRU
+        uint64_t    clock;
+
+    public:
+        uint64_t    accesses;
+        uint64_t    misses;
+
+        RV32I_CACHE(const rv32i_cache_config &config);
+        bool access(uint32_t addr, uint32_t size);
+        void flush();
+        std::string describe();
+};
+
+class RV32I_CACHE_MODEL : public RV32I_PROBE_CONSUMER {
+    private:
+        RV32I_CACHE icache;
+        RV32I_CACHE dcache;
+        uint64_t    loads;
+        uint64_t    stores;
+        uint64_t    load_misses;
+        uint64_t    store_misses;
+        uint64_t    branches;
+        uint64_t    taken;
+
+    public:
+        RV32I_CACHE_MODEL(const rv32i_cache_config &l1i, const rv32i_cache_config &l1d);
+        void consume(const rv32i_event *events, uint32_t n);
+        void report(std::ostream &out);
+};
+
+bool parseCacheConfig(const char *arg, rv32i_cache_config *config);
+
+#endif
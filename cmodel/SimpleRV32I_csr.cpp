@@ -0,0 +1,192 @@
+#include <iostream>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*
+ * Zicsr: the CSR instructions and the guest visible counters
+ *
+ * The counters are not updated per instruction by the block engines: they
+ * charge instret and cycle once per translated block (step() per
+ * instruction), cycle from the per class cost table; time ticks once every
+ * time_div cycles.
+ * mcycle/minstret writes are kept as offsets, so the model's own counts
+ * (getInstret()/getCycles()) do not depend on what the guest writes.
+ * */
+
+#define RV32I_MISA_VALUE    (0x40000000 | RV32I_MISA_I)  //MXL 32bit, I, plus the enabled extensions
+
+
+static rv32i_cost_class opClass(int op) {
+    switch(op) {
+        case LB:
+        case LH:
+        case LW:
+        case LBU:
+        case LHU:
+        case LR_W:      return COST_LOAD;
+        case SB:
+        case SH:
+        case SW:
+        case SC_W:
+        case AMOSWAP_W:
+        case AMOADD_W:
+        case AMOXOR_W:
+        case AMOAND_W:
+        case AMOOR_W:
+        case AMOMIN_W:
+        case AMOMAX_W:
+        case AMOMINU_W:
+        case AMOMAXU_W: return COST_STORE;
+        case BEQ:
+        case BNE:
+        case BLT:
+        case BGE:
+        case BLTU:
+        case BGEU:      return COST_BRANCH;
+        case JAL:
+        case JALR:      return COST_JUMP;
+        case FENCE:
+        case FENCE_I:
+        case ECALL:
+        case EBREAK:
+        case CSRRW:
+        case CSRRS:
+        case CSRRC:
+        case CSRRWI:
+        case CSRRSI:
+        case CSRRCI:    return COST_SYSTEM;
+        default:        return COST_ALU;
+    }
+}
+
+
+/*
+ * sets the cycles charged per instruction class (COST_CLASSES entries, NULL
+ * for 1 cycle each) and the number of cycles per tick of the time CSR
+ * translated blocks carry their cost, so they are dropped
+ * */
+void SimpleRV32I::configureCounters(const uint32_t *classCosts, uint32_t timeDivider) {
+    flushBlocks();
+    for(int c=0; c<COST_CLASSES; c++) {
+        costs[c] = classCosts ? classCosts[c] : 1;
+    }
+    for(int op=0; op<RV32I_NUM_OPS; op++) {
+        op_cost[op] = costs[opClass(op)];
+    }
+    time_div = timeDivider ? timeDivider : 1;
+}
+
+
+/*
+ * selects the extensions (RV32I_MISA_M, RV32I_MISA_A) the model implements
+ * besides RV32I, and enables them; the encodings of the others are illegal
+ * instructions, as on a plain RV32I hart
+ * the guest can turn them off and back on through misa
+ * */
+void SimpleRV32I::configureIsa(uint32_t extensions) {
+    isa_ext = extensions & (RV32I_MISA_M | RV32I_MISA_A);
+    misa_ext = isa_ext;
+    invalidateDecodeCache();
+}
+
+
+/*
+ * returns the cost of the n instructions starting at pc, which have been decoded
+ * */
+uint32_t SimpleRV32I::blockCycles(uint32_t pc, uint32_t n) {
+    uint32_t c = 0;
+    for(uint32_t i=0; i<n; i++) {
+        c += op_cost[decodeAt(pc + 4*i)->op];
+    }
+    return c;
+}
+
+
+/*
+ * reads a CSR, returns false if it does not exist
+ * */
+bool SimpleRV32I::csrRead(uint32_t csr, uint32_t *value) {
+    uint64_t c = cycle + cycle_off;
+    uint64_t n = instret + instret_off;
+    uint64_t t = cycle / time_div;
+    switch(csr) {
+        case RV32I_CSR_CYCLE:
+        case RV32I_CSR_MCYCLE:      *value = (uint32_t)c; break;
+        case RV32I_CSR_CYCLEH:
+        case RV32I_CSR_MCYCLEH:     *value = (uint32_t)(c >> 32); break;
+        case RV32I_CSR_INSTRET:
+        case RV32I_CSR_MINSTRET:    *value = (uint32_t)n; break;
+        case RV32I_CSR_INSTRETH:
+        case RV32I_CSR_MINSTRETH:   *value = (uint32_t)(n >> 32); break;
+        case RV32I_CSR_TIME:        *value = (uint32_t)t; break;
+        case RV32I_CSR_TIMEH:       *value = (uint32_t)(t >> 32); break;
+        case RV32I_CSR_MSCRATCH:    *value = mscratch; break;
+        case RV32I_CSR_MISA:        *value = RV32I_MISA_VALUE | misa_ext; break;
+        case RV32I_CSR_MVENDORID:
+        case RV32I_CSR_MARCHID:
+        case RV32I_CSR_MIMPID:      *value = 0; break;
+        case RV32I_CSR_MHARTID:     *value = hart_id; break;
+        default:                    return false;
+    }
+    return true;
+}
+
+
+/*
+ * writes a CSR, returns false if it does not exist or is read only
+ * counter writes take effect after the writing instruction retired, which
+ * costs cost cycles
+ * */
+bool SimpleRV32I::csrWrite(uint32_t csr, uint32_t value, uint32_t cost) {
+    uint64_t c = cycle + cost;
+    uint64_t n = instret + 1;
+    if((csr >> 10) == 0x3) return false; //read only space
+    switch(csr) {
+        case RV32I_CSR_MCYCLE:      cycle_off = (int64_t)((((c + cycle_off) & 0xffffffff00000000ULL) | value) - c); break;
+        case RV32I_CSR_MCYCLEH:     cycle_off = (int64_t)((((c + cycle_off) & 0xffffffffULL) | ((uint64_t)value << 32)) - c); break;
+        case RV32I_CSR_MINSTRET:    instret_off = (int64_t)((((n + instret_off) & 0xffffffff00000000ULL) | value) - n); break;
+        case RV32I_CSR_MINSTRETH:   instret_off = (int64_t)((((n + instret_off) & 0xffffffffULL) | ((uint64_t)value << 32)) - n); break;
+        case RV32I_CSR_MSCRATCH:    mscratch = value; break;
+        case RV32I_CSR_MISA:        //WARL, only the extensions configureIsa() selected can be turned off and back on
+                                    if((value & isa_ext) != misa_ext) {
+                                        misa_ext = value & isa_ext;
+                                        //the decode cache (in use by step()) is dropped at the next syncMemory()
+                                        code_gen = imem->code_gen - 1;
+                                    }
+                                    break;
+        default:                    return false;
+    }
+    return true;
+}
+
+
+/*
+ * CSRRW/CSRRS/CSRRC and their immediate forms: rd gets the old value
+ * CSRRS/CSRRC with x0 (or a zero immediate) do not write, so read only CSRs
+ * can be read with them, anything else on a missing/read only CSR is an
+ * illegal instruction
+ * */
+void SimpleRV32I::execCsr(const rv32i_decoded &inst) {
+    uint32_t src = ((inst.op == CSRRWI) || (inst.op == CSRRSI) || (inst.op == CSRRCI)) ? inst.rs1 : regs[inst.rs1];
+    bool write = (inst.op == CSRRW) || (inst.op == CSRRWI) || (inst.rs1 != 0);
+    uint32_t old, value;
+
+    if(!csrRead(inst.imm, &old)) {
+        trap(RV32I_CAUSE_ILLEGAL_INST, inst.inst);
+        return;
+    }
+    switch(inst.op) {
+        case CSRRW:
+        case CSRRWI:    value = src; break;
+        case CSRRS:
+        case CSRRSI:    value = old | src; break;
+        default:        value = old & ~src; break;
+    }
+    if(write && !csrWrite(inst.imm, value, op_cost[inst.op])) {
+        trap(RV32I_CAUSE_ILLEGAL_INST, inst.inst);
+        return;
+    }
+    debug_printf(DEBUG_MEDIUM,"SimpleRV32I::execCsr> csr(%03x) old(%08x) %s:%d\n",inst.imm,old,__FILE__, __LINE__);
+    regs[inst.rd] = old;
+    PC = PC + 4;
+}
@@ -0,0 +1,308 @@
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*                                      RV32I instruction format
+ *('S' - Sign Bit, 'X' - normal bit, '-->' - right fill, '<--' - left fill) : for getting 32bit immediates
+ *===========================================================================================================
+ *
+ * |`````````````````{31:12,0-->}```````````|```11:7````|`````6:0``````|
+ * |S x x x x x x x x x x x x x x x x x x x | x x x x x | x x x x x x x|   U-Type Instruction
+ * |___________________IMM__________________|_____RD____|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ * |``````{<--S,20,10:1,11,19:12,0-->}``````|```11:7````|`````6:0``````|
+ * |S x x x x x x x x x x x x x x x x x x x | x x x x x | x x x x x x x|   J-Type Instruction
+ * |___________________IMM__________________|_____RD____|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
+ * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   R-Type Instruction
+ * |____FUNCT7____|____RS2____|_____RS1___|_FUNCT3|_____RD____|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
+ * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   I-Type Instruction
+ * |____FUNCT7____|___SHAMT___|_____RS1___|_FUNCT3|_____RD____|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ * |````````{S,11:0}````````|```19:15```|`14:12`|```11:7````|`````6:0``````|
+ * |S x x x x x x x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   I-Type Instruction
+ * |__________IMM___________|_____RS1___|_FUNCT3|_____RD____|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
+ * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   S-Type Instruction
+ * |__IMM[11:5]___|____RS2____|_____RS1___|_FUNCT3|_IMM[4:0]__|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ * |`````31:25````|```24:20```|```19:15```|`14:12`|```11:7````|`````6:0``````|
+ * |x x x x x x x | x x x x x | x x x x x | x x x | x x x x x | x x x x x x x|   B-Type Instruction
+ * |__IMM[12,10:5]|____RS2____|_____RS1___|_FUNCT3|IMM[4:1,11]|____OPCODE____|
+ *
+ *===========================================================================================================
+ *
+ */
+
+
+/*
+ * Decoder
+ *
+ * Each encoding is a rule: its opcode, funct3 and the funct7 bits it fixes,
+ * the operation and its format. RV32I and each extension have their own list
+ * of rules, and decodeTable is generated from all of them at compile time:
+ * an entry for every opcode[6:2], funct3, funct7 combination (the key),
+ * ILLEGAL where no rule matches, so unknown encodings trap. Decoding is a
+ * lookup of the key, the immediate extractor of the entry's format and a
+ * check of the bits outside the key the format fixes, without branches on
+ * the encoding. An extension adds its list to buildDecodeTable(), with the
+ * misa bit fillDecodeCache() checks for its operations; rules that overlap
+ * do not compile.
+ * C is not there: instructions are fetched as aligned 32bit words, so
+ * anything without 11 in its low opcode bits is illegal.
+ * */
+
+#define OPC_LOAD        0b0000011
+#define OPC_MISC_MEM    0b0001111
+#define OPC_OP_IMM      0b0010011
+#define OPC_AUIPC       0b0010111
+#define OPC_STORE       0b0100011
+#define OPC_AMO         0b0101111
+#define OPC_OP          0b0110011
+#define OPC_LUI         0b0110111
+#define OPC_BRANCH      0b1100011
+#define OPC_JALR        0b1100111
+#define OPC_JAL         0b1101111
+#define OPC_SYSTEM      0b1110011
+
+#define F3_ANY          0xff    //rule matches every funct3
+
+#define DECODE_KEY_BITS 15      //opcode[6:2], funct3, funct7
+
+typedef enum {
+    FMT_NONE,           //no rule: ILLEGAL
+    FMT_R,
+    FMT_R_NO_RS2,       //rs2 must be 0 (LR.W)
+    FMT_I,
+    FMT_I_SHAMT,        //imm is the shift amount
+    FMT_I_CSR,          //imm is the CSR number
+    FMT_SYSTEM,         //ECALL, EBREAK with inst[20] set
+    FMT_S,
+    FMT_B,
+    FMT_U,
+    FMT_J
+} rv32i_format_id;
+
+typedef struct {
+    rv32i_op_type   type;
+    int32_t         (*imm)(uint32_t inst);
+    uint32_t        zero;       //bits outside the key that must be 0, the encoding is illegal otherwise
+    uint32_t        select;     //bit outside the key that picks the operation after the rule's
+} rv32i_format;
+
+typedef struct {
+    uint8_t         opcode;
+    uint8_t         funct3;     //F3_ANY for all of them
+    uint8_t         mask7;      //funct7 bits the encoding fixes, to funct7
+    uint8_t         funct7;
+    rv32i_operation op;
+    rv32i_format_id format;
+} rv32i_decode_rule;
+
+typedef struct {
+    uint8_t         op;
+    uint8_t         format;
+} rv32i_decode_entry;
+
+typedef struct {
+    rv32i_decode_entry  entry[1 << DECODE_KEY_BITS];
+    uint32_t            ext[RV32I_NUM_OPS];     //RV32I_MISA_* bit of the list each operation is in
+    int                 overlaps;               //keys more than one rule matched
+} rv32i_decode_table;
+
+
+static constexpr rv32i_decode_rule rv32iRules[] = {
+    //opcode        funct3  mask7 funct7  op      format
+    { OPC_LUI,      F3_ANY, 0x00, 0x00, LUI,    FMT_U },
+    { OPC_AUIPC,    F3_ANY, 0x00, 0x00, AUIPC,  FMT_U },
+    { OPC_JAL,      F3_ANY, 0x00, 0x00, JAL,    FMT_J },
+    { OPC_JALR,     0b000,  0x00, 0x00, JALR,   FMT_I },
+    { OPC_BRANCH,   0b000,  0x00, 0x00, BEQ,    FMT_B },
+    { OPC_BRANCH,   0b001,  0x00, 0x00, BNE,    FMT_B },
+    { OPC_BRANCH,   0b100,  0x00, 0x00, BLT,    FMT_B },
+    { OPC_BRANCH,   0b101,  0x00, 0x00, BGE,    FMT_B },
+    { OPC_BRANCH,   0b110,  0x00, 0x00, BLTU,   FMT_B },
+    { OPC_BRANCH,   0b111,  0x00, 0x00, BGEU,   FMT_B },
+    { OPC_LOAD,     0b000,  0x00, 0x00, LB,     FMT_I },
+    { OPC_LOAD,     0b001,  0x00, 0x00, LH,     FMT_I },
+    { OPC_LOAD,     0b010,  0x00, 0x00, LW,     FMT_I },
+    { OPC_LOAD,     0b100,  0x00, 0x00, LBU,    FMT_I },
+    { OPC_LOAD,     0b101,  0x00, 0x00, LHU,    FMT_I },
+    { OPC_STORE,    0b000,  0x00, 0x00, SB,     FMT_S },
+    { OPC_STORE,    0b001,  0x00, 0x00, SH,     FMT_S },
+    { OPC_STORE,    0b010,  0x00, 0x00, SW,     FMT_S },
+    { OPC_OP_IMM,   0b000,  0x00, 0x00, ADDI,   FMT_I },
+    { OPC_OP_IMM,   0b010,  0x00, 0x00, SLTI,   FMT_I },
+    { OPC_OP_IMM,   0b011,  0x00, 0x00, SLTIU,  FMT_I },
+    { OPC_OP_IMM,   0b100,  0x00, 0x00, XORI,   FMT_I },
+    { OPC_OP_IMM,   0b110,  0x00, 0x00, ORI,    FMT_I },
+    { OPC_OP_IMM,   0b111,  0x00, 0x00, ANDI,   FMT_I },
+    { OPC_OP_IMM,   0b001,  0x7f, 0x00, SLLI,   FMT_I_SHAMT },
+    { OPC_OP_IMM,   0b101,  0x7f, 0x00, SRLI,   FMT_I_SHAMT },
+    { OPC_OP_IMM,   0b101,  0x7f, 0x20, SRAI,   FMT_I_SHAMT },
+    { OPC_OP,       0b000,  0x7f, 0x00, ADD,    FMT_R },
+    { OPC_OP,       0b000,  0x7f, 0x20, SUB,    FMT_R },
+    { OPC_OP,       0b001,  0x7f, 0x00, SLL,    FMT_R },
+    { OPC_OP,       0b010,  0x7f, 0x00, SLT,    FMT_R },
+    { OPC_OP,       0b011,  0x7f, 0x00, SLTU,   FMT_R },
+    { OPC_OP,       0b100,  0x7f, 0x00, XOR,    FMT_R },
+    { OPC_OP,       0b101,  0x7f, 0x00, SRL,    FMT_R },
+    { OPC_OP,       0b101,  0x7f, 0x20, SRA,    FMT_R },
+    { OPC_OP,       0b110,  0x7f, 0x00, OR,     FMT_R },
+    { OPC_OP,       0b111,  0x7f, 0x00, AND,    FMT_R },
+    { OPC_MISC_MEM, 0b000,  0x00, 0x00, FENCE,  FMT_I },     //fm, pred, succ, rs1, rd ignored
+    { OPC_SYSTEM,   0b000,  0x7f, 0x00, ECALL,  FMT_SYSTEM },
+};
+
+static constexpr rv32i_decode_rule zifenceiRules[] = {
+    { OPC_MISC_MEM, 0b001,  0x00, 0x00, FENCE_I, FMT_I },
+};
+
+//CSR number in inst[31:20], the immediate forms have zimm in rs1
+static constexpr rv32i_decode_rule zicsrRules[] = {
+    { OPC_SYSTEM,   0b001,  0x00, 0x00, CSRRW,  FMT_I_CSR },
+    { OPC_SYSTEM,   0b010,  0x00, 0x00, CSRRS,  FMT_I_CSR },
+    { OPC_SYSTEM,   0b011,  0x00, 0x00, CSRRC,  FMT_I_CSR },
+    { OPC_SYSTEM,   0b101,  0x00, 0x00, CSRRWI, FMT_I_CSR },
+    { OPC_SYSTEM,   0b110,  0x00, 0x00, CSRRSI, FMT_I_CSR },
+    { OPC_SYSTEM,   0b111,  0x00, 0x00, CSRRCI, FMT_I_CSR },
+};
+
+static constexpr rv32i_decode_rule rv32mRules[] = {
+    { OPC_OP,       0b000,  0x7f, 0x01, MUL,    FMT_R },
+    { OPC_OP,       0b001,  0x7f, 0x01, MULH,   FMT_R },
+    { OPC_OP,       0b010,  0x7f, 0x01, MULHSU, FMT_R },
+    { OPC_OP,       0b011,  0x7f, 0x01, MULHU,  FMT_R },
+    { OPC_OP,       0b100,  0x7f, 0x01, DIV,    FMT_R },
+    { OPC_OP,       0b101,  0x7f, 0x01, DIVU,   FMT_R },
+    { OPC_OP,       0b110,  0x7f, 0x01, REM,    FMT_R },
+    { OPC_OP,       0b111,  0x7f, 0x01, REMU,   FMT_R },
+};
+
+//funct7 is funct5, aq, rl: only funct5 is fixed
+static constexpr rv32i_decode_rule rv32aRules[] = {
+    { OPC_AMO,      0b010,  0x7c, 0x08, LR_W,      FMT_R_NO_RS2 },
+    { OPC_AMO,      0b010,  0x7c, 0x0c, SC_W,      FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x04, AMOSWAP_W, FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x00, AMOADD_W,  FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x10, AMOXOR_W,  FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x30, AMOAND_W,  FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x20, AMOOR_W,   FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x40, AMOMIN_W,  FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x50, AMOMAX_W,  FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x60, AMOMINU_W, FMT_R },
+    { OPC_AMO,      0b010,  0x7c, 0x70, AMOMAXU_W, FMT_R },
+};
+
+
+template<size_t N>
+static constexpr void addRules(rv32i_decode_table &t, const rv32i_decode_rule (&rules)[N], uint32_t ext) {
+    for(size_t i=0; i<N; i++) {
+        const rv32i_decode_rule &r = rules[i];
+        t.ext[r.op] = ext;
+        for(uint32_t funct3=0; funct3<8; funct3++) {
+            if((r.funct3 != F3_ANY) && (r.funct3 != funct3)) continue;
+            for(uint32_t funct7=0; funct7<128; funct7++) {
+                if((funct7 & r.mask7) != r.funct7) continue;
+                rv32i_decode_entry &e = t.entry[((r.opcode >> 2) << 10) | (funct3 << 7) | funct7];
+                if(e.op != ILLEGAL) t.overlaps++;
+                e.op = r.op;
+                e.format = r.format;
+            }
+        }
+    }
+}
+
+static constexpr rv32i_decode_table buildDecodeTable() {
+    rv32i_decode_table t = {};
+    for(uint32_t k=0; k<(1 << DECODE_KEY_BITS); k++) t.entry[k].op = ILLEGAL;
+    addRules(t, rv32iRules, 0);
+    addRules(t, zifenceiRules, 0);
+    addRules(t, zicsrRules, 0);
+    addRules(t, rv32mRules, RV32I_MISA_M);
+    addRules(t, rv32aRules, RV32I_MISA_A);
+    return t;
+}
+
+static constexpr rv32i_decode_table decodeTable = buildDecodeTable();
+static_assert(decodeTable.overlaps == 0, "decode rules overlap");
+
+
+static int32_t immNone(uint32_t) { return 0; }
+static int32_t immI(uint32_t inst) { return (int32_t)inst >> 20; }
+static int32_t immShamt(uint32_t inst) { return (inst >> 20) & 0x1f; }
+static int32_t immCsr(uint32_t inst) { return inst >> 20; }
+static int32_t immS(uint32_t inst) { return (((int32_t)inst >> 20) & 0xffffffe0) | ((inst >> 7) & 0x1f); }
+static int32_t immB(uint32_t inst) { return (((int32_t)inst >> 19) & 0xfffff000) | ((inst << 4) & 0x800) | ((inst >> 20) & 0x7e0) | ((inst >> 7) & 0x1e); }
+static int32_t immU(uint32_t inst) { return inst & 0xfffff000; }
+static int32_t immJ(uint32_t inst) { return (((int32_t)inst >> 11) & 0xfff00000) | (inst & 0xff000) | ((inst >> 9) & 0x800) | ((inst >> 20) & 0x7fe); }
+
+//indexed by rv32i_format_id
+static const rv32i_format formats[] = {
+    { INVALID_TYPE, immNone,  0x00000000, 0x00000000 },
+    { R_TYPE,       immNone,  0x00000000, 0x00000000 },
+    { R_TYPE,       immNone,  0x01f00000, 0x00000000 },     //rs2
+    { I_TYPE,       immI,     0x00000000, 0x00000000 },
+    { I_TYPE,       immShamt, 0x00000000, 0x00000000 },
+    { I_TYPE,       immCsr,   0x00000000, 0x00000000 },
+    { I_TYPE,       immI,     0x01ef8f80, 0x00100000 },     //inst[24:21], rs1, rd; EBREAK after ECALL
+    { S_TYPE,       immS,     0x00000000, 0x00000000 },
+    { B_TYPE,       immB,     0x00000000, 0x00000000 },
+    { U_TYPE,       immU,     0x00000000, 0x00000000 },
+    { J_TYPE,       immJ,     0x00000000, 0x00000000 },
+};
+
+
+RV32I_INST::RV32I_INST() {
+    opcode = 0;
+    rd = 0;
+    rs1 = 0;
+    rs2 = 0;
+    funct3 = 0;
+    funct7 = 0;
+    shamt = 0;
+    imm = 0;
+    inst = 0;
+    op = ILLEGAL;
+    type = INVALID_TYPE;
+    ext = 0;
+}
+
+
+/*
+ * takes a 32bit rv32i instruction as input, decodes its fields and looks
+ * up its operation, format and immediate in decodeTable
+ * */
+void RV32I_INST::decodeInst(uint32_t inst) {
+    const rv32i_decode_entry &e = decodeTable.entry[((inst >> 2) & 0x1f) << 10 | ((inst >> 12) & 0x7) << 7 | (inst >> 25)];
+    const rv32i_format &f = formats[e.format];
+    this->inst = inst;
+    opcode  = inst & 0x0000007f;
+    rd      = (inst >> 7)  & 0x00000001f;
+    rs1     = (inst >> 15) & 0x00000001f;
+    rs2     = (inst >> 20) & 0x00000001f;
+    funct3  = (inst >> 12) & 0x000000007;
+    funct7  = (inst >> 25) & 0x00000007f;
+    shamt   = (inst >> 20) & 0x00000001f;
+    imm     = f.imm(inst);
+    type    = f.type;
+    op      = (rv32i_operation)(e.op + ((inst & f.select) != 0));
+    if((inst & f.zero) || ((inst & 0x3) != 0x3)) op = ILLEGAL;
+    ext     = decodeTable.ext[op];
+    debug_printf(DEBUG_MEDIUM,"RV32I_INST::decodeInst> inst(%08x) => op(%d) %s:%d\n",inst,op,__FILE__, __LINE__);
+}
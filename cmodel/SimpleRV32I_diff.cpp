@@ -0,0 +1,307 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include "SimpleRV32I_diff.h"
+#include "SimpleRV32I_utils.h"
+
+
+/*
+ * parses <interval>[:<snapshot period>], a snapshot period shorter than an
+ * interval would take one per interval
+ * */
+bool parseDiffConfig(const char *arg, uint64_t *interval, uint64_t *snapshot) {
+    char *end;
+    *interval = strtoull(arg, &end, 0);
+    if(*end == ':') *snapshot = strtoull(end + 1, &end, 0);
+    return !*end && *interval && *snapshot;
+}
+
+
+/*
+ * model is loaded and about to run, the reference starts as a fork of it
+ * */
+RV32I_DIFF::RV32I_DIFF(SimpleRV32I *model, uint64_t interval, uint64_t snapshot) {
+    this->interval = interval;
+    this->snapshot = snapshot;
+    cpu = model;
+    ref = model->fork(ENGINE_INTERP);
+    snap = NULL;
+    cpu->trackDirtyPages(true);
+    ref->trackDirtyPages(true);
+    memset(&stats, 0, sizeof(stats));
+    result.diverged = false;
+    result.exact = false;
+    result.retired = 0;
+    result.pc = 0;
+    result.inst = 0;
+    result.last_pc = 0;
+    takeSnapshot();
+}
+
+
+RV32I_DIFF::~RV32I_DIFF() {
+    cpu->trackDirtyPages(false);
+    delete ref;
+    delete snap;
+}
+
+
+void RV32I_DIFF::takeSnapshot() {
+    delete snap;
+    snap = ref->fork();
+    stats.snapshots++;
+    debug_printf(DEBUG_MEDIUM,"RV32I_DIFF::takeSnapshot> at %lu instructions %s:%d\n",snap->instret,__FILE__, __LINE__);
+}
+
+
+/*
+ * runs a for up to n instructions, then b for as many as a retired, and
+ * lets b take the step a stopped at (a trap does not retire)
+ * */
+void RV32I_DIFF::runBoth(SimpleRV32I *a, SimpleRV32I *b, uint64_t n) {
+    a->run(n);
+    b->run(a->instret - b->instret);
+    if(a->status && !b->status) b->run(1);
+}
+
+
+/*
+ * architectural state of a and b, sets m to what differs first (detail ""
+ * if nothing does), a's value first
+ * */
+void RV32I_DIFF::compareState(SimpleRV32I *a, SimpleRV32I *b, rv32i_mismatch *m) {
+    std::ostringstream out;
+    out << std::hex;
+    m->reg = 0;
+    m->mem = false;
+    if(a->status != b->status) {
+        out << "status " << (int)a->status << " vs " << (int)b->status;
+    } else if(a->PC != b->PC) {
+        out << "pc 0x" << a->PC << " vs 0x" << b->PC;
+    } else if(a->instret != b->instret) {
+        out << "instret " << std::dec << a->instret << " vs " << b->instret;
+    } else if((a->status == RV32I_STATUS_TRAP) && ((a->trap_cause != b->trap_cause) || (a->trap_value != b->trap_value))) {
+        out << "trap cause " << std::dec << a->trap_cause << " value 0x" << std::hex << a->trap_value
+            << " vs cause " << std::dec << b->trap_cause << " value 0x" << std::hex << b->trap_value;
+    } else if(a->cycle != b->cycle) {
+        out << "cycle " << std::dec << a->cycle << " vs " << b->cycle;
+    } else if((a->cycle_off != b->cycle_off) || (a->instret_off != b->instret_off) ||
+              (a->mscratch != b->mscratch) || (a->misa_ext != b->misa_ext)) {
+        out << "CSRs (mcycle/minstret writes, mscratch, misa)";
+    } else {
+        for(int i=1; i<32; i++) {
+            if(a->regs[i] != b->regs[i]) {
+                out << "x" << std::dec << i << " 0x" << std::hex << a->regs[i] << " vs 0x" << b->regs[i];
+                m->reg = i;
+                break;
+            }
+        }
+    }
+    m->detail = out.str();
+}
+
+
+/*
+ * a data page of a and b, pages not allocated yet are all zeros and pages
+ * they still share are the same
+ * */
+void RV32I_DIFF::comparePage(SimpleRV32I *a, SimpleRV32I *b, uint32_t page, rv32i_mismatch *m) {
+    static const uint32_t zeros[RV32I_PAGE_SIZE / 4] = { 0 };
+    const rv32i_page *ta = a->dmem->getTable(page >> RV32I_DIR_BITS);
+    const rv32i_page *tb = b->dmem->getTable(page >> RV32I_DIR_BITS);
+    const uint32_t *pa = (ta && ta[page & (RV32I_DIR_SIZE - 1)].data) ? (const uint32_t*)ta[page & (RV32I_DIR_SIZE - 1)].data : zeros;
+    const uint32_t *pb = (tb && tb[page & (RV32I_DIR_SIZE - 1)].data) ? (const uint32_t*)tb[page & (RV32I_DIR_SIZE - 1)].data : zeros;
+    m->detail.clear();
+    if((pa == pb) || !memcmp(pa, pb, RV32I_PAGE_SIZE)) return;
+    for(int i=0; i<RV32I_PAGE_SIZE / 4; i++) {
+        if(pa[i] != pb[i]) {
+            std::ostringstream out;
+            m->reg = 0;
+            m->mem = true;
+            m->addr = (page << RV32I_PAGE_BITS) + 4*i;
+            out << std::hex << "memory 0x" << m->addr << " 0x" << pa[i] << " vs 0x" << pb[i];
+            m->detail = out.str();
+            return;
+        }
+    }
+}
+
+
+//every data page of a and b
+void RV32I_DIFF::compareMemory(SimpleRV32I *a, SimpleRV32I *b, rv32i_mismatch *m) {
+    m->detail.clear();
+    for(uint32_t d=0; d<RV32I_DIR_SIZE; d++) {
+        if(!a->dmem->getTable(d) && !b->dmem->getTable(d)) continue;
+        for(uint32_t p=0; p<RV32I_DIR_SIZE; p++) {
+            comparePage(a, b, (d << RV32I_DIR_BITS) | p, m);
+            if(!m->detail.empty()) return;
+        }
+    }
+}
+
+
+/*
+ * reruns n instructions from the snapshot on both engines, the tested one
+ * with blocks of at most blockLen instructions, sets m to what differs
+ * afterwards
+ * */
+void RV32I_DIFF::probe(uint64_t n, rv32i_mismatch *m, uint32_t blockLen) {
+    SimpleRV32I *a = snap->fork(cpu->engine);
+    SimpleRV32I *b = snap->fork();
+    a->block_len = blockLen;
+    runBoth(a, b, n);
+    compareState(a, b, m);
+    if(m->detail.empty()) compareMemory(a, b, m);
+    delete a;
+    delete b;
+    stats.probes++;
+    debug_printf(DEBUG_MEDIUM,"RV32I_DIFF::probe> %lu instructions, blocks of %u: %s %s:%d\n",n,blockLen,m->detail.c_str(),__FILE__, __LINE__);
+}
+
+
+/*
+ * the tested engine ran a block ending with instruction end - 1 (counted
+ * from the snapshot): returns its first instruction, found among the
+ * blocks a rerun translated that reach exactly there
+ * */
+uint64_t RV32I_DIFF::blockStart(uint64_t end) {
+    uint64_t first = (end > RV32I_MAX_BLOCK_LEN) ? end - RV32I_MAX_BLOCK_LEN : 0;
+    std::vector<uint32_t> pcs;
+    SimpleRV32I *r = snap->fork();
+    r->run(first);
+    for(uint64_t k=first; (k < end) && !r->status; k++) {
+        pcs.push_back(r->PC);
+        r->step();
+    }
+    delete r;
+    if(pcs.empty()) return end - 1;
+    //the block is straight line code up to pcs.back(), all of it if the
+    //rerun did not keep the block
+    size_t line = pcs.size() - 1;
+    while((line > 0) && (pcs[line - 1] + 4 == pcs[line])) line--;
+    SimpleRV32I *a = snap->fork(cpu->engine);
+    a->run(end);
+    size_t k;
+    for(k=line; k < pcs.size(); k++) {
+        rv32i_code_page *cp = a->getCodePage(pcs[k]);
+        rv32i_block *blk = cp ? cp->blocks[(pcs[k] & RV32I_PAGE_MASK) >> 2] : NULL;
+        if(blk && (first + k + blk->n == end)) break;
+    }
+    delete a;
+    return first + ((k < pcs.size()) ? k : line);
+}
+
+
+/*
+ * the models differ (m) after the interval [start, end) (instret), they
+ * did not at start: looks for the first instruction after which reruns
+ * from the snapshot differ, the interval is reported if the reruns do not
+ * */
+void RV32I_DIFF::bisect(uint64_t start, uint64_t end, const rv32i_mismatch &m) {
+    uint64_t base = snap->instret;
+    uint64_t lo = start - base;
+    uint64_t hi = end - base + 1;   //+1: the step a stopped model takes
+    rv32i_mismatch found, d;
+    probe(hi, &found);
+    result.diverged = true;
+    result.exact = !found.detail.empty();
+    result.last_pc = 0;
+    if(result.exact) {
+        while(hi - lo > 1) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            probe(mid, &d);
+            if(d.detail.empty()) {
+                lo = mid;
+            } else {
+                hi = mid;
+                found = d;
+            }
+        }
+        //a probe that ends inside a block runs its tail on step(), so hi is
+        //the end of the block that diverged, one instruction blocks tell
+        //which of its instructions did
+        probe(hi, &d, 1);
+        if(d.detail.empty()) {
+            result.exact = false;
+            lo = blockStart(hi);
+        } else {
+            found = d;
+            lo = start - base;
+            while(hi - lo > 1) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                probe(mid, &d, 1);
+                if(d.detail.empty()) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                    found = d;
+                }
+            }
+            lo = hi - 1;
+        }
+    }
+    result.detail = found.detail.empty() ? m.detail : found.detail;
+    result.retired = base + lo;
+    SimpleRV32I *r = snap->fork();
+    r->run(lo);
+    const rv32i_decoded *inst = r->decodeAt(r->PC);
+    result.pc = r->PC;
+    result.inst = inst ? inst->inst : 0;
+    if(!result.exact && !found.detail.empty()) {
+        r->run(hi - 1 - lo);
+        result.last_pc = r->PC;
+    }
+    delete r;
+}
+
+
+/*
+ * runs the model and the reference, an interval at a time, until the
+ * model stops, diverges from the reference or has retired maxInstructions
+ * instructions
+ * */
+const rv32i_divergence &RV32I_DIFF::run(uint64_t maxInstructions) {
+    std::vector<uint32_t> pages, refPages;
+    uint64_t done = 0;
+    while(!result.diverged && !cpu->status && (done < maxInstructions)) {
+        if(ref->instret - snap->instret >= snapshot) takeSnapshot();
+        uint64_t start = cpu->instret;
+        runBoth(cpu, ref, std::min(interval, maxInstructions - done));
+        done += cpu->instret - start;
+        stats.intervals++;
+        rv32i_mismatch m;
+        compareState(cpu, ref, &m);
+        cpu->takeDirtyPages(pages);
+        ref->takeDirtyPages(refPages);
+        pages.insert(pages.end(), refPages.begin(), refPages.end());
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+        for(size_t i=0; m.detail.empty() && (i < pages.size()); i++) {
+            comparePage(cpu, ref, pages[i], &m);
+            stats.pages++;
+        }
+        if(!m.detail.empty()) bisect(start, std::max(cpu->instret, ref->instret), m);
+    }
+    stats.instructions += done;
+    return result;
+}
+
+
+void RV32I_DIFF::report(std::ostream &out) {
+    out << std::dec << "diff: " << stats.instructions << " instructions checked against the reference in " << stats.intervals
+        << " intervals of " << interval << ", " << stats.pages << " pages compared, " << stats.snapshots << " snapshots" << std::endl;
+    if(!result.diverged) {
+        out << "no divergence" << std::endl;
+    } else if(result.exact) {
+        out << "divergence at instruction " << result.retired << " (" << stats.probes << " reruns): pc 0x" << std::hex << result.pc
+            << " inst 0x" << result.inst << ", " << result.detail << " (engine vs reference)" << std::dec << std::endl;
+    } else if(result.last_pc) {
+        out << "divergence in the block of instructions " << result.retired << " to " << (result.retired + (result.last_pc - result.pc) / 4)
+            << " (" << stats.probes << " reruns): pc 0x" << std::hex << result.pc << " to 0x" << result.last_pc
+            << ", not reproduced with one instruction blocks: " << result.detail << " (engine vs reference)" << std::dec << std::endl;
+    } else {
+        out << "divergence in the interval after instruction " << result.retired << " starting at pc 0x" << std::hex << result.pc
+            << ", not reproduced from the snapshot: " << result.detail << " (engine vs reference)" << std::dec << std::endl;
+    }
+}
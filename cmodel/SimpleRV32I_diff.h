@@ -0,0 +1,88 @@
+#ifndef __SIMPLERV32I_DIFF_H__
+#define __SIMPLERV32I_DIFF_H__
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SimpleRV32I.h"
+
+/*
+ * Differential checker: validates a fast engine against the reference
+ * interpreter (step()) while the program runs
+ *
+ * The model under test runs on its own engine, a fork of it runs on
+ * ENGINE_INTERP. They take turns an interval of instructions at a time, so
+ * they never get more than an interval apart: after each one their
+ * architectural state (registers, pc, status, counters) is compared, and
+ * so are the data pages either of them stored to during the interval (each
+ * keeps the list, see SimpleRV32I::takeDirtyPages()).
+ * Every snapshot period the reference is forked (pages shared copy on
+ * write) as a snapshot. On a mismatch both engines are rerun from the last
+ * snapshot for a bisected number of instructions, on fresh forks compared
+ * in full, down to the first run after which they differ. The block
+ * engines only stop between blocks (a budget tail goes through step()), so
+ * that narrows it down to a block; the same bisection with one instruction
+ * blocks then finds the instruction. A divergence that needs the whole
+ * block to show is reported as the block's address range.
+ * The guest must be deterministic in both runs: no syscalls, breakpoints,
+ * tracing or probes.
+ * */
+
+#define RV32I_DIFF_INTERVAL 4096        //default instructions between comparisons
+#define RV32I_DIFF_SNAPSHOT (1 << 20)   //default instructions between snapshots
+
+typedef struct {
+    bool        diverged;
+    bool        exact;      //the diverging instruction was found, otherwise the interval it is in
+    uint64_t    retired;    //instructions retired before it (before the interval if not exact)
+    uint32_t    pc;         //the instruction (the block's or interval's first) and its encoding
+    uint32_t    inst;
+    uint32_t    last_pc;    //not exact: the block's last instruction, 0 if not reproduced at all
+    std::string detail;     //what differs, the engine's value first
+} rv32i_divergence;
+
+//what differs between two models
+typedef struct {
+    std::string detail;     //"" if nothing does
+    int         reg;        //the register, 0 if it is not one
+    bool        mem;        //a memory word, at addr
+    uint32_t    addr;
+} rv32i_mismatch;
+
+typedef struct {
+    uint64_t    instructions;
+    uint64_t    intervals;
+    uint64_t    pages;      //data pages compared
+    uint64_t    snapshots;
+    uint64_t    probes;     //reruns while bisecting
+} rv32i_diff_stats;
+
+bool parseDiffConfig(const char *arg, uint64_t *interval, uint64_t *snapshot);
+
+class RV32I_DIFF {
+    private:
+        SimpleRV32I *cpu;   //model under test
+        SimpleRV32I *ref;   //reference, on ENGINE_INTERP
+        SimpleRV32I *snap;  //last snapshot of the reference
+        uint64_t interval;
+        uint64_t snapshot;
+        rv32i_diff_stats stats;
+        rv32i_divergence result;
+
+        static void runBoth(SimpleRV32I *a, SimpleRV32I *b, uint64_t n);
+        static void compareState(SimpleRV32I *a, SimpleRV32I *b, rv32i_mismatch *m);
+        static void comparePage(SimpleRV32I *a, SimpleRV32I *b, uint32_t page, rv32i_mismatch *m);
+        static void compareMemory(SimpleRV32I *a, SimpleRV32I *b, rv32i_mismatch *m);
+        void probe(uint64_t n, rv32i_mismatch *m, uint32_t blockLen=RV32I_MAX_BLOCK_LEN);
+        uint64_t blockStart(uint64_t end);
+        void takeSnapshot();
+        void bisect(uint64_t start, uint64_t end, const rv32i_mismatch &m);
+
+    public:
+        RV32I_DIFF(SimpleRV32I *model, uint64_t interval=RV32I_DIFF_INTERVAL, uint64_t snapshot=RV32I_DIFF_SNAPSHOT);
+        ~RV32I_DIFF();
+        const rv32i_divergence &run(uint64_t maxInstructions=UINT64_MAX);
+        const rv32i_diff_stats &getStats() { return stats; }
+        void report(std::ostream &out);
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_dump.h"
+#include "SimpleRV32I_utils.h"
+
+
+/*
+ * formats the words a chunk at a time into one buffer, the stream gets a
+ * write per chunk and no flushes
+ * */
+void writeHexWords(std::ostream &out, const uint32_t *words, uint32_t n) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[1024 * 11];
+    while(n) {
+        uint32_t chunk = (n < 1024) ? n : 1024;
+        char *p = buf;
+        for(uint32_t i=0; i<chunk; i++) {
+            uint32_t w = words[i];
+            *p++ = '0';
+            *p++ = 'x';
+            for(int s=28; s>=0; s-=4) {
+                *p++ = digits[(w >> s) & 0xf];
+            }
+            *p++ = '\n';
+        }
+        out.write(buf, p - buf);
+        words += chunk;
+        n -= chunk;
+    }
+}
+
+
+/*
+ * writes all of iov, IOV_MAX pieces per call, picking up after short writes
+ * */
+static bool writeAll(int fd, std::vector<struct iovec> &iov) {
+    size_t i = 0;
+    while(i < iov.size()) {
+        ssize_t w = writev(fd, &iov[i], std::min(iov.size() - i, (size_t)IOV_MAX));
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        while((i < iov.size()) && ((size_t)w >= iov[i].iov_len)) {
+            w -= iov[i].iov_len;
+            i++;
+        }
+        if(w) {
+            iov[i].iov_base = (uint8_t*)iov[i].iov_base + w;
+            iov[i].iov_len -= w;
+        }
+    }
+    return true;
+}
+
+
+/*
+ * writes a binary dump of the state (see SimpleRV32I_dump.h): a full one
+ * starting file over, or with diff the pages written since the previous
+ * dump, appended to it (a full one if this is the first dump)
+ * a full dump starts tracking the pages written, dirty page tracking must
+ * not be used for anything else in between (RV32I_DIFF)
+ * */
+bool SimpleRV32I::saveDump(std::string file, bool diff) {
+    static const uint8_t zeros[RV32I_PAGE_SIZE] = { 0 };
+    std::vector<uint32_t> pages;
+    rv32i_dump_header h;
+
+    diff = diff && dirty_map;
+    if(diff) {
+        takeDirtyPages(pages);
+        std::sort(pages.begin(), pages.end());
+    } else {
+        for(uint32_t d=0; d<RV32I_DIR_SIZE; d++) {
+            const rv32i_page *table = dmem->getTable(d);
+            if(table == NULL) continue;
+            for(uint32_t p=0; p<RV32I_DIR_SIZE; p++) {
+                //pages never written or all zero read back as zeros
+                if(table[p].data && (table[p].flags & RV32I_PERM_MASK) && !zeroPage(table[p].data)) pages.push_back((d << RV32I_DIR_BITS) | p);
+            }
+        }
+        trackDirtyPages(true);
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RV32I_DUMP_MAGIC, sizeof(h.magic));
+    h.version = RV32I_DUMP_VERSION;
+    h.flags = diff ? RV32I_DUMP_DIFF : 0;
+    h.mem_size = mem_size;
+    h.pc = PC;
+    h.status = status;
+    h.pages = pages.size();
+    h.instret = instret;
+    h.cycle = cycle;
+    memcpy(h.regs, regs, sizeof(h.regs));
+
+    //the header, then each record and the page it describes, from guest memory
+    std::vector<rv32i_dump_page> recs(pages.size());
+    std::vector<struct iovec> iov;
+    iov.reserve(1 + 2*pages.size());
+    iov.push_back((struct iovec){ &h, sizeof(h) });
+    for(size_t i=0; i<pages.size(); i++) {
+        const rv32i_page *table = dmem->getTable(pages[i] >> RV32I_DIR_BITS);
+        const uint8_t *data = table ? table[pages[i] & (RV32I_DIR_SIZE - 1)].data : NULL;
+        recs[i].addr = pages[i] << RV32I_PAGE_BITS;
+        recs[i].flags = (data == NULL) || zeroPage(data) ? RV32I_DUMP_ZERO : 0;
+        iov.push_back((struct iovec){ &recs[i], sizeof(recs[i]) });
+        if(!(recs[i].flags & RV32I_DUMP_ZERO)) iov.push_back((struct iovec){ (void*)(data ? data : zeros), RV32I_PAGE_SIZE });
+    }
+
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | (diff ? O_APPEND : O_TRUNC), 0644);
+    if(fd < 0) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    bool ok = writeAll(fd, iov);
+    ok = (close(fd) == 0) && ok;
+    if(!ok) {
+        std::cerr << "Unable to write dump: " << file << std::endl;
+        return false;
+    }
+    debug_printf(DEBUG_LOW,"SimpleRV32I::saveDump> %s at %lu instructions, %u pages %s:%d\n",diff ? "diff" : "full",instret,h.pages,__FILE__, __LINE__);
+    return true;
+}
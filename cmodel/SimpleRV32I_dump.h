@@ -0,0 +1,51 @@
+#ifndef __SIMPLERV32I_DUMP_H__
+#define __SIMPLERV32I_DUMP_H__
+#include <stdint.h>
+#include <ostream>
+
+/*
+ * Binary state dumps
+ *
+ * A compact alternative to the text dumps (dumpData()/dumpRegs()) for large
+ * memories and for periodic dumps during long runs: the registers, pc,
+ * status and counters, and data pages, each with its guest address.
+ * A full dump holds every page of the data view with something in it, a diff
+ * dump only the pages written since the previous dump of the model (stores,
+ * SC/AMOs and writeMemory(), see SimpleRV32I::trackDirtyPages()). A full
+ * dump starts a file, diff dumps are appended to it, each one gathered by
+ * writev() straight from guest memory (a call per IOV_MAX pieces).
+ * rv32i_dump applies the dumps of a file in order and writes the state as
+ * text dumps again.
+ *
+ * File: dumps, each a rv32i_dump_header followed by its page records, each
+ * record followed by the page contents unless it has RV32I_DUMP_ZERO.
+ * */
+
+#define RV32I_DUMP_MAGIC        "RV32IDMP"
+#define RV32I_DUMP_VERSION      1
+
+#define RV32I_DUMP_DIFF         0x1     //header flags: pages written since the previous dump only
+#define RV32I_DUMP_ZERO         0x1     //page flags: all zero, no contents follow
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    flags;          //RV32I_DUMP_DIFF
+    uint32_t    mem_size;       //[0, mem_size) is what the text data dump covers
+    uint32_t    pc;
+    uint32_t    status;
+    uint32_t    pages;          //page records that follow
+    uint64_t    instret;
+    uint64_t    cycle;
+    uint32_t    regs[32];
+} rv32i_dump_header;
+
+typedef struct {
+    uint32_t    addr;
+    uint32_t    flags;          //RV32I_DUMP_ZERO
+} rv32i_dump_page;
+
+//writes n words as the text dumps do, one "0x%08x" line each
+void writeHexWords(std::ostream &out, const uint32_t *words, uint32_t n);
+
+#endif
@@ -0,0 +1,401 @@
+#include <iostream>
+#include <sys/mman.h>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*
+ * x86-64 dynamic binary translator (ENGINE_JIT)
+ *
+ * Blocks of the block engine that reach jit_threshold executions are compiled
+ * from their decode cache entries into native code, placed in an executable
+ * code cache. A translation is called as
+ *
+ *      uint64_t fn(uint32_t *regs, rv32i_tlb_entry *tlb_rd, rv32i_tlb_entry *tlb_wr)
+ *
+ * and returns (instructions retired << 32) | next pc. Guest registers stay at
+ * fixed offsets from rbx (regs). Loads and stores do the same TLB lookup as
+ * load()/store() inline, off r12 (tlb_rd) and r13 (tlb_wr); a miss leaves the
+ * block early so the access goes through step(), which fills the TLB or
+ * traps. ECALL/EBREAK leave the block the same way, so the host handles them.
+ *
+ * The code cache is flushed as a whole when it fills up, and together with
+ * the blocks whenever code is written (self-modifying code included, code
+ * pages never get write TLB entries).
+ * */
+
+#if defined(__x86_64__)
+
+//x86 condition codes, as used by jcc/setcc/cmovcc
+#define X86_CC_B    0x2
+#define X86_CC_AE   0x3
+#define X86_CC_E    0x4
+#define X86_CC_NE   0x5
+#define X86_CC_A    0x7
+#define X86_CC_L    0xc
+#define X86_CC_GE   0xd
+
+//upper bound of the native code emitted for one guest instruction, side exit included
+#define X86_MAX_INST_BYTES 96
+
+/*
+ * minimal x86-64 emitter, only the forms used by the translator
+ * eax/ecx/edx are scratch, rbx holds regs, r12/r13 hold the read/write TLBs
+ * */
+class X86_EMITTER {
+    public:
+        uint8_t *p;
+
+        X86_EMITTER(uint8_t *buf) { p = buf; }
+        void b(uint8_t v) { *p++ = v; }
+        void d(uint32_t v) { *((uint32_t*)p) = v; p += 4; }
+
+        //<op> reg, [rbx + 4*guestReg]
+        void regMem(uint8_t opc, uint8_t reg, uint8_t guestReg) { b(opc); b(0x43 | (reg << 3)); b(guestReg*4); }
+        void loadEax(uint8_t guestReg) { regMem(0x8b, 0, guestReg); }
+        void loadEcx(uint8_t guestReg) { regMem(0x8b, 1, guestReg); }
+        void storeEax(uint8_t guestReg) { regMem(0x89, 0, guestReg); }
+        void storeImm(uint8_t guestReg, uint32_t v) { b(0xc7); b(0x43); b(guestReg*4); d(v); }
+        void movEaxImm(uint32_t v) { b(0xb8); d(v); }
+        void movEcxImm(uint32_t v) { b(0xb9); d(v); }
+        void aluEaxImm(uint8_t opc, uint32_t v) { b(opc); d(v); } //05 add, 0d or, 25 and, 35 xor, 3d cmp
+        void shiftEaxImm(uint8_t ext, uint8_t v) { b(0xc1); b(0xc0 | (ext << 3)); b(v); } //4 shl, 5 shr, 7 sar
+        void shiftEaxCl(uint8_t ext) { b(0xd3); b(0xc0 | (ext << 3)); }
+        void setccEax(uint8_t cc) { b(0x0f); b(0x90 | cc); b(0xc0); b(0x0f); b(0xb6); b(0xc0); } //setcc al; movzx eax, al
+        void cmovccEaxEcx(uint8_t cc) { b(0x0f); b(0x40 | cc); b(0xc1); }
+
+        //jcc rel32, returns the location of the displacement for patching
+        uint8_t *jcc(uint8_t cc) { b(0x0f); b(0x80 | cc); d(0); return p - 4; }
+        uint8_t *jmp() { b(0xe9); d(0); return p - 4; }
+        void patch(uint8_t *disp) { *((int32_t*)disp) = (int32_t)(p - (disp + 4)); }
+
+        void prologue() {
+            b(0x53);                        //push rbx
+            b(0x41); b(0x54);               //push r12
+            b(0x41); b(0x55);               //push r13
+            b(0x48); b(0x89); b(0xfb);      //mov rbx, rdi
+            b(0x49); b(0x89); b(0xf4);      //mov r12, rsi
+            b(0x49); b(0x89); b(0xd5);      //mov r13, rdx
+        }
+
+        /*
+         * TLB lookup for the guest address in eax (r12 read TLB, r13 write TLB)
+         * on a hit rdx holds the TLB addend, so the host address is rdx+rax
+         * returns the location of the miss jump displacement
+         * */
+        uint8_t *tlbLookup(bool write, uint8_t size) {
+            b(0x89); b(0xc1);                               //mov ecx, eax
+            b(0xc1); b(0xe9); b(RV32I_PAGE_BITS);           //shr ecx, PAGE_BITS
+            b(0x81); b(0xe1); d(RV32I_TLB_SIZE - 1);        //and ecx, TLB_SIZE-1
+            b(0xc1); b(0xe1); b(4);                         //shl ecx, 4 (sizeof(rv32i_tlb_entry))
+            b(0x89); b(0xc2);                               //mov edx, eax
+            b(0x81); b(0xe2); d(~(uint32_t)(RV32I_PAGE_MASK & ~(size - 1))); //and edx, tag mask
+            if(write) { b(0x41); b(0x3b); b(0x54); b(0x0d); b(0x00); } //cmp edx, [r13+rcx]
+            else      { b(0x41); b(0x3b); b(0x14); b(0x0c); }          //cmp edx, [r12+rcx]
+            uint8_t *miss = jcc(X86_CC_NE);
+            if(write) { b(0x49); b(0x8b); b(0x54); b(0x0d); b(0x08); } //mov rdx, [r13+rcx+8]
+            else      { b(0x49); b(0x8b); b(0x54); b(0x0c); b(0x08); } //mov rdx, [r12+rcx+8]
+            return miss;
+        }
+
+        //returns (n << 32) | eax
+        void exit(uint32_t n) {
+            b(0xba); d(n);                  //mov edx, n
+            b(0x48); b(0xc1); b(0xe2); b(32); //shl rdx, 32
+            b(0x48); b(0x09); b(0xd0);      //or rax, rdx
+            b(0x41); b(0x5d);               //pop r13
+            b(0x41); b(0x5c);               //pop r12
+            b(0x5b);                        //pop rbx
+            b(0xc3);                        //ret
+        }
+};
+
+
+/*
+ * compiles a hot block to native code, leaves blk->jit NULL if the code cache
+ * cannot be set up
+ * */
+void SimpleRV32I::compileBlock(rv32i_block *blk) {
+    //room for the prologue, every instruction and the final exit
+    uint32_t worst = (blk->n + 2) * X86_MAX_INST_BYTES;
+
+    if(jit_cache == NULL) {
+        void *m = mmap(NULL, jit_cache_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(m == MAP_FAILED) {
+            std::cerr << "Unable to allocate jit code cache: " << jit_cache_size << " bytes" << std::endl;
+            engine = ENGINE_BLOCK;
+            return;
+        }
+        jit_cache = (uint8_t*)m;
+        jit_cache_used = 0;
+    }
+    if(worst > jit_cache_size) return;
+    if(jit_cache_used + worst > jit_cache_size) {
+        //code cache full, start over: drop every native translation but keep the blocks
+        debug_printf(DEBUG_LOW,"SimpleRV32I::compileBlock> code cache full, flushing %s:%d\n",__FILE__, __LINE__);
+        for(size_t i=0; i<code_pages.size(); i++) {
+            for(int j=0; j<RV32I_PAGE_WORDS; j++) {
+                rv32i_block *b = code_pages[i]->blocks[j];
+                if(b != NULL) {
+                    b->jit = NULL;
+                    b->count = 0;
+                }
+            }
+        }
+        jit_cache_used = 0;
+    }
+
+    uint8_t *start = jit_cache + jit_cache_used;
+    X86_EMITTER e(start);
+    uint8_t *sideExit[RV32I_MAX_BLOCK_LEN];
+    uint32_t sideExitIdx[RV32I_MAX_BLOCK_LEN];
+    uint32_t nSideExits = 0;
+    uint32_t end = blk->pc + 4*blk->n;
+    bool exited = false;
+
+    e.prologue();
+    for(uint32_t i=0; (i < blk->n) && !exited; i++) {
+        uint32_t pc = blk->pc + 4*i;
+        const rv32i_decoded &inst = *decodeAt(pc);
+        uint8_t aluOp = 0;      //opcode of the eax,[mem] form
+        uint8_t aluImmOp = 0;   //opcode of the eax,imm32 form
+        uint8_t shiftExt = 0;
+        uint8_t cc = 0;
+        uint8_t size = 0;
+
+        switch(inst.op) {
+            case LUI:       if(inst.rd) e.storeImm(inst.rd, inst.imm); break;
+            case AUIPC:     if(inst.rd) e.storeImm(inst.rd, pc + inst.imm); break;
+
+            case ADDI:      aluImmOp = 0x05; break;
+            case XORI:      aluImmOp = 0x35; break;
+            case ORI:       aluImmOp = 0x0d; break;
+            case ANDI:      aluImmOp = 0x25; break;
+            case SLLI:      shiftExt = 4; break;
+            case SRLI:      shiftExt = 5; break;
+            case SRAI:      shiftExt = 7; break;
+            case SLTI:      aluImmOp = 0x3d; cc = X86_CC_L; break;
+            case SLTIU:     aluImmOp = 0x3d; cc = X86_CC_B; break;
+
+            case ADD:       aluOp = 0x03; break;
+            case SUB:       aluOp = 0x2b; break;
+            case XOR:       aluOp = 0x33; break;
+            case OR:        aluOp = 0x0b; break;
+            case AND:       aluOp = 0x23; break;
+            case SLT:       aluOp = 0x3b; cc = X86_CC_L; break;
+            case SLTU:      aluOp = 0x3b; cc = X86_CC_B; break;
+            case SLL:       shiftExt = 4; break;
+            case SRL:       shiftExt = 5; break;
+            case SRA:       shiftExt = 7; break;
+
+            case LB:
+            case LBU:
+            case SB:        size = 1; break;
+            case LH:
+            case LHU:
+            case SH:        size = 2; break;
+            case LW:
+            case SW:        size = 4; break;
+
+            default:        break;
+        }
+
+        switch(inst.op) {
+            case ADDI: case XORI: case ORI: case ANDI: case SLTI: case SLTIU:
+                            if(!inst.rd) break;
+                            e.loadEax(inst.rs1);
+                            e.aluEaxImm(aluImmOp, inst.imm);
+                            if(cc) e.setccEax(cc);
+                            e.storeEax(inst.rd);
+                            break;
+            case SLLI: case SRLI: case SRAI:
+                            if(!inst.rd) break;
+                            e.loadEax(inst.rs1);
+                            e.shiftEaxImm(shiftExt, inst.imm);
+                            e.storeEax(inst.rd);
+                            break;
+            case ADD: case SUB: case XOR: case OR: case AND: case SLT: case SLTU:
+                            if(!inst.rd) break;
+                            e.loadEax(inst.rs1);
+                            e.regMem(aluOp, 0, inst.rs2);
+                            if(cc) e.setccEax(cc);
+                            e.storeEax(inst.rd);
+                            break;
+            case MUL:
+                            if(!inst.rd) break;
+                            e.loadEax(inst.rs1);
+                            e.b(0x0f); e.regMem(0xaf, 0, inst.rs2);        //imul eax, [rs2]
+                            e.storeEax(inst.rd);
+                            break;
+            case MULH: case MULHSU: case MULHU:
+                            //64bit product of the sign/zero extended operands, high half
+                            if(!inst.rd) break;
+                            if(inst.op == MULHU) e.loadEax(inst.rs1);
+                            else { e.b(0x48); e.regMem(0x63, 0, inst.rs1); } //movsxd rax, [rs1]
+                            if(inst.op == MULH) { e.b(0x48); e.regMem(0x63, 1, inst.rs2); } //movsxd rcx, [rs2]
+                            else e.loadEcx(inst.rs2);
+                            e.b(0x48); e.b(0x0f); e.b(0xaf); e.b(0xc1);    //imul rax, rcx
+                            e.b(0x48); e.b(0xc1); e.b(0xe8); e.b(32);      //shr rax, 32
+                            e.storeEax(inst.rd);
+                            break;
+            case DIV: case DIVU: case REM: case REMU: {
+                            //the divide by zero and overflow cases (which fault on x86) are branched around
+                            if(!inst.rd) break;
+                            bool sign = (inst.op == DIV) || (inst.op == REM);
+                            bool rem = (inst.op == REM) || (inst.op == REMU);
+                            uint8_t *ovf = NULL;
+                            e.loadEax(inst.rs1);
+                            e.loadEcx(inst.rs2);
+                            e.b(0x85); e.b(0xc9);                           //test ecx, ecx
+                            uint8_t *zero = e.jcc(X86_CC_E);
+                            if(sign) {
+                                e.b(0x83); e.b(0xf9); e.b(0xff);            //cmp ecx, -1
+                                uint8_t *ok = e.jcc(X86_CC_NE);
+                                e.aluEaxImm(0x3d, 0x80000000);
+                                ovf = e.jcc(X86_CC_E);
+                                e.patch(ok);
+                                e.b(0x99); e.b(0xf7); e.b(0xf9);            //cdq; idiv ecx
+                            } else {
+                                e.b(0x31); e.b(0xd2); e.b(0xf7); e.b(0xf1); //xor edx, edx; div ecx
+                            }
+                            if(rem) { e.b(0x89); e.b(0xd0); }               //mov eax, edx
+                            uint8_t *done = e.jmp();
+                            //x / 0 = all ones, x % 0 = x (already in eax)
+                            e.patch(zero);
+                            if(!rem) e.movEaxImm(0xffffffff);
+                            if(sign) {
+                                //-2^31 / -1 = -2^31 (already in eax), -2^31 % -1 = 0
+                                uint8_t *done2 = e.jmp();
+                                e.patch(ovf);
+                                if(rem) { e.b(0x31); e.b(0xc0); }           //xor eax, eax
+                                e.patch(done2);
+                            }
+                            e.patch(done);
+                            e.storeEax(inst.rd);
+                            }
+                            break;
+            case SLL: case SRL: case SRA:
+                            if(!inst.rd) break;
+                            e.loadEax(inst.rs1);
+                            e.loadEcx(inst.rs2);
+                            e.shiftEaxCl(shiftExt);
+                            e.storeEax(inst.rd);
+                            break;
+
+            case LB: case LH: case LW: case LBU: case LHU:
+            case SB: case SH: case SW:
+                            //address = regs[rs1] + imm, TLB miss => side exit to step()
+                            e.loadEax(inst.rs1);
+                            e.aluEaxImm(0x05, inst.imm);
+                            sideExit[nSideExits] = e.tlbLookup((inst.op == SB) || (inst.op == SH) || (inst.op == SW), size);
+                            sideExitIdx[nSideExits++] = i;
+                            switch(inst.op) {
+                                case LB:    e.b(0x0f); e.b(0xbe); e.b(0x04); e.b(0x02); break; //movsx eax, byte [rdx+rax]
+                                case LH:    e.b(0x0f); e.b(0xbf); e.b(0x04); e.b(0x02); break; //movsx eax, word [rdx+rax]
+                                case LW:    e.b(0x8b); e.b(0x04); e.b(0x02); break;          //mov eax, [rdx+rax]
+                                case LBU:   e.b(0x0f); e.b(0xb6); e.b(0x04); e.b(0x02); break; //movzx eax, byte [rdx+rax]
+                                case LHU:   e.b(0x0f); e.b(0xb7); e.b(0x04); e.b(0x02); break; //movzx eax, word [rdx+rax]
+                                case SB:    e.loadEcx(inst.rs2); e.b(0x88); e.b(0x0c); e.b(0x02); break; //mov [rdx+rax], cl
+                                case SH:    e.loadEcx(inst.rs2); e.b(0x66); e.b(0x89); e.b(0x0c); e.b(0x02); break; //mov [rdx+rax], cx
+                                case SW:    e.loadEcx(inst.rs2); e.b(0x89); e.b(0x0c); e.b(0x02); break; //mov [rdx+rax], ecx
+                                default:    break;
+                            }
+                            if((inst.op != SB) && (inst.op != SH) && (inst.op != SW) && inst.rd) e.storeEax(inst.rd);
+                            break;
+
+            case JAL:       if(inst.rd) e.storeImm(inst.rd, end);
+                            e.movEaxImm(pc + inst.imm);
+                            e.exit(blk->n);
+                            exited = true;
+                            break;
+            case JALR:      //target is computed before rd is written, rd may be rs1
+                            e.loadEax(inst.rs1);
+                            e.aluEaxImm(0x05, inst.imm);
+                            e.aluEaxImm(0x25, 0xfffffffe);
+                            if(inst.rd) e.storeImm(inst.rd, end);
+                            e.exit(blk->n);
+                            exited = true;
+                            break;
+            case BEQ:       cc = X86_CC_E; break;
+            case BNE:       cc = X86_CC_NE; break;
+            case BLT:       cc = X86_CC_L; break;
+            case BGE:       cc = X86_CC_GE; break;
+            case BLTU:      cc = X86_CC_B; break;
+            case BGEU:      cc = X86_CC_AE; break;
+
+            case LUI:
+            case AUIPC:     break;
+            case FENCE:     e.b(0x0f); e.b(0xae); e.b(0xf0); break; //mfence
+
+            default:        //ECALL/EBREAK, the atomics, and anything else, is left to the host
+                            e.movEaxImm(pc);
+                            e.exit(i);
+                            exited = true;
+                            break;
+        }
+
+        if(!exited && cc && (inst.op >= BEQ) && (inst.op <= BGEU)) {
+            //next pc = condition ? target : fall through
+            e.loadEax(inst.rs1);
+            e.regMem(0x3b, 0, inst.rs2);
+            e.movEaxImm(end);
+            e.movEcxImm(pc + inst.imm);
+            e.cmovccEaxEcx(cc);
+            e.exit(blk->n);
+            exited = true;
+        }
+    }
+    if(!exited) {
+        //block ends without a control transfer
+        e.movEaxImm(end);
+        e.exit(blk->n);
+    }
+
+    //side exits, the access at index i is done by step()
+    for(uint32_t i=0; i<nSideExits; i++) {
+        e.patch(sideExit[i]);
+        e.movEaxImm(blk->pc + 4*sideExitIdx[i]);
+        e.exit(sideExitIdx[i]);
+    }
+
+    jit_cache_used += (uint32_t)(e.p - start);
+    jit_cache_used = (jit_cache_used + 15) & ~15;
+    blk->jit = start;
+    debug_printf(DEBUG_MEDIUM,"SimpleRV32I::compileBlock> pc(%08x) n(%d) %d bytes %s:%d\n",blk->pc,blk->n,(int)(e.p - start),__FILE__, __LINE__);
+}
+
+
+/*
+ * releases the native code cache
+ * */
+void SimpleRV32I::flushJitCache() {
+    if(jit_cache != NULL) {
+        munmap(jit_cache, jit_cache_size);
+        jit_cache = NULL;
+    }
+    jit_cache_used = 0;
+}
+
+#else
+
+//no native backend for this host, ENGINE_JIT runs as ENGINE_BLOCK
+void SimpleRV32I::compileBlock(rv32i_block *blk) {
+    engine = ENGINE_BLOCK;
+}
+
+void SimpleRV32I::flushJitCache() {
+    jit_cache_used = 0;
+}
+
+#endif
+
+
+/*
+ * sets the size of the native code cache and the number of executions after
+ * which a block is compiled, drops any code compiled so far
+ * */
+void SimpleRV32I::configureJit(uint32_t codeCacheSize, uint32_t hotThreshold) {
+    flushBlocks();
+    flushJitCache();
+    jit_cache_size = codeCacheSize;
+    jit_threshold = hotThreshold ? hotThreshold : 1;
+}
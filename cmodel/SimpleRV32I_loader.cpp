@@ -0,0 +1,412 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*
+ * Program loaders
+ *
+ * Input files are mmap'd read only and copied straight into guest memory
+ * (ELF and raw images can also be loaded from a buffer, see librv32i.h):
+ *  - ELF32 RISC-V executables: PT_LOAD segments mapped at their virtual
+ *    addresses with their permissions, .bss zero filled, PC set to the entry
+ *    point. With split instruction/data views executable segments go to the
+ *    instruction view and are also readable (e.g. .rodata) in the data view
+ *    the other segments only go to the data view
+ *  - raw binaries (objcopy -O binary): copied as is into the instruction memory
+ *  - hex text (one 32bit word per line): parsed in a single pass
+ *  - checkpoints written by saveCheckpoint(): the machine state as it was
+ * Loaders report errors on std::cerr and return false, leaving whatever was
+ * loaded before the error in place.
+ * */
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+
+/*
+ * read only mapping of a whole input file
+ * */
+class RV32I_FILE_MAP {
+    public:
+        const uint8_t *data;
+        size_t size;
+        bool ok;
+
+        RV32I_FILE_MAP(std::string file) {
+            struct stat st;
+            int fd = open(file.c_str(), O_RDONLY);
+            data = NULL;
+            size = 0;
+            ok = false;
+            if(fd < 0) return;
+            if((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)) {
+                size = st.st_size;
+                ok = true;
+                if(size) {
+                    void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if(m == MAP_FAILED) {
+                        ok = false;
+                        size = 0;
+                    } else {
+                        data = (const uint8_t*)m;
+                    }
+                }
+            }
+            close(fd);
+        }
+
+        ~RV32I_FILE_MAP() {
+            if(data != NULL) munmap((void*)data, size);
+        }
+};
+
+
+/*
+ * image_end raised to cover a range loaded up to end (exclusive, in 64 bits)
+ * a range reaching the top of the address space leaves it on the last page
+ * instead of wrapping to 0, so the heap (empty) starts there
+ * */
+static inline uint32_t imageEnd(uint32_t image_end, uint64_t end) {
+    if(end > ~(uint32_t)RV32I_PAGE_MASK) end = ~(uint32_t)RV32I_PAGE_MASK;
+    return (end > image_end) ? (uint32_t)end : image_end;
+}
+
+
+static inline int hexDigit(uint8_t c) {
+    if((c >= '0') && (c <= '9')) return c - '0';
+    if((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+
+/*
+ * loads an ascii hexadecimal format file into mem, one 32bit value per line
+ * (optionally 0x prefixed, as written by dumpData()), blank lines are skipped
+ * */
+bool SimpleRV32I::loadHex(std::string file, RV32I_MEM *mem) {
+    RV32I_FILE_MAP in(file);
+    uint32_t i = 0;
+
+    if(!in.ok) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+
+    const uint8_t *p = in.data;
+    const uint8_t *end = in.data + in.size;
+    while(p < end) {
+        uint32_t data = 0;
+        int digits = 0;
+        while((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r'))) p++;
+        if((p + 1 < end) && (p[0] == '0') && ((p[1] == 'x') || (p[1] == 'X'))) p += 2;
+        for(int v; (p < end) && ((v = hexDigit(*p)) >= 0); p++, digits++) {
+            data = (data << 4) | v;
+        }
+        while((p < end) && (*p != '\n')) p++;
+        p++;
+        if(!digits) continue;
+        if(!mem->write(i, &data, 4)) {
+            std::cerr << "Insufficient memory" << std::endl;
+            return false;
+        }
+        i += 4;
+    }
+    return true;
+}
+
+
+/*
+ * loads a raw binary image (e.g. objcopy -O binary output) into the
+ * instruction memory at addr
+ * */
+bool SimpleRV32I::loadBinary(std::string file, uint32_t addr) {
+    RV32I_FILE_MAP in(file);
+
+    if(!in.ok) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    return loadBinary(in.data, in.size, addr);
+}
+
+bool SimpleRV32I::loadBinary(const void *image, size_t size, uint32_t addr) {
+    if(((uint64_t)addr + size > 0x100000000ULL) || !imem->write(addr, image, size)) {
+        std::cerr << "Insufficient memory" << std::endl;
+        invalidateDecodeCache();
+        return false;
+    }
+    image_end = imageEnd(image_end, (uint64_t)addr + size);
+    invalidateDecodeCache();
+    return true;
+}
+
+
+/*
+ * loads an ELF32 RISC-V executable: every PT_LOAD segment is mapped at its
+ * virtual address with its permissions, filled from the file and zero filled
+ * up to its memory size, PC is set to the ELF entry point
+ * */
+bool SimpleRV32I::loadElf(std::string file) {
+    RV32I_FILE_MAP in(file);
+
+    if(!in.ok) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    return loadElfImage(in.data, in.size, file);
+}
+
+bool SimpleRV32I::loadElf(const void *image, size_t size) {
+    return loadElfImage((const uint8_t*)image, size, "<buffer>");
+}
+
+/*
+ * loads the ELF executable held in image, name is only used in error messages
+ * */
+bool SimpleRV32I::loadElfImage(const uint8_t *image, size_t size, const std::string &name) {
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr*)image;
+    if((size < sizeof(Elf32_Ehdr)) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+       (eh->e_ident[EI_CLASS] != ELFCLASS32) || (eh->e_ident[EI_DATA] != ELFDATA2LSB) ||
+       (eh->e_machine != EM_RISCV) || (eh->e_type != ET_EXEC)) {
+        std::cerr << "Not a little endian ELF32 RISC-V executable: " << name << std::endl;
+        return false;
+    }
+    if((eh->e_phentsize != sizeof(Elf32_Phdr)) ||
+       ((uint64_t)eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf32_Phdr) > size)) {
+        std::cerr << "Malformed ELF program header table: " << name << std::endl;
+        return false;
+    }
+
+    const Elf32_Phdr *ph = (const Elf32_Phdr*)(image + eh->e_phoff);
+    for(int i=0; i<eh->e_phnum; i++) {
+        if((ph[i].p_type != PT_LOAD) || (ph[i].p_memsz == 0)) continue;
+        if((ph[i].p_filesz > ph[i].p_memsz) || ((uint64_t)ph[i].p_offset + ph[i].p_filesz > size)) {
+            std::cerr << "Malformed ELF segment " << i << ": " << name << std::endl;
+            return false;
+        }
+        if((uint64_t)ph[i].p_vaddr + ph[i].p_memsz > 0x100000000ULL) {
+            std::cerr << "ELF segment " << i << " outside of guest memory: " << std::hex << ph[i].p_vaddr << std::endl;
+            return false;
+        }
+        uint8_t perms = ((ph[i].p_flags & PF_R) ? RV32I_PERM_R : 0) |
+                        ((ph[i].p_flags & PF_W) ? RV32I_PERM_W : 0) |
+                        ((ph[i].p_flags & PF_X) ? RV32I_PERM_X : 0);
+        RV32I_MEM *views[2] = { dmem, NULL };
+        if(ph[i].p_flags & PF_X) {
+            views[0] = imem;
+            if(dmem != imem) views[1] = dmem;
+        }
+        for(int v=0; (v < 2) && (views[v] != NULL); v++) {
+            uint8_t viewPerms = (views[v] == imem) ? perms : (perms & ~RV32I_PERM_X);
+            if(!views[v]->map(ph[i].p_vaddr, ph[i].p_memsz, viewPerms) ||
+               !views[v]->write(ph[i].p_vaddr, image + ph[i].p_offset, ph[i].p_filesz) ||
+               !views[v]->fill(ph[i].p_vaddr + ph[i].p_filesz, 0, ph[i].p_memsz - ph[i].p_filesz)) { //.bss
+                std::cerr << "Unable to map ELF segment " << i << ": " << std::hex << ph[i].p_vaddr << std::endl;
+                return false;
+            }
+        }
+        image_end = imageEnd(image_end, (uint64_t)ph[i].p_vaddr + ph[i].p_memsz);
+        debug_printf(DEBUG_LOW,"SimpleRV32I::loadElf> segment %d: %08x-%08x perms(%x) %s:%d\n",i,ph[i].p_vaddr,
+                     ph[i].p_vaddr + ph[i].p_memsz - 1,perms,__FILE__, __LINE__);
+    }
+    invalidateDecodeCache();
+    PC = eh->e_entry;
+    return true;
+}
+
+
+/*
+ * Checkpoints
+ *
+ * Binary, host endian: a header with the architectural state, then for each
+ * memory view (one if unified, instruction then data view if split) its
+ * mapped pages in address order, as a {address, flags} record followed by
+ * the 4KiB page contents if the page holds anything but zeros. Pages never
+ * touched or all zero cost 8 bytes.
+ * */
+
+#define RV32I_CKPT_MAGIC    "RV32ICKP"
+#define RV32I_CKPT_VERSION  3
+#define RV32I_CKPT_DATA     0x100   //page record is followed by the page contents
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    views;          //1: unified layout, 2: split
+    uint32_t    mem_size;
+    uint32_t    pc;
+    uint32_t    status;
+    uint32_t    trap_cause;
+    uint32_t    trap_value;
+    uint32_t    image_end;      //where the heap starts
+    uint64_t    instret;
+    uint64_t    cycle;
+    int64_t     cycle_off;      //mcycle/minstret writes
+    int64_t     instret_off;
+    uint32_t    mscratch;
+    uint32_t    misa_ext;       //extensions enabled (RV32I_MISA_*)
+    uint32_t    regs[32];
+    uint32_t    pages[2];       //page records per view
+} rv32i_ckpt_header;
+
+typedef struct {
+    uint32_t    addr;
+    uint32_t    flags;          //RV32I_PERM_* | RV32I_CKPT_DATA
+} rv32i_ckpt_page;
+
+
+//writes the page records of one view, returns the number of records
+static uint32_t saveView(std::ofstream &out, RV32I_MEM *mem) {
+    uint32_t n = 0;
+    for(uint32_t d=0; d<RV32I_DIR_SIZE; d++) {
+        const rv32i_page *table = mem->getTable(d);
+        if(table == NULL) continue;
+        for(uint32_t p=0; p<RV32I_DIR_SIZE; p++) {
+            if(!(table[p].flags & RV32I_PERM_MASK)) continue;
+            rv32i_ckpt_page rec;
+            rec.addr = (d << (RV32I_DIR_BITS + RV32I_PAGE_BITS)) | (p << RV32I_PAGE_BITS);
+            rec.flags = table[p].flags & RV32I_PERM_MASK;
+            if(table[p].data && !zeroPage(table[p].data)) rec.flags |= RV32I_CKPT_DATA;
+            out.write((const char*)&rec, sizeof(rec));
+            if(rec.flags & RV32I_CKPT_DATA) out.write((const char*)table[p].data, RV32I_PAGE_SIZE);
+            n++;
+        }
+    }
+    return n;
+}
+
+
+/*
+ * writes the machine state (registers, PC, status, counters/CSRs, mapped memory) to file
+ * */
+bool SimpleRV32I::saveCheckpoint(std::string file) {
+    std::ofstream out(file.c_str(), std::ios::binary);
+    rv32i_ckpt_header h;
+
+    if(!out.is_open()) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RV32I_CKPT_MAGIC, sizeof(h.magic));
+    h.version = RV32I_CKPT_VERSION;
+    h.views = (imem == dmem) ? 1 : 2;
+    h.mem_size = mem_size;
+    h.pc = PC;
+    h.status = status;
+    h.trap_cause = trap_cause;
+    h.trap_value = trap_value;
+    h.image_end = image_end;
+    h.instret = instret;
+    h.cycle = cycle;
+    h.cycle_off = cycle_off;
+    h.instret_off = instret_off;
+    h.mscratch = mscratch;
+    h.misa_ext = misa_ext;
+    memcpy(h.regs, regs, sizeof(h.regs));
+    out.write((const char*)&h, sizeof(h)); //page counts are filled in afterwards
+    h.pages[0] = saveView(out, imem);
+    if(imem != dmem) h.pages[1] = saveView(out, dmem);
+    out.seekp(0);
+    out.write((const char*)&h, sizeof(h));
+    out.close();
+    if(out.fail()) {
+        std::cerr << "Unable to write checkpoint: " << file << std::endl;
+        return false;
+    }
+    debug_printf(DEBUG_LOW,"SimpleRV32I::saveCheckpoint> pc(%08x) pages %d/%d %s:%d\n",PC,h.pages[0],h.pages[1],__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * restores the machine state saved by saveCheckpoint(), the checkpoint file
+ * is mmap'd and its pages copied into guest memory
+ * the model must use the same memory layout the checkpoint was taken with,
+ * its memory ends up exactly as saved (whatever was mapped before is gone),
+ * a file that does not check out leaves the model as it was
+ * */
+bool SimpleRV32I::loadCheckpoint(std::string file) {
+    RV32I_FILE_MAP in(file);
+
+    if(!in.ok) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    const rv32i_ckpt_header *h = (const rv32i_ckpt_header*)in.data;
+    if((in.size < sizeof(*h)) || memcmp(h->magic, RV32I_CKPT_MAGIC, sizeof(h->magic)) || (h->version != RV32I_CKPT_VERSION)) {
+        std::cerr << "Not a checkpoint: " << file << std::endl;
+        return false;
+    }
+    if(h->views != ((imem == dmem) ? 1u : 2u)) {
+        std::cerr << "Checkpoint was taken with the " << ((h->views == 1) ? "unified" : "split") << " memory layout: " << file << std::endl;
+        return false;
+    }
+    if(h->misa_ext & ~isa_ext) {
+        std::cerr << "Checkpoint was taken with extensions the model does not implement (misa " << std::hex << h->misa_ext << std::dec << "): " << file << std::endl;
+        return false;
+    }
+
+    //every record is checked before anything is changed
+    const uint8_t *p = in.data + sizeof(*h);
+    const uint8_t *end = in.data + in.size;
+    for(uint32_t v=0; v<h->views; v++) {
+        for(uint32_t i=0; i<h->pages[v]; i++) {
+            const rv32i_ckpt_page *rec = (const rv32i_ckpt_page*)p;
+            if((end - p < (ptrdiff_t)sizeof(*rec)) ||
+               ((rec->flags & RV32I_CKPT_DATA) && (end - p < (ptrdiff_t)(sizeof(*rec) + RV32I_PAGE_SIZE)))) {
+                std::cerr << "Truncated checkpoint: " << file << std::endl;
+                return false;
+            }
+            if(rec->addr & RV32I_PAGE_MASK) {
+                std::cerr << "Not a checkpoint: " << file << std::endl;
+                return false;
+            }
+            p += sizeof(*rec) + ((rec->flags & RV32I_CKPT_DATA) ? RV32I_PAGE_SIZE : 0);
+        }
+    }
+
+    imem->reset();
+    if(dmem != imem) dmem->reset();
+    p = in.data + sizeof(*h);
+    for(uint32_t v=0; v<h->views; v++) {
+        RV32I_MEM *mem = v ? dmem : imem;
+        for(uint32_t i=0; i<h->pages[v]; i++) {
+            const rv32i_ckpt_page *rec = (const rv32i_ckpt_page*)p;
+            p += sizeof(*rec);
+            mem->map(rec->addr, RV32I_PAGE_SIZE, rec->flags & RV32I_PERM_MASK);
+            if(rec->flags & RV32I_CKPT_DATA) {
+                mem->write(rec->addr, p, RV32I_PAGE_SIZE);
+                p += RV32I_PAGE_SIZE;
+            }
+        }
+    }
+
+    mem_size = h->mem_size;
+    PC = h->pc;
+    status = h->status;
+    resv_addr = RV32I_RESV_NONE;    //not saved, an SC right after the restore fails
+    trap_cause = h->trap_cause;
+    trap_value = h->trap_value;
+    image_end = h->image_end;
+    instret = h->instret;
+    cycle = h->cycle;
+    cycle_off = h->cycle_off;
+    instret_off = h->instret_off;
+    mscratch = h->mscratch;
+    misa_ext = h->misa_ext;
+    memcpy(regs, h->regs, sizeof(regs));
+    invalidateDecodeCache();
+    flushTlb();
+    debug_printf(DEBUG_LOW,"SimpleRV32I::loadCheckpoint> pc(%08x) pages %d/%d %s:%d\n",PC,h->pages[0],h->pages[1],__FILE__, __LINE__);
+    return true;
+}
@@ -0,0 +1,517 @@
+#include <iostream>
+#include "SimpleRV32I_lockstep.h"
+#include "SimpleRV32I_utils.h"
+
+//the vector kernels are built for AVX2 and for the x86-64 baseline (SSE2), the loader picks one
+#if defined(__x86_64__)
+#define RV32I_VEC_CLONES __attribute__((target_clones("avx2","default")))
+#else
+#define RV32I_VEC_CLONES
+#endif
+
+#define LANE_BITS   ((1u << RV32I_VEC_LANES) - 1)
+#define BLEND(x, y, m)  (((x) & (m)) | ((y) & ~(m)))   //x in the lanes of m, y elsewhere
+
+
+/*
+ * executes an ALU instruction (rd != 0) or a jump/branch for the lanes in
+ * mask (m: the same mask, one all ones/all zeros element per lane), jumps
+ * and branches write the lanes' next pc to pcs and return it if it is the
+ * same for every lane, UINT32_MAX if the lanes went different ways
+ * vectors without a lane in mask are skipped
+ * */
+static uint32_t RV32I_VEC_CLONES vecExec(const rv32i_decoded *d, uint32_t pc, rv32i_vec (*regs)[RV32I_LOCKSTEP_VECS],
+                                         rv32i_vec *pcs, const rv32i_vec *m, uint64_t mask) {
+    rv32i_vec *rd = regs[d->rd];
+    const rv32i_vec *rs1 = regs[d->rs1];
+    const rv32i_vec *rs2 = regs[d->rs2];
+    const rv32i_vec zero = {};
+    const rv32i_vec k = zero + (uint32_t)d->imm;
+    const uint32_t target = pc + d->imm;
+    rv32i_vec lo = ~zero, hi = zero;    //lowest/highest next pc of the lanes in mask
+
+    #define VEC_LOOP(...) \
+        for(int v=0; v<RV32I_LOCKSTEP_VECS; v++) { \
+            if(!((mask >> (v*RV32I_VEC_LANES)) & LANE_BITS)) continue; \
+            rv32i_vec a = rs1[v], b = rs2[v]; \
+            (void)a; (void)b; \
+            __VA_ARGS__; \
+        } \
+        break
+    #define ALU(expr)       VEC_LOOP(rd[v] = BLEND((expr), rd[v], m[v]))
+    #define NEXT_PC(next)   rv32i_vec npc = (next); \
+                            pcs[v] = BLEND(npc, pcs[v], m[v]); \
+                            lo = (npc < lo) ? BLEND(npc, lo, m[v]) : lo; \
+                            hi = (npc > hi) ? BLEND(npc, hi, m[v]) : hi
+    #define BRANCH(cond)    VEC_LOOP(rv32i_vec t = (rv32i_vec)(cond); NEXT_PC(BLEND(zero + target, zero + (pc + 4), t)))
+
+    switch(d->op) {
+        case LUI:   ALU(k);
+        case AUIPC: ALU(zero + target);
+        case ADDI:  ALU(a + k);
+        case SLTI:  ALU((rv32i_vec)((rv32i_svec)a < (rv32i_svec)k) & 1);
+        case SLTIU: ALU((rv32i_vec)(a < k) & 1);
+        case XORI:  ALU(a ^ k);
+        case ORI:   ALU(a | k);
+        case ANDI:  ALU(a & k);
+        case SLLI:  ALU(a << (uint32_t)d->imm);
+        case SRLI:  ALU(a >> (uint32_t)d->imm);
+        case SRAI:  ALU((rv32i_vec)((rv32i_svec)a >> d->imm));
+        case ADD:   ALU(a + b);
+        case SUB:   ALU(a - b);
+        case SLL:   ALU(a << (b & 0x1f));
+        case SLT:   ALU((rv32i_vec)((rv32i_svec)a < (rv32i_svec)b) & 1);
+        case SLTU:  ALU((rv32i_vec)(a < b) & 1);
+        case XOR:   ALU(a ^ b);
+        case SRL:   ALU(a >> (b & 0x1f));
+        case SRA:   ALU((rv32i_vec)((rv32i_svec)a >> (rv32i_svec)(b & 0x1f)));
+        case OR:    ALU(a | b);
+        case AND:   ALU(a & b);
+        case MUL:   ALU(a * b);
+        case MULH:
+        case MULHSU:
+        case MULHU:
+        case DIV:
+        case DIVU:
+        case REM:
+        case REMU:  VEC_LOOP(rv32i_vec t;
+                             for(int i=0; i<RV32I_VEC_LANES; i++) t[i] = rv32i_mulDiv(d->op, a[i], b[i]);
+                             rd[v] = BLEND(t, rd[v], m[v]));
+        case JAL:   VEC_LOOP(if(d->rd) rd[v] = BLEND(zero + (pc + 4), rd[v], m[v]);
+                             NEXT_PC(zero + target));
+        case JALR:  VEC_LOOP(rv32i_vec t = (a + k) & ~1u;
+                             if(d->rd) rd[v] = BLEND(zero + (pc + 4), rd[v], m[v]);
+                             NEXT_PC(t));
+        case BEQ:   BRANCH(a == b);
+        case BNE:   BRANCH(a != b);
+        case BLT:   BRANCH((rv32i_svec)a < (rv32i_svec)b);
+        case BGE:   BRANCH((rv32i_svec)a >= (rv32i_svec)b);
+        case BLTU:  BRANCH(a < b);
+        case BGEU:  BRANCH(a >= b);
+        default:    return 0;
+    }
+
+    #undef VEC_LOOP
+    #undef ALU
+    #undef NEXT_PC
+    #undef BRANCH
+
+    uint32_t min = UINT32_MAX, max = 0;
+    for(int i=0; i<RV32I_VEC_LANES; i++) {
+        if(lo[i] < min) min = lo[i];
+        if(hi[i] > max) max = hi[i];
+    }
+    return (min == max) ? min : UINT32_MAX;
+}
+
+
+//expands a lane mask to one all ones/all zeros element per lane
+static void RV32I_VEC_CLONES laneMasks(uint64_t mask, rv32i_vec *m) {
+    const rv32i_vec index = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    const rv32i_vec zero = {};
+    static_assert(RV32I_VEC_LANES == 8, "index has one element per lane");
+    for(int v=0; v<RV32I_LOCKSTEP_VECS; v++) {
+        m[v] = -(((zero + (uint32_t)(mask >> (v*RV32I_VEC_LANES))) >> index) & 1);
+    }
+}
+
+
+RV32I_LOCKSTEP::RV32I_LOCKSTEP(SimpleRV32I *model) {
+    code = model->fork();
+    g = new rv32i_lanes;
+    memset(g, 0, sizeof(*g));
+    memset(&stats, 0, sizeof(stats));
+}
+
+RV32I_LOCKSTEP::~RV32I_LOCKSTEP() {
+    delete g;
+    delete code;
+}
+
+
+/*
+ * vector instruction set the kernels run with on this host
+ * */
+const char *RV32I_LOCKSTEP::vectorIsa() {
+#if defined(__x86_64__)
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+    return "generic";
+#endif
+}
+
+
+/*
+ * copies a model's state into lane l, which runs in lockstep unless the
+ * model has stopped, has one address space for code and data (its stores
+ * could change the code the group runs), decodes with other extensions
+ * than the group or traces/probes/profiles
+ * */
+void RV32I_LOCKSTEP::enter(uint32_t lane, SimpleRV32I *cpu, uint64_t maxInstructions) {
+    g->cpu[lane] = cpu;
+    g->retired[lane] = 0;
+    g->cycles[lane] = 0;
+    g->limit[lane] = maxInstructions;
+    g->tag_rd[lane] = RV32I_TLB_INVALID;
+    g->tag_wr[lane] = RV32I_TLB_INVALID;
+    if(maxInstructions != UINT64_MAX) g->limited = true;
+    for(int r=0; r<32; r++) {
+        reg(r, lane) = cpu->regs[r];
+    }
+    lanePc(lane) = cpu->PC;
+    if((cpu->status && (cpu->status != RV32I_STATUS_BREAK)) || (maxInstructions == 0)) return;
+    if((cpu->imem == cpu->dmem) || cpu->trace || cpu->probe || cpu->profiler || cpu->syscalls || cpu->break_map || cpu->watch_map || cpu->status ||
+       (cpu->misa_ext != code->misa_ext)) {
+        g->detached |= 1ull << lane;
+        return;
+    }
+    cpu->syncMemory();
+    g->live |= 1ull << lane;
+}
+
+
+/*
+ * copies lane l back to its model, which finishes the run on its own
+ * engine if the lane was detached
+ * */
+void RV32I_LOCKSTEP::leave(uint32_t lane) {
+    SimpleRV32I *cpu = g->cpu[lane];
+    for(int r=1; r<32; r++) {
+        cpu->regs[r] = reg(r, lane);
+    }
+    cpu->PC = lanePc(lane);
+    cpu->instret += g->retired[lane];
+    cpu->cycle += g->cycles[lane];
+    if(g->detached & (1ull << lane)) {
+        stats.detached++;
+        cpu->run(g->limit[lane] - g->retired[lane]);
+    }
+}
+
+
+/*
+ * the lanes in mask retired n more instructions costing cycles
+ * */
+void RV32I_LOCKSTEP::credit(uint64_t mask, uint64_t n, uint64_t cycles) {
+    if(n == 0) return;
+    for(uint64_t bits = mask; bits; bits &= bits - 1) {
+        int l = __builtin_ctzll(bits);
+        g->retired[l] += n;
+        g->cycles[l] += cycles;
+    }
+    stats.retired += n * __builtin_popcountll(mask);
+}
+
+
+/*
+ * the lanes in mask stop at pc, halted if status is RV32I_STATUS_HALT,
+ * otherwise with the status they have (trapped, or running and out of instructions)
+ * */
+void RV32I_LOCKSTEP::stop(uint64_t mask, uint32_t pc, uint8_t status) {
+    for(uint64_t bits = mask; bits; bits &= bits - 1) {
+        int l = __builtin_ctzll(bits);
+        lanePc(l) = pc;
+        if(status) g->cpu[l]->status = status;
+    }
+    g->live &= ~mask;
+}
+
+
+/*
+ * runs a load (rd != 0: written) or store of a T for the lanes in mask,
+ * each on its own memory, through a one entry TLB per lane kept with the
+ * group (the lanes' own TLBs are spread over their models); misses go to
+ * the model's load()/store() and copy the entry it ends up with
+ * a store that misses may move the page away from a fork (see
+ * RV32I_MEM::fork()), so it drops the lane's read entry
+ * returns the lanes whose access trapped
+ * */
+template<typename T, bool isStore> uint64_t RV32I_LOCKSTEP::memory(const rv32i_decoded *d, uint64_t mask) {
+    uint64_t fail = 0;
+    for(uint64_t bits = mask; bits; bits &= bits - 1) {
+        int l = __builtin_ctzll(bits);
+        uint32_t addr = reg(d->rs1, l) + d->imm;
+        uint32_t tag = addr & ~(uint32_t)(RV32I_PAGE_MASK & ~(sizeof(T) - 1));
+        SimpleRV32I *cpu;
+        const rv32i_tlb_entry *e;
+        T v;
+        if(isStore) {
+            if(g->tag_wr[l] == tag) {
+                *((T*)(g->addend_wr[l] + addr)) = (T)reg(d->rs2, l);
+                continue;
+            }
+            cpu = g->cpu[l];
+            if(!cpu->store(addr, (T)reg(d->rs2, l))) {
+                fail |= 1ull << l;
+                continue;
+            }
+            g->tag_rd[l] = RV32I_TLB_INVALID;
+            e = &cpu->tlb_wr[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)];
+            if(e->tag == (addr & ~RV32I_PAGE_MASK)) {
+                g->tag_wr[l] = e->tag;
+                g->addend_wr[l] = e->addend;
+            }
+            continue;
+        }
+        if(g->tag_rd[l] == tag) {
+            v = *((T*)(g->addend_rd[l] + addr));
+        } else {
+            cpu = g->cpu[l];
+            if(!cpu->load(addr, &v)) {
+                fail |= 1ull << l;
+                continue;
+            }
+            e = &cpu->tlb_rd[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)];
+            if(e->tag == (addr & ~RV32I_PAGE_MASK)) {
+                g->tag_rd[l] = e->tag;
+                g->addend_rd[l] = e->addend;
+            }
+        }
+        if(d->rd) reg(d->rd, l) = (int32_t)v;
+    }
+    return fail;
+}
+
+
+/*
+ * hands the instruction at pc to the step() of every lane in mask, for what
+ * the lanes cannot share (CSRs: each lane has its own counters, atomics:
+ * each has its own reservation)
+ * */
+void RV32I_LOCKSTEP::scalar(uint32_t pc, uint64_t mask) {
+    for(uint64_t bits = mask; bits; bits &= bits - 1) {
+        int l = __builtin_ctzll(bits);
+        SimpleRV32I *cpu = g->cpu[l];
+        for(int r=1; r<32; r++) {
+            cpu->regs[r] = reg(r, l);
+        }
+        cpu->PC = pc;
+        cpu->cycle += g->cycles[l];
+        g->cycles[l] = 0;
+        cpu->instret += g->retired[l];   //counted by its step() from here on, the budget left stays
+        g->limit[l] -= g->retired[l];
+        g->retired[l] = 0;
+        cpu->step();
+        g->tag_rd[l] = RV32I_TLB_INVALID;
+        g->tag_wr[l] = RV32I_TLB_INVALID;
+        for(int r=1; r<32; r++) {
+            reg(r, l) = cpu->regs[r];
+        }
+        lanePc(l) = cpu->PC;
+        stats.scalar++;
+        if(!RV32I_STATUS_STOPPED(cpu->status)) {
+            g->limit[l]--;
+            stats.retired++;
+        }
+        if(cpu->status) g->live &= ~(1ull << l);
+        else if(cpu->misa_ext != code->misa_ext) {
+            //a misa write changed what the lane decodes, it goes on alone
+            g->live &= ~(1ull << l);
+            g->detached |= 1ull << l;
+        }
+    }
+}
+
+
+/*
+ * runs the lanes in mask, all at pc, until they go different ways, jump
+ * past a pc other lanes wait at, or stop
+ * lanes waiting at a pc on the way join the group, next is the lowest pc
+ * of the other running lanes (all above pc)
+ * */
+void RV32I_LOCKSTEP::runBlock(uint32_t pc, uint64_t mask, uint32_t next) {
+    rv32i_vec m[RV32I_LOCKSTEP_VECS];
+    uint64_t budget = UINT64_MAX;   //instructions every lane in mask may still run
+    uint64_t n = 0;                 //instructions run by the lanes in mask since they were last credited
+    uint64_t cycles = 0;
+    bool join = true;
+
+    for(;;) {
+        if(pc == next) {
+            credit(mask, n, cycles);
+            n = 0;
+            cycles = 0;
+            next = UINT32_MAX;
+            for(uint64_t bits = g->live & ~mask; bits; bits &= bits - 1) {
+                int l = __builtin_ctzll(bits);
+                uint32_t p = lanePc(l);
+                if(p == pc) mask |= 1ull << l;
+                else if(p < next) next = p;
+            }
+            join = true;
+        }
+        if(join) {
+            laneMasks(mask, m);
+            if(g->limited) {
+                for(uint64_t bits = mask; bits; bits &= bits - 1) {
+                    int l = __builtin_ctzll(bits);
+                    if(g->limit[l] - g->retired[l] - n < budget) budget = g->limit[l] - g->retired[l] - n;
+                }
+            }
+            join = false;
+        }
+        if(budget == 0) {
+            //lanes out of instructions stop, the others are scheduled again
+            credit(mask, n, cycles);
+            for(uint64_t bits = mask; bits; bits &= bits - 1) {
+                int l = __builtin_ctzll(bits);
+                lanePc(l) = pc;
+                if(g->retired[l] == g->limit[l]) g->live &= ~(1ull << l);
+            }
+            return;
+        }
+
+        rv32i_decoded *d = code->decodeAt(pc);
+        if(d == NULL) {
+            credit(mask, n, cycles);
+            for(uint64_t bits = mask; bits; bits &= bits - 1) {
+                SimpleRV32I *cpu = g->cpu[__builtin_ctzll(bits)];
+                cpu->PC = pc;
+                cpu->trap((pc & 0x3) ? RV32I_CAUSE_FETCH_MISALIGNED : RV32I_CAUSE_FETCH_FAULT, pc);
+            }
+            stop(mask, pc, RV32I_STATUS_RUNNING);
+            return;
+        }
+        uint32_t cost = code->op_cost[d->op];
+        stats.issued++;
+        switch(d->op) {
+            case LB:
+            case LH:
+            case LW:
+            case LBU:
+            case LHU:
+            case SB:
+            case SH:
+            case SW:    {
+                            uint64_t fail;
+                            switch(d->op) {
+                                case LB:    fail = memory<int8_t, false>(d, mask); break;
+                                case LH:    fail = memory<int16_t, false>(d, mask); break;
+                                case LW:    fail = memory<int32_t, false>(d, mask); break;
+                                case LBU:   fail = memory<uint8_t, false>(d, mask); break;
+                                case LHU:   fail = memory<uint16_t, false>(d, mask); break;
+                                case SB:    fail = memory<uint8_t, true>(d, mask); break;
+                                case SH:    fail = memory<uint16_t, true>(d, mask); break;
+                                default:    fail = memory<uint32_t, true>(d, mask); break;
+                            }
+                            if(fail) {
+                                //the faulting lanes stop at this instruction
+                                credit(mask, n, cycles);
+                                n = 0;
+                                cycles = 0;
+                                stop(fail, pc, RV32I_STATUS_RUNNING);
+                                mask &= ~fail;
+                                if(mask == 0) return;
+                                laneMasks(mask, m);
+                            }
+                        }
+                        break;
+            case JAL:
+            case JALR:
+            case BEQ:
+            case BNE:
+            case BLT:
+            case BGE:
+            case BLTU:
+            case BGEU:  {
+                            //the group goes on while its lanes agree and no lane waits before the target
+                            uint32_t target = vecExec(d, pc, g->regs, g->pc, m, mask);
+                            n++;
+                            cycles += cost;
+                            budget--;
+                            if((target == UINT32_MAX) || (target > next)) {
+                                credit(mask, n, cycles);
+                                return;
+                            }
+                            pc = target;
+                        }
+                        continue;
+            case ECALL:
+            case EBREAK:
+                        credit(mask, n + 1, cycles + cost);
+                        stop(mask, pc, RV32I_STATUS_HALT);
+                        return;
+            case CSRRW:
+            case CSRRS:
+            case CSRRC:
+            case CSRRWI:
+            case CSRRSI:
+            case CSRRCI:
+            case LR_W:
+            case SC_W:
+            case AMOSWAP_W:
+            case AMOADD_W:
+            case AMOXOR_W:
+            case AMOAND_W:
+            case AMOOR_W:
+            case AMOMIN_W:
+            case AMOMAX_W:
+            case AMOMINU_W:
+            case AMOMAXU_W:
+            case FENCE_I:
+            case ILLEGAL:
+                        credit(mask, n, cycles);
+                        scalar(pc, mask);
+                        return;
+            default:    if(d->rd) vecExec(d, pc, g->regs, g->pc, m, mask);
+                        break;
+        }
+        n++;
+        cycles += cost;
+        budget--;
+        pc += 4;
+    }
+}
+
+
+/*
+ * runs the lanes of the group until each has stopped: the lanes at the
+ * lowest pc go first
+ * */
+void RV32I_LOCKSTEP::runGroup() {
+    while(g->live) {
+        uint32_t pc = UINT32_MAX, next = UINT32_MAX;
+        uint64_t mask = 0;
+        for(uint64_t bits = g->live; bits; bits &= bits - 1) {
+            int l = __builtin_ctzll(bits);
+            uint32_t p = lanePc(l);
+            if(p < pc) {
+                next = pc;
+                pc = p;
+                mask = 0;
+            } else if(p > pc) {
+                if(p < next) next = p;
+                continue;
+            }
+            mask |= 1ull << l;
+        }
+        runBlock(pc, mask, next);
+    }
+}
+
+
+/*
+ * runs n models until each completes, traps or has retired its
+ * maxInstructions (NULL: no limit), RV32I_LOCKSTEP_WIDTH at a time
+ * the models must be forks of the one the engine was built from, that only
+ * differ in their data memory and registers, and none of them may be run
+ * by anything else meanwhile
+ * */
+void RV32I_LOCKSTEP::run(SimpleRV32I * const *cpus, const uint64_t *maxInstructions, uint32_t n) {
+    for(uint32_t first=0; first<n; first+=RV32I_LOCKSTEP_WIDTH) {
+        uint32_t lanes = (n - first < RV32I_LOCKSTEP_WIDTH) ? n - first : RV32I_LOCKSTEP_WIDTH;
+        g->live = 0;
+        g->detached = 0;
+        g->limited = false;
+        for(uint32_t l=0; l<lanes; l++) {
+            enter(l, cpus[first + l], maxInstructions ? maxInstructions[first + l] : UINT64_MAX);
+        }
+        stats.lanes += lanes;
+        runGroup();
+        for(uint32_t l=0; l<lanes; l++) {
+            leave(l);
+        }
+        debug_printf(DEBUG_MEDIUM,"RV32I_LOCKSTEP::run> lanes %d-%d done, %llu issued %llu retired %s:%d\n",first,first+lanes-1,
+                     (unsigned long long)stats.issued,(unsigned long long)stats.retired,__FILE__, __LINE__);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef __SIMPLERV32I_LOCKSTEP_H__
+#define __SIMPLERV32I_LOCKSTEP_H__
+#include <stdint.h>
+#include "SimpleRV32I.h"
+
+/*
+ * Lockstep engine, for sweeps of one program over many inputs
+ *
+ * Runs instances of one program (forks of one model that differ in their
+ * data memory) RV32I_LOCKSTEP_WIDTH at a time, as the lanes of a group.
+ * Registers are kept in structure of arrays form, so an instruction is
+ * decoded once and executed for every lane at its pc with vector operations
+ * on RV32I_VEC_LANES lanes at a time (AVX2, or pairs of SSE operations on
+ * hosts without it, chosen when the program starts), under a mask of the
+ * lanes taking part.
+ * Lanes whose control flow diverges are regrouped by pc: the lanes at the
+ * lowest pc run next, up to the end of their basic block, and pick up the
+ * lanes waiting at a pc they run through. That is where the lanes leaving
+ * a loop early wait for the others to catch up.
+ * Loads/stores go to each lane's own memory, CSR instructions to the
+ * lane's step(). A lane that writes code it may execute (MEM_UNIFIED)
+ * leaves the group and finishes on its own engine, like lanes that trace,
+ * probe or profile.
+ * */
+
+#define RV32I_LOCKSTEP_WIDTH    64      //lanes per group, one bit each of a uint64_t mask
+#define RV32I_VEC_LANES         8       //lanes per vector, 256 bits
+#define RV32I_LOCKSTEP_VECS     (RV32I_LOCKSTEP_WIDTH / RV32I_VEC_LANES)
+
+typedef uint32_t rv32i_vec __attribute__((vector_size(4*RV32I_VEC_LANES)));
+typedef int32_t rv32i_svec __attribute__((vector_size(4*RV32I_VEC_LANES)));
+
+//state of a group, lane l of register r is regs[r][l / RV32I_VEC_LANES][l % RV32I_VEC_LANES]
+typedef struct {
+    rv32i_vec   regs[32][RV32I_LOCKSTEP_VECS];
+    rv32i_vec   pc[RV32I_LOCKSTEP_VECS];    //valid for the lanes not running
+    uint64_t    retired[RV32I_LOCKSTEP_WIDTH];  //instructions not yet added to the lane's instret
+    uint64_t    cycles[RV32I_LOCKSTEP_WIDTH];   //cycles not yet added to the lane's cycle
+    uint64_t    limit[RV32I_LOCKSTEP_WIDTH];    //instructions the lane may retire, retired included
+    uint32_t    tag_rd[RV32I_LOCKSTEP_WIDTH];   //last page each lane read/wrote, as a TLB entry of the lane's model
+    uint32_t    tag_wr[RV32I_LOCKSTEP_WIDTH];
+    uintptr_t   addend_rd[RV32I_LOCKSTEP_WIDTH];
+    uintptr_t   addend_wr[RV32I_LOCKSTEP_WIDTH];
+    SimpleRV32I *cpu[RV32I_LOCKSTEP_WIDTH];
+    uint64_t    live;       //lanes still running in lockstep
+    uint64_t    detached;   //lanes left to their own engine
+    bool        limited;    //some lane has an instruction limit
+} rv32i_lanes;
+
+typedef struct {
+    uint64_t    lanes;
+    uint64_t    issued;     //instructions decoded and executed for a group of lanes
+    uint64_t    retired;    //instructions retired by lanes in lockstep
+    uint64_t    scalar;     //instructions handed to a lane's step()
+    uint64_t    detached;   //lanes that finished on their own engine
+} rv32i_lockstep_stats;
+
+class RV32I_LOCKSTEP {
+    private:
+        SimpleRV32I *code;  //fork of the lanes' model, decodes for all of them
+        rv32i_lanes *g;
+        rv32i_lockstep_stats stats;
+
+        inline uint32_t &reg(int r, int l) { return g->regs[r][l / RV32I_VEC_LANES][l % RV32I_VEC_LANES]; }
+        inline uint32_t &lanePc(int l) { return g->pc[l / RV32I_VEC_LANES][l % RV32I_VEC_LANES]; }
+        void enter(uint32_t lane, SimpleRV32I *cpu, uint64_t maxInstructions);
+        void leave(uint32_t lane);
+        void credit(uint64_t mask, uint64_t n, uint64_t cycles);
+        void stop(uint64_t mask, uint32_t pc, uint8_t status);
+        template<typename T, bool isStore> uint64_t memory(const rv32i_decoded *d, uint64_t mask);
+        void scalar(uint32_t pc, uint64_t mask);
+        void runBlock(uint32_t pc, uint64_t mask, uint32_t next);
+        void runGroup();
+
+    public:
+        RV32I_LOCKSTEP(SimpleRV32I *model);
+        ~RV32I_LOCKSTEP();
+        void run(SimpleRV32I * const *cpus, const uint64_t *maxInstructions, uint32_t n);
+        const rv32i_lockstep_stats &getStats() { return stats; }
+        static const char *vectorIsa();
+};
+
+#endif
@@ -0,0 +1,310 @@
+#include <iostream>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include "SimpleRV32I_mem.h"
+#include "SimpleRV32I_utils.h"
+
+
+/*
+ * page buffers: the page contents are preceded by a reference count, one
+ * per memory (original or fork) the page is mapped in
+ * */
+#define RV32I_PAGE_HEADER   64
+
+static inline std::atomic<uint32_t> *pageRefs(uint8_t *data) {
+    return (std::atomic<uint32_t>*)(data - RV32I_PAGE_HEADER);
+}
+
+static uint8_t *allocPage() {
+    uint8_t *raw = new uint8_t[RV32I_PAGE_HEADER + RV32I_PAGE_SIZE]();
+    new (raw) std::atomic<uint32_t>(1);
+    return raw + RV32I_PAGE_HEADER;
+}
+
+static void releasePage(uint8_t *data) {
+    if(pageRefs(data)->fetch_sub(1) == 1) {
+        delete [] (data - RV32I_PAGE_HEADER);
+    }
+}
+
+//holds the page table lock for the rest of the scope while harts share the memory
+#define MEM_GUARD() std::unique_lock<std::mutex> guard(lock, std::defer_lock); if(concurrent) guard.lock()
+
+
+RV32I_MEM::RV32I_MEM() {
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        dir[i] = NULL;
+    }
+    code_gen = 0;
+    tlb_gen = 0;
+    concurrent = false;
+    for(int i=0; i<RV32I_RESV_SETS; i++) {
+        resv_gen[i] = 0;
+    }
+}
+
+RV32I_MEM::~RV32I_MEM() {
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        if(dir[i] == NULL) continue;
+        for(int j=0; j<RV32I_DIR_SIZE; j++) {
+            if(dir[i][j].data) releasePage(dir[i][j].data);
+        }
+        delete [] dir[i];
+    }
+    for(size_t i=0; i<free_pages.size(); i++) {
+        releasePage(free_pages[i]);
+    }
+}
+
+
+/*
+ * unmaps every page, buffers that are not shared with a fork are kept to
+ * back pages touched later on
+ * */
+void RV32I_MEM::reset() {
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        if(dir[i] == NULL) continue;
+        for(int j=0; j<RV32I_DIR_SIZE; j++) {
+            rv32i_page *pg = &dir[i][j];
+            if(pg->data) {
+                if(pageRefs(pg->data)->load() == 1) free_pages.push_back(pg->data);
+                else releasePage(pg->data);
+            }
+            pg->data = NULL;
+            pg->flags = 0;
+        }
+    }
+    code_gen++;
+    tlb_gen++;
+}
+
+
+/*
+ * turns this memory into a copy on write copy of golden: every page is
+ * shared and marked RV32I_PAGE_SHARED on both sides
+ * golden must not be running while it is forked, forks of the same golden
+ * memory can be taken from several threads
+ * */
+void RV32I_MEM::fork(RV32I_MEM *golden) {
+    std::lock_guard<std::mutex> guard(golden->fork_lock);
+    reset();
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        if(golden->dir[i] == NULL) continue;
+        rv32i_page *src = golden->dir[i];
+        rv32i_page *dst = lookup(i << (RV32I_PAGE_BITS + RV32I_DIR_BITS), true);
+        for(int j=0; j<RV32I_DIR_SIZE; j++) {
+            if(src[j].data) {
+                if(!(src[j].flags & RV32I_PAGE_SHARED)) {
+                    src[j].flags |= RV32I_PAGE_SHARED;
+                    golden->tlb_gen++; //golden's write TLB entries for the page must go
+                }
+                pageRefs(src[j].data)->fetch_add(1);
+            }
+            dst[j].data = src[j].data;
+            dst[j].flags = src[j].flags & ~(RV32I_PAGE_CODE | RV32I_PAGE_RESERVED);
+        }
+    }
+}
+
+/*
+ * returns the page table entry for addr, allocating the second level table
+ * if create is set, NULL if there is none
+ * */
+rv32i_page *RV32I_MEM::lookup(uint32_t addr, bool create) {
+    uint32_t d = addr >> (RV32I_PAGE_BITS + RV32I_DIR_BITS);
+    if(dir[d] == NULL) {
+        if(!create) return NULL;
+        dir[d] = new rv32i_page[RV32I_DIR_SIZE];
+        for(int i=0; i<RV32I_DIR_SIZE; i++) {
+            dir[d][i].data = NULL;
+            dir[d][i].flags = 0;
+        }
+    }
+    return &dir[d][(addr >> RV32I_PAGE_BITS) & (RV32I_DIR_SIZE - 1)];
+}
+
+
+/*
+ * maps [base, base+size) with the given permissions, rounded out to whole
+ * pages, pages already mapped keep their contents and gain the permissions
+ * (segments sharing a page get the union of their permissions)
+ * */
+bool RV32I_MEM::map(uint32_t base, uint32_t size, uint8_t perms) {
+    MEM_GUARD();
+    if(size == 0) return true;
+    uint64_t first = base >> RV32I_PAGE_BITS;
+    uint64_t last = ((uint64_t)base + size - 1) >> RV32I_PAGE_BITS;
+    if(last >= (1ULL << (32 - RV32I_PAGE_BITS))) return false;
+    for(uint64_t p = first; p <= last; p++) {
+        rv32i_page *pg = lookup(p << RV32I_PAGE_BITS, true);
+        pg->flags |= (perms & RV32I_PERM_MASK);
+    }
+    debug_printf(DEBUG_LOW,"RV32I_MEM::map> %08x-%08x perms(%x) %s:%d\n",base,(uint32_t)(base + size - 1),perms,__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * returns the page flags for addr, 0 if it is not mapped
+ * */
+uint8_t RV32I_MEM::getFlags(uint32_t addr) {
+    MEM_GUARD();
+    rv32i_page *pg = lookup(addr, false);
+    return pg ? pg->flags : 0;
+}
+
+
+/*
+ * returns the host address of a mapped page, allocating it on first touch
+ * a shared page about to be written is copied first (unless every fork
+ * sharing it is gone), which moves it: TLB entries for it become stale
+ * */
+uint8_t *RV32I_MEM::pageData(rv32i_page *pg, bool write) {
+    if(pg->data == NULL) {
+        if(free_pages.empty()) {
+            pg->data = allocPage();
+        } else {
+            pg->data = free_pages.back();
+            free_pages.pop_back();
+            memset(pg->data, 0, RV32I_PAGE_SIZE);
+        }
+    } else if(write && (pg->flags & RV32I_PAGE_SHARED)) {
+        if(pageRefs(pg->data)->load() != 1) {
+            uint8_t *copy = allocPage();
+            memcpy(copy, pg->data, RV32I_PAGE_SIZE);
+            releasePage(pg->data);
+            pg->data = copy;
+            tlb_gen++;
+        }
+        pg->flags &= ~RV32I_PAGE_SHARED;
+    }
+    return pg->data;
+}
+
+
+/*
+ * returns the host address of the page holding addr, allocating it on first
+ * touch, NULL if the page is not mapped with all the permissions in perm
+ * asking for RV32I_PERM_W gives a page that is not shared with a fork
+ * */
+uint8_t *RV32I_MEM::access(uint32_t addr, uint8_t perm) {
+    MEM_GUARD();
+    rv32i_page *pg = lookup(addr, false);
+    if((pg == NULL) || !(pg->flags & RV32I_PERM_MASK) || ((pg->flags & perm) != perm)) return NULL;
+    return pageData(pg, perm & RV32I_PERM_W);
+}
+
+
+/*
+ * records that instructions from the page holding addr are being cached,
+ * from now on writes to it have to go through codeWrite()
+ * */
+void RV32I_MEM::markCode(uint32_t addr) {
+    MEM_GUARD();
+    rv32i_page *pg = lookup(addr, false);
+    if((pg != NULL) && !(pg->flags & RV32I_PAGE_CODE)) {
+        pg->flags |= RV32I_PAGE_CODE;
+        tlb_gen++;  //write TLB entries for the page must go
+    }
+}
+
+
+/*
+ * an LR reserved a word on the page holding addr: while concurrent, the page
+ * leaves the write TLBs for good, so that every store to it reaches the
+ * store slow path and breaks the reservations on the sets it writes
+ * */
+void RV32I_MEM::reserve(uint32_t addr) {
+    MEM_GUARD();
+    if(!concurrent) return;
+    rv32i_page *pg = lookup(addr, false);
+    if((pg != NULL) && !(pg->flags & RV32I_PAGE_RESERVED)) {
+        pg->flags |= RV32I_PAGE_RESERVED;
+        tlb_gen++;  //write TLB entries for the page must go
+    }
+}
+
+
+/*
+ * a code page is being written: every cached decode/translation is stale
+ * the page stops being a code page until instructions are cached from it again
+ * */
+void RV32I_MEM::codeWrite(uint32_t addr) {
+    MEM_GUARD();
+    codeWritePage(lookup(addr, false), addr);
+}
+
+void RV32I_MEM::codeWritePage(rv32i_page *pg, uint32_t addr) {
+    if((pg != NULL) && (pg->flags & RV32I_PAGE_CODE)) {
+        pg->flags &= ~RV32I_PAGE_CODE;
+        code_gen++;
+        debug_printf(DEBUG_MEDIUM,"RV32I_MEM::codeWrite> %08x %s:%d\n",addr,__FILE__, __LINE__);
+    }
+}
+
+
+/*
+ * copies guest memory out, ignoring permissions; pages never touched read as 0
+ * returns false if part of the range is not mapped
+ * */
+bool RV32I_MEM::read(uint32_t addr, void *buf, uint32_t len) {
+    MEM_GUARD();
+    uint8_t *out = (uint8_t*)buf;
+    while(len) {
+        uint32_t off = addr & RV32I_PAGE_MASK;
+        uint32_t n = (len < RV32I_PAGE_SIZE - off) ? len : RV32I_PAGE_SIZE - off;
+        rv32i_page *pg = lookup(addr, false);
+        if((pg == NULL) || !(pg->flags & RV32I_PERM_MASK)) return false;
+        if(pg->data) memcpy(out, pg->data + off, n);
+        else memset(out, 0, n);
+        out += n;
+        addr += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/*
+ * copies data into guest memory, ignoring permissions (used by the loaders)
+ * returns false if part of the range is not mapped
+ * */
+bool RV32I_MEM::write(uint32_t addr, const void *buf, uint32_t len) {
+    MEM_GUARD();
+    const uint8_t *in = (const uint8_t*)buf;
+    while(len) {
+        uint32_t off = addr & RV32I_PAGE_MASK;
+        uint32_t n = (len < RV32I_PAGE_SIZE - off) ? len : RV32I_PAGE_SIZE - off;
+        rv32i_page *pg = lookup(addr, false);
+        if((pg == NULL) || !(pg->flags & RV32I_PERM_MASK)) return false;
+        codeWritePage(pg, addr);
+        memcpy(pageData(pg, true) + off, in, n);
+        in += n;
+        addr += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+/*
+ * sets a range of guest memory to value, ignoring permissions
+ * pages never touched are left alone when filling with 0
+ * */
+bool RV32I_MEM::fill(uint32_t addr, uint8_t value, uint32_t len) {
+    MEM_GUARD();
+    while(len) {
+        uint32_t off = addr & RV32I_PAGE_MASK;
+        uint32_t n = (len < RV32I_PAGE_SIZE - off) ? len : RV32I_PAGE_SIZE - off;
+        rv32i_page *pg = lookup(addr, false);
+        if((pg == NULL) || !(pg->flags & RV32I_PERM_MASK)) return false;
+        if(pg->data || value) {
+            codeWritePage(pg, addr);
+            memset(pageData(pg, true) + off, value, n);
+        }
+        addr += n;
+        len -= n;
+    }
+    return true;
+}
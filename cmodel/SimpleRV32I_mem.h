@@ -0,0 +1,128 @@
+#ifndef __SIMPLERV32I_MEM_H__
+#define __SIMPLERV32I_MEM_H__
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+/*
+ * Sparse paged guest memory, covering the full 32bit address space
+ *
+ * The address space is split in 4KiB pages, reached through a two level
+ * table (1024 directory entries of 1024 pages each). Second level tables are
+ * allocated when a region is mapped into them, page contents are allocated
+ * (zero filled) the first time a page is touched. Accesses to pages that
+ * were never mapped, or without the required permission, fail and are
+ * turned into guest traps by the model.
+ *
+ * A memory can be forked: the fork shares every page with the original,
+ * both sides copy a shared page the first time they write to it (page
+ * contents are reference counted, so forks may outlive the original).
+ * reset() unmaps everything but keeps the pages around for reuse.
+ *
+ * Harts of an SMP system (RV32I_SMP) share one memory from several threads:
+ * with setConcurrent() the page table updates (first touch, code page
+ * tracking) are serialized, guest accesses through the TLBs are not. Pages
+ * an LR reserved a word on are kept out of the write TLBs from then on, so
+ * that plain stores to them can break the reservations.
+ * */
+
+#define RV32I_PAGE_BITS     12
+#define RV32I_PAGE_SIZE     (1 << RV32I_PAGE_BITS)
+#define RV32I_PAGE_MASK     (RV32I_PAGE_SIZE - 1)
+#define RV32I_DIR_BITS      10
+#define RV32I_DIR_SIZE      (1 << RV32I_DIR_BITS)
+
+//page permissions
+#define RV32I_PERM_R        0x01
+#define RV32I_PERM_W        0x02
+#define RV32I_PERM_X        0x04
+#define RV32I_PERM_RW       (RV32I_PERM_R | RV32I_PERM_W)
+#define RV32I_PERM_RX       (RV32I_PERM_R | RV32I_PERM_X)
+#define RV32I_PERM_RWX      (RV32I_PERM_R | RV32I_PERM_W | RV32I_PERM_X)
+#define RV32I_PERM_MASK     RV32I_PERM_RWX
+
+//page state
+#define RV32I_PAGE_CODE     0x10    //instructions from this page are cached, writes must flush the code caches
+#define RV32I_PAGE_SHARED   0x20    //contents may be shared with a fork, copied before the first write
+#define RV32I_PAGE_RESERVED 0x40    //LR reserved a word here while concurrent, stores must break the reservations (see reserve())
+
+//LR/SC reservation sets, 8 byte granules hashed on the address, see resvSet()
+#define RV32I_RESV_SETS     256
+
+typedef struct {
+    uint8_t     *data;      //host copy of the page, NULL until first touched
+    uint8_t     flags;      //RV32I_PERM_* | RV32I_PAGE_*, 0 if not mapped
+} rv32i_page;
+
+//true if the page contents are all zero
+static inline bool zeroPage(const uint8_t *data) {
+    const uint64_t *w = (const uint64_t*)data;
+    for(int i=0; i<RV32I_PAGE_SIZE/8; i++) {
+        if(w[i]) return false;
+    }
+    return true;
+}
+
+
+class RV32I_MEM {
+    private:
+        rv32i_page *dir[RV32I_DIR_SIZE];
+        std::vector<uint8_t*> free_pages;   //page buffers kept by reset()
+        std::mutex fork_lock;
+        std::mutex lock;    //page table updates, taken only while concurrent
+        bool concurrent;
+        std::atomic<uint32_t> resv_gen[RV32I_RESV_SETS];
+
+        rv32i_page *lookup(uint32_t addr, bool create);
+        uint8_t *pageData(rv32i_page *pg, bool write);
+        void codeWritePage(rv32i_page *pg, uint32_t addr);
+
+    public:
+        //bumped whenever a code page is written: cached decodes/translations are stale
+        std::atomic<uint32_t> code_gen;
+        //bumped whenever a page may no longer be reached through a write TLB entry
+        std::atomic<uint32_t> tlb_gen;
+
+        RV32I_MEM();
+        ~RV32I_MEM();
+
+        void reset();
+        void fork(RV32I_MEM *golden);
+        void setConcurrent(bool on) { concurrent = on; }
+        /*
+         * generation of the reservation set holding addr, bumped by every
+         * SC/AMO to it, and by plain stores to it once its page is reserved:
+         * an SC only succeeds if no other write got in since its LR
+         * */
+        std::atomic<uint32_t> *resvSet(uint32_t addr) { return &resv_gen[(addr >> 3) & (RV32I_RESV_SETS - 1)]; }
+        bool map(uint32_t base, uint32_t size, uint8_t perms);
+        //second level table index (pages index*1024...), NULL if nothing was mapped there
+        const rv32i_page *getTable(uint32_t index) { return dir[index]; }
+        uint8_t getFlags(uint32_t addr);
+        uint8_t *access(uint32_t addr, uint8_t perm);
+        void markCode(uint32_t addr);
+        void reserve(uint32_t addr);
+        void codeWrite(uint32_t addr);
+        bool read(uint32_t addr, void *buf, uint32_t len);
+        bool write(uint32_t addr, const void *buf, uint32_t len);
+        bool fill(uint32_t addr, uint8_t value, uint32_t len);
+};
+
+
+/*
+ * software TLB entry, direct mapped on the guest page number
+ * tag is the guest page address (RV32I_TLB_INVALID if empty), addend is the
+ * host page address minus the guest page address
+ * */
+typedef struct {
+    uint32_t    tag;
+    uint32_t    pad;
+    uintptr_t   addend;
+} rv32i_tlb_entry;
+
+#define RV32I_TLB_BITS      8
+#define RV32I_TLB_SIZE      (1 << RV32I_TLB_BITS)
+#define RV32I_TLB_INVALID   0xffffffff
+
+#endif
@@ -0,0 +1,197 @@
+#include <iostream>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+
+RV32I_PROBE::RV32I_PROBE() {
+    cur = NULL;
+    fill = 0;
+    running = false;
+}
+
+RV32I_PROBE::~RV32I_PROBE() {
+    finish();
+    for(size_t i=0; i<consumers.size(); i++) {
+        delete consumers[i]->full;
+        delete consumers[i]->empty;
+        delete consumers[i];
+    }
+    for(size_t i=0; i<chunks.size(); i++) {
+        delete chunks[i];
+    }
+}
+
+
+/*
+ * adds an analysis, all of them have to be added before start()
+ * the consumer is not owned by the probe
+ * */
+void RV32I_PROBE::addConsumer(RV32I_PROBE_CONSUMER *consumer) {
+    rv32i_probe_consumer *c = new rv32i_probe_consumer;
+    c->consumer = consumer;
+    c->full = new rv32i_chunk_queue();
+    c->empty = new rv32i_chunk_queue();
+    c->sleeping.store(false);
+    consumers.push_back(c);
+}
+
+
+/*
+ * starts one thread per consumer, events can be recorded afterwards
+ * */
+void RV32I_PROBE::start() {
+    if(running) return;
+    running = true;
+    for(size_t i=0; i<consumers.size(); i++) {
+        consumers[i]->thread = std::thread(consumerThread, consumers[i]);
+    }
+    cur = getChunk();
+    fill = 0;
+}
+
+
+/*
+ * hands the events recorded so far to the consumers and waits until they
+ * have seen all of them
+ * */
+void RV32I_PROBE::finish() {
+    if(!running) return;
+    if(fill) flush();
+    for(size_t i=0; i<consumers.size(); i++) {
+        handOver(consumers[i], NULL); //end of stream
+        consumers[i]->thread.join();
+    }
+    running = false;
+}
+
+
+void RV32I_PROBE::report(std::ostream &out) {
+    for(size_t i=0; i<consumers.size(); i++) {
+        consumers[i]->consumer->report(out);
+    }
+}
+
+
+/*
+ * returns a chunk no consumer uses anymore, a new one while fewer than
+ * RV32I_PROBE_CHUNKS are in flight per consumer, otherwise waits for the
+ * consumers to catch up
+ * */
+rv32i_event_chunk *RV32I_PROBE::getChunk() {
+    rv32i_event_chunk *chunk;
+    for(;;) {
+        for(size_t i=0; i<consumers.size(); i++) {
+            if(consumers[i]->empty->pop(&chunk)) return chunk;
+        }
+        if(chunks.size() < RV32I_PROBE_CHUNKS - 1) break;
+        std::this_thread::yield();
+    }
+    chunk = new rv32i_event_chunk;
+    chunks.push_back(chunk);
+    return chunk;
+}
+
+
+/*
+ * passes a full chunk to every consumer
+ * */
+void RV32I_PROBE::publish(rv32i_event_chunk *chunk) {
+    chunk->refs.store(consumers.size(), std::memory_order_relaxed);
+    for(size_t i=0; i<consumers.size(); i++) {
+        handOver(consumers[i], chunk);
+    }
+}
+
+
+/*
+ * queues chunk for c and wakes it if it sleeps: it announces that before it
+ * looks at the queue a last time, the fences order that against the push
+ * */
+void RV32I_PROBE::handOver(rv32i_probe_consumer *c, rv32i_event_chunk *chunk) {
+    while(!c->full->push(chunk)) std::this_thread::yield();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(c->sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(c->lock);
+        c->sleeping.store(false, std::memory_order_relaxed);
+        c->wake.notify_one();
+    }
+}
+
+
+void RV32I_PROBE::flush() {
+    cur->n = fill;
+    if(consumers.empty()) {
+        fill = 0;
+        return;
+    }
+    publish(cur);
+    cur = getChunk();
+    fill = 0;
+}
+
+
+/*
+ * consumer side: runs the analysis on each chunk, the last consumer done
+ * with a chunk returns it to the simulator thread
+ * waits for chunks spinning RV32I_PROBE_SPIN times, then asleep
+ * */
+void RV32I_PROBE::consumerThread(rv32i_probe_consumer *c) {
+    uint64_t events = 0;
+    for(;;) {
+        rv32i_event_chunk *chunk;
+        for(int spin=0; !c->full->pop(&chunk); spin++) {
+            if(spin < RV32I_PROBE_SPIN) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(c->lock);
+            c->sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(c->full->pop(&chunk)) {
+                c->sleeping.store(false, std::memory_order_relaxed);
+                break;
+            }
+            c->wake.wait(guard, [c] { return !c->sleeping.load(std::memory_order_relaxed); });
+            spin = 0;
+        }
+        if(chunk == NULL) break;
+        c->consumer->consume(chunk->events, chunk->n);
+        events += chunk->n;
+        if(chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            while(!c->empty->push(chunk)) std::this_thread::yield();
+        }
+    }
+    debug_printf(DEBUG_LOW,"RV32I_PROBE::consumerThread> %llu events %s:%d\n",(unsigned long long)events,__FILE__, __LINE__);
+}
+
+
+/*
+ * turns an instruction executed by step() into events: its fetch, the
+ * access of a load/store that did not trap, the outcome of a branch
+ * stored is false for an SC.W that failed, which does not write memory
+ * */
+void SimpleRV32I::probeStep(rv32i_operation op, uint32_t pc, uint32_t addr, bool stored) {
+    static const uint8_t sizes[] = { 1, 2, 4, 1, 2, 1, 2, 4 };  //LB..SW
+    probe->event(pc, RV32I_EVENT_FETCH | (4 << 8));
+    if(RV32I_STATUS_STOPPED(status)) return;
+    if((op >= LB) && (op <= LHU)) {
+        probe->event(addr, RV32I_EVENT_LOAD | (sizes[op - LB] << 8));
+    } else if((op >= SB) && (op <= SW)) {
+        probe->event(addr, RV32I_EVENT_STORE | (sizes[op - LB] << 8));
+    } else if(op == LR_W) {
+        probe->event(addr, RV32I_EVENT_LOAD | (4 << 8));
+    } else if((op >= SC_W) && (op <= AMOMAXU_W)) {
+        if(stored) probe->event(addr, RV32I_EVENT_STORE | (4 << 8));
+    } else if((op >= BEQ) && (op <= BGEU)) {
+        probe->event(pc, RV32I_EVENT_BRANCH | ((PC != pc + 4) ? RV32I_EVENT_TAKEN : 0));
+    }
+}
+
+
+/*
+ * sends the events of the instructions executed from now on to probe
+ * (started by the caller), NULL detaches it
+ * */
+void SimpleRV32I::attachProbe(RV32I_PROBE *probe) {
+    this->probe = probe;
+}
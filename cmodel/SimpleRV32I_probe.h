@@ -0,0 +1,135 @@
+#ifndef __SIMPLERV32I_PROBE_H__
+#define __SIMPLERV32I_PROBE_H__
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <ostream>
+
+/*
+ * Memory access / branch event pipeline
+ *
+ * An attached probe turns every executed instruction into events (fetch,
+ * load, store, conditional branch outcome) batched into fixed size chunks.
+ * Full chunks are handed to the consumer threads over single producer /
+ * single consumer lock free queues, one per consumer, and come back over a
+ * second queue once every consumer is done with them. The simulator thread
+ * only appends to the current chunk, the analysis (e.g. RV32I_CACHE_MODEL)
+ * runs on the consumers' threads; if they fall behind, the simulator waits
+ * for a chunk to come back rather than growing the queues. A consumer with
+ * nothing to do spins a little, then sleeps until the next chunk is handed
+ * to it.
+ * */
+
+#define RV32I_EVENT_FETCH   0
+#define RV32I_EVENT_LOAD    1
+#define RV32I_EVENT_STORE   2
+#define RV32I_EVENT_BRANCH  3
+#define RV32I_EVENT_TYPE    0x3
+#define RV32I_EVENT_TAKEN   0x4     //branch taken
+#define RV32I_EVENT_SIZE(info)  ((info) >> 8)   //access size in bytes
+
+#define RV32I_CHUNK_EVENTS  4096    //events per chunk
+#define RV32I_PROBE_CHUNKS  64      //chunks in flight per consumer, a power of two
+#define RV32I_PROBE_SPIN    100     //empty polls before a consumer sleeps
+
+/*
+ * one event: the address accessed (the pc for fetches and branches) and
+ * RV32I_EVENT_* | size << 8
+ * */
+typedef struct {
+    uint32_t    addr;
+    uint32_t    info;
+} rv32i_event;
+
+typedef struct {
+    std::atomic<uint32_t> refs;     //consumers still reading the chunk
+    uint32_t    n;                  //events in the chunk
+    rv32i_event events[RV32I_CHUNK_EVENTS];
+} rv32i_event_chunk;
+
+/*
+ * bounded single producer / single consumer queue, N a power of two
+ * the indices are only ever written by one side each
+ * */
+template<typename T, uint32_t N> class RV32I_SPSC_QUEUE {
+    private:
+        alignas(64) std::atomic<uint32_t> head;    //next slot to pop, written by the consumer
+        alignas(64) std::atomic<uint32_t> tail;    //next slot to push, written by the producer
+        alignas(64) T slots[N];
+
+    public:
+        RV32I_SPSC_QUEUE() : head(0), tail(0) {}
+
+        bool push(const T &value) {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) == N) return false;
+            slots[t & (N - 1)] = value;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T *value) {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire)) return false;
+            *value = slots[h & (N - 1)];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+};
+
+typedef RV32I_SPSC_QUEUE<rv32i_event_chunk*, RV32I_PROBE_CHUNKS> rv32i_chunk_queue;
+
+/*
+ * analysis run on a consumer thread, sees every event in order
+ * */
+class RV32I_PROBE_CONSUMER {
+    public:
+        virtual ~RV32I_PROBE_CONSUMER() {}
+        virtual void consume(const rv32i_event *events, uint32_t n) = 0;
+        virtual void report(std::ostream &out) = 0;
+};
+
+class RV32I_PROBE {
+    private:
+        typedef struct {
+            RV32I_PROBE_CONSUMER *consumer;
+            rv32i_chunk_queue   *full;      //simulator -> consumer
+            rv32i_chunk_queue   *empty;     //consumer -> simulator, chunks it released last
+            std::thread         thread;
+            std::mutex          lock;       //sleeping/wake
+            std::condition_variable wake;
+            std::atomic<bool>   sleeping;   //the consumer waits on wake for a chunk
+        } rv32i_probe_consumer;
+
+        std::vector<rv32i_probe_consumer*> consumers;
+        std::vector<rv32i_event_chunk*> chunks;    //every chunk allocated, for the destructor
+        rv32i_event_chunk *cur;
+        uint32_t    fill;
+        bool        running;
+
+        rv32i_event_chunk *getChunk();
+        void publish(rv32i_event_chunk *chunk);
+        void flush();
+        static void handOver(rv32i_probe_consumer *c, rv32i_event_chunk *chunk);
+        static void consumerThread(rv32i_probe_consumer *c);
+
+    public:
+        RV32I_PROBE();
+        ~RV32I_PROBE();
+        void addConsumer(RV32I_PROBE_CONSUMER *consumer);
+        void start();
+        void finish();
+        void report(std::ostream &out);
+
+        inline void event(uint32_t addr, uint32_t info) {
+            if(fill == RV32I_CHUNK_EVENTS) flush();
+            rv32i_event *e = &cur->events[fill++];
+            e->addr = addr;
+            e->info = info;
+        }
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <elf.h>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+
+RV32I_PROFILER::RV32I_PROFILER() {
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        pc_dir[i] = NULL;
+    }
+    start(0);
+}
+
+RV32I_PROFILER::~RV32I_PROFILER() {
+    for(int i=0; i<RV32I_DIR_SIZE; i++) {
+        if(pc_dir[i] == NULL) continue;
+        for(int j=0; j<RV32I_DIR_SIZE; j++) {
+            delete [] pc_dir[i][j];
+        }
+        delete [] pc_dir[i];
+    }
+}
+
+
+/*
+ * drops the call stacks, profiling (re)starts in the function at pc
+ * block and PC counts are kept
+ * */
+void RV32I_PROFILER::start(uint32_t pc) {
+    rv32i_profile_node root;
+    root.parent = 0;
+    root.func = pc;
+    root.self = 0;
+    nodes.clear();
+    node_index.clear();
+    stack.clear();
+    nodes.push_back(root);
+    cur = 0;
+    pending = RV32I_LINK_NONE;
+    pending_ret = 0;
+}
+
+
+/*
+ * returns the counter of the block of n instructions at pc, blocks
+ * translated again (after a flush) keep counting in the same one
+ * */
+uint64_t *RV32I_PROFILER::blockCounter(uint32_t pc, uint32_t n) {
+    uint64_t key = ((uint64_t)pc << 32) | n;
+    std::unordered_map<uint64_t, uint32_t>::iterator it = block_index.find(key);
+    if(it != block_index.end()) return &blocks[it->second].count;
+    rv32i_profile_block b;
+    b.pc = pc;
+    b.n = n;
+    b.count = 0;
+    block_index[key] = blocks.size();
+    blocks.push_back(b);
+    return &blocks.back().count;
+}
+
+
+uint64_t *RV32I_PROFILER::newPcCounter(uint32_t pc) {
+    uint64_t ***table = &pc_dir[pc >> (RV32I_PAGE_BITS + RV32I_DIR_BITS)];
+    if(*table == NULL) {
+        *table = new uint64_t*[RV32I_DIR_SIZE];
+        for(int i=0; i<RV32I_DIR_SIZE; i++) {
+            (*table)[i] = NULL;
+        }
+    }
+    uint64_t **page = &(*table)[(pc >> RV32I_PAGE_BITS) & (RV32I_DIR_SIZE - 1)];
+    *page = new uint64_t[RV32I_PAGE_WORDS];
+    memset(*page, 0, RV32I_PAGE_WORDS * sizeof(uint64_t));
+    return &(*page)[(pc & RV32I_PAGE_MASK) >> 2];
+}
+
+
+/*
+ * follows the call/return that ended the last instruction/block, pc is
+ * where it went: a call enters the callee's path, a return unwinds to the
+ * frame it returns to (returns matching no frame, e.g. after a longjmp
+ * style stack switch, are ignored)
+ * */
+void RV32I_PROFILER::transfer(uint32_t pc) {
+    if(pending == RV32I_LINK_CALL) {
+        rv32i_profile_frame f;
+        f.node = cur;
+        f.ret = pending_ret;
+        stack.push_back(f);
+        uint64_t key = ((uint64_t)cur << 32) | pc;
+        std::unordered_map<uint64_t, uint32_t>::iterator it = node_index.find(key);
+        if(it == node_index.end()) {
+            rv32i_profile_node n;
+            n.parent = cur;
+            n.func = pc;
+            n.self = 0;
+            it = node_index.insert(std::make_pair(key, (uint32_t)nodes.size())).first;
+            nodes.push_back(n);
+        }
+        cur = it->second;
+    } else {
+        for(size_t i=stack.size(); i>0; i--) {
+            if(stack[i-1].ret == pc) {
+                cur = stack[i-1].node;
+                stack.resize(i-1);
+                break;
+            }
+        }
+    }
+    pending = RV32I_LINK_NONE;
+}
+
+
+/*
+ * reads the function symbols of an ELF file (all code labels if it has
+ * no typed function symbols, e.g. hand written assembly)
+ * */
+bool RV32I_PROFILER::loadSymbols(std::string file) {
+    std::ifstream in(file.c_str(), std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr*)data.data();
+
+    if((data.size() < sizeof(Elf32_Ehdr)) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || (eh->e_ident[EI_CLASS] != ELFCLASS32) ||
+       (eh->e_shentsize != sizeof(Elf32_Shdr)) || ((uint64_t)eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf32_Shdr) > data.size())) {
+        return false;
+    }
+    const Elf32_Shdr *sh = (const Elf32_Shdr*)(data.data() + eh->e_shoff);
+    std::vector<rv32i_symbol> funcs, labels;
+    for(int i=0; i<eh->e_shnum; i++) {
+        if((sh[i].sh_type != SHT_SYMTAB) || (sh[i].sh_link >= eh->e_shnum)) continue;
+        const Elf32_Shdr &strtab = sh[sh[i].sh_link];
+        if(((uint64_t)sh[i].sh_offset + sh[i].sh_size > data.size()) || ((uint64_t)strtab.sh_offset + strtab.sh_size > data.size())) {
+            return false;
+        }
+        const Elf32_Sym *sym = (const Elf32_Sym*)(data.data() + sh[i].sh_offset);
+        for(uint32_t j=0; j<sh[i].sh_size / sizeof(Elf32_Sym); j++) {
+            uint8_t type = ELF32_ST_TYPE(sym[j].st_info);
+            if((sym[j].st_shndx == SHN_UNDEF) || (sym[j].st_shndx >= SHN_LORESERVE) || (sym[j].st_name >= strtab.sh_size)) continue;
+            if((type != STT_FUNC) && (type != STT_NOTYPE)) continue;
+            rv32i_symbol s;
+            s.addr = sym[j].st_value;
+            s.size = sym[j].st_size;
+            s.name = std::string(data.data() + strtab.sh_offset + sym[j].st_name,
+                                 strnlen(data.data() + strtab.sh_offset + sym[j].st_name, strtab.sh_size - sym[j].st_name));
+            if(s.name.empty() || (s.name[0] == '$') || !s.name.compare(0, 2, ".L")) continue; //mapping symbols, local labels
+            ((type == STT_FUNC) ? funcs : labels).push_back(s);
+        }
+    }
+    symbols = funcs.empty() ? labels : funcs;
+    std::sort(symbols.begin(), symbols.end(), [](const rv32i_symbol &a, const rv32i_symbol &b) { return a.addr < b.addr; });
+    debug_printf(DEBUG_LOW,"RV32I_PROFILER::loadSymbols> %d symbols %s:%d\n",(int)symbols.size(),__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * name of the symbol holding pc (+offset), the address if there is none
+ * */
+std::string RV32I_PROFILER::symbolize(uint32_t pc, bool offset) {
+    std::ostringstream s;
+    std::vector<rv32i_symbol>::iterator it = std::upper_bound(symbols.begin(), symbols.end(), pc,
+                                             [](uint32_t a, const rv32i_symbol &b) { return a < b.addr; });
+    if(it != symbols.begin()) {
+        --it;
+        if(!it->size || (pc < it->addr + it->size)) {
+            s << it->name;
+            if(offset && (pc != it->addr)) s << "+0x" << std::hex << pc - it->addr;
+            return s.str();
+        }
+    }
+    s << "0x" << std::hex << std::setw(8) << std::setfill('0') << pc;
+    return s.str();
+}
+
+
+//instructions run per PC, from the block and per PC counts
+void RV32I_PROFILER::pcCounts(std::map<uint32_t, uint64_t> *counts) {
+    for(size_t i=0; i<blocks.size(); i++) {
+        if(blocks[i].count == 0) continue;
+        for(uint32_t j=0; j<blocks[i].n; j++) {
+            (*counts)[blocks[i].pc + 4*j] += blocks[i].count;
+        }
+    }
+    for(uint32_t d=0; d<RV32I_DIR_SIZE; d++) {
+        if(pc_dir[d] == NULL) continue;
+        for(uint32_t p=0; p<RV32I_DIR_SIZE; p++) {
+            if(pc_dir[d][p] == NULL) continue;
+            for(uint32_t w=0; w<RV32I_PAGE_WORDS; w++) {
+                if(pc_dir[d][p][w]) (*counts)[(d << (RV32I_DIR_BITS + RV32I_PAGE_BITS)) | (p << RV32I_PAGE_BITS) | (w << 2)] += pc_dir[d][p][w];
+            }
+        }
+    }
+}
+
+
+/*
+ * hot functions (instructions run in them, self and including callees),
+ * hot blocks and hot PCs, RV32I_PROFILE_TOP of each
+ * out's formatting (base, precision) is left as it was found
+ * */
+void RV32I_PROFILER::report(std::ostream &out) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    uint64_t total = 0;
+    std::map<uint32_t, uint64_t> self, inclusive;
+    for(size_t i=0; i<nodes.size(); i++) {
+        total += nodes[i].self;
+        self[nodes[i].func] += nodes[i].self;
+        //counted once per function on the path, recursion included
+        std::vector<uint32_t> seen;
+        for(uint32_t n=i; ; n=nodes[n].parent) {
+            if(std::find(seen.begin(), seen.end(), nodes[n].func) == seen.end()) {
+                seen.push_back(nodes[n].func);
+                inclusive[nodes[n].func] += nodes[i].self;
+            }
+            if(n == 0) break;
+        }
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t> > funcs;
+    for(std::map<uint32_t, uint64_t>::iterator it=self.begin(); it!=self.end(); ++it) {
+        funcs.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(funcs.rbegin(), funcs.rend());
+    out << "# " << std::dec << total << " instructions profiled" << std::endl;
+    out << "# functions: self instructions, self %, including callees, name" << std::endl;
+    for(size_t i=0; (i < funcs.size()) && (i < RV32I_PROFILE_TOP); i++) {
+        out << std::dec << std::setw(14) << funcs[i].first << std::fixed << std::setprecision(2) << std::setw(8)
+            << (total ? 100.0 * funcs[i].first / total : 0) << "%" << std::setw(14) << inclusive[funcs[i].second]
+            << "  " << symbolize(funcs[i].second, true) << std::endl;
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t> > hot;
+    for(size_t i=0; i<blocks.size(); i++) {
+        if(blocks[i].count) hot.push_back(std::make_pair(blocks[i].count * blocks[i].n, (uint32_t)i));
+    }
+    std::sort(hot.rbegin(), hot.rend());
+    out << "# blocks: instructions run, executions, length, start" << std::endl;
+    for(size_t i=0; (i < hot.size()) && (i < RV32I_PROFILE_TOP); i++) {
+        const rv32i_profile_block &b = blocks[hot[i].second];
+        out << std::dec << std::setw(14) << hot[i].first << std::setw(14) << b.count << std::setw(6) << b.n
+            << "  " << symbolize(b.pc, true) << std::endl;
+    }
+
+    std::map<uint32_t, uint64_t> counts;
+    pcCounts(&counts);
+    std::vector<std::pair<uint64_t, uint32_t> > pcs;
+    for(std::map<uint32_t, uint64_t>::iterator it=counts.begin(); it!=counts.end(); ++it) {
+        pcs.push_back(std::make_pair(it->second, it->first));
+    }
+    std::partial_sort(pcs.begin(), pcs.begin() + std::min(pcs.size(), (size_t)RV32I_PROFILE_TOP), pcs.end(),
+                      [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) { return a.first > b.first; });
+    out << "# pcs: executions, pc" << std::endl;
+    for(size_t i=0; (i < pcs.size()) && (i < RV32I_PROFILE_TOP); i++) {
+        out << std::dec << std::setw(14) << pcs[i].first << "  " << std::hex << std::setw(8) << std::setfill('0') << pcs[i].second
+            << std::setfill(' ') << " " << symbolize(pcs[i].second, true) << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+
+/*
+ * collapsed stacks (flamegraph.pl input): one line per call path that ran
+ * instructions, "outer;...;inner <instructions>"
+ * */
+void RV32I_PROFILER::flamegraph(std::ostream &out) {
+    for(size_t i=0; i<nodes.size(); i++) {
+        if(nodes[i].self == 0) continue;
+        std::string path;
+        for(uint32_t n=i; ; n=nodes[n].parent) {
+            path = symbolize(nodes[n].func, false) + (path.empty() ? "" : ";") + path;
+            if(n == 0) break;
+        }
+        out << path << " " << std::dec << nodes[i].self << std::endl;
+    }
+}
+
+
+/*
+ * counts the instructions run from now on in profiler, NULL detaches it
+ * blocks are translated again to pick up their counters
+ * */
+void SimpleRV32I::attachProfiler(RV32I_PROFILER *profiler) {
+    flushBlocks();
+    this->profiler = profiler;
+    if(profiler) profiler->start(PC);
+}
@@ -0,0 +1,133 @@
+#ifndef __SIMPLERV32I_PROFILE_H__
+#define __SIMPLERV32I_PROFILE_H__
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <ostream>
+#include "SimpleRV32I_mem.h"
+
+/*
+ * Guest profiler
+ *
+ * Counts are kept per translated block (one increment per block run by the
+ * block/JIT engines, the counter is found when the block is translated) and
+ * per PC for instructions run by step(), in a two level table like the code
+ * cache directory. A shadow call stack follows the calling convention:
+ * JAL/JALR with rd x1/x5 is a call, JALR x0 through x1/x5 a return. Stacks
+ * are kept as a tree of call paths, each path counting the instructions run
+ * in it, which gives the hot function report and the collapsed stacks for
+ * flamegraph.pl without storing anything per instruction.
+ * PCs are named from the ELF symbol table when there is one.
+ * */
+
+//control transfer at the end of an instruction/block
+#define RV32I_LINK_NONE     0
+#define RV32I_LINK_CALL     1
+#define RV32I_LINK_RETURN   2
+
+inline uint8_t rv32i_link_kind(bool jalr, uint8_t rd, uint8_t rs1) {
+    if((rd == 1) || (rd == 5)) return RV32I_LINK_CALL;
+    if(jalr && (rd == 0) && ((rs1 == 1) || (rs1 == 5))) return RV32I_LINK_RETURN;
+    return RV32I_LINK_NONE;
+}
+
+#define RV32I_PROFILE_TOP   20      //entries in each section of the report
+
+typedef struct {
+    uint32_t    pc;
+    uint32_t    n;          //instructions
+    uint64_t    count;      //full runs
+} rv32i_profile_block;
+
+//a call path: the function called from the parent path
+typedef struct {
+    uint32_t    parent;
+    uint32_t    func;       //entry point
+    uint64_t    self;       //instructions run in this path
+} rv32i_profile_node;
+
+typedef struct {
+    uint32_t    node;       //caller's path
+    uint32_t    ret;        //return address
+} rv32i_profile_frame;
+
+typedef struct {
+    uint32_t    addr;
+    uint32_t    size;
+    std::string name;
+} rv32i_symbol;
+
+class RV32I_PROFILER {
+    private:
+        std::deque<rv32i_profile_block> blocks;
+        std::unordered_map<uint64_t, uint32_t> block_index;     //pc << 32 | n
+        uint64_t    **pc_dir[RV32I_DIR_SIZE];                   //per PC counts of step()ed instructions, by page
+        std::vector<rv32i_profile_node> nodes;
+        std::unordered_map<uint64_t, uint32_t> node_index;      //parent << 32 | func
+        std::vector<rv32i_profile_frame> stack;
+        std::vector<rv32i_symbol> symbols;
+        uint32_t    cur;            //current call path
+        uint8_t     pending;        //RV32I_LINK_* of the last instruction/block
+        uint32_t    pending_ret;    //its return address, for calls
+
+        uint64_t *newPcCounter(uint32_t pc);
+        void transfer(uint32_t pc);
+        std::string symbolize(uint32_t pc, bool offset);
+        void pcCounts(std::map<uint32_t, uint64_t> *counts);
+
+    public:
+        RV32I_PROFILER();
+        ~RV32I_PROFILER();
+        void start(uint32_t pc);
+        bool loadSymbols(std::string file);
+        uint64_t *blockCounter(uint32_t pc, uint32_t n);
+        void report(std::ostream &out);
+        void flamegraph(std::ostream &out);
+
+        /*
+         * a block of n instructions at pc about to run (or, for native code,
+         * just run) in full, ending with a link control transfer
+         * */
+        inline void block(uint64_t *counter, uint32_t pc, uint32_t n, uint8_t link) {
+            if(pending) transfer(pc);
+            (*counter)++;
+            nodes[cur].self += n;
+            pending = link;
+            pending_ret = pc + 4*n;
+        }
+
+        inline uint64_t *pcCounter(uint32_t pc) {
+            uint64_t **table = pc_dir[pc >> (RV32I_PAGE_BITS + RV32I_DIR_BITS)];
+            uint64_t *page = table ? table[(pc >> RV32I_PAGE_BITS) & (RV32I_DIR_SIZE - 1)] : NULL;
+            return page ? &page[(pc & RV32I_PAGE_MASK) >> 2] : newPcCounter(pc);
+        }
+
+        //n instructions from pc, part of a block
+        inline void run(uint32_t pc, uint32_t n) {
+            if(pending) transfer(pc);
+            for(uint32_t i=0; i<n; i++) {
+                (*pcCounter(pc + 4*i))++;
+            }
+            nodes[cur].self += n;
+        }
+
+        //the block last passed to block() stopped (trapped) after done of its n instructions
+        inline void partial(uint64_t *counter, uint32_t pc, uint32_t done, uint32_t n) {
+            (*counter)--;
+            nodes[cur].self -= n;
+            pending = RV32I_LINK_NONE;
+            run(pc, done);
+        }
+
+        //one instruction run by step()
+        inline void step(uint32_t pc, uint8_t link) {
+            run(pc, 1);
+            pending = link;
+            pending_ret = pc + 4;
+        }
+};
+
+#endif
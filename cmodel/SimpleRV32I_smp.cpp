@@ -0,0 +1,192 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "SimpleRV32I_smp.h"
+#include "SimpleRV32I_utils.h"
+
+
+//value an AMO writes back, old being the word in memory and src rs2
+static inline uint32_t amoResult(rv32i_operation op, uint32_t old, uint32_t src) {
+    switch(op) {
+        case AMOMIN_W:  return ((int32_t)old < (int32_t)src) ? old : src;
+        case AMOMAX_W:  return ((int32_t)old > (int32_t)src) ? old : src;
+        case AMOMINU_W: return (old < src) ? old : src;
+        default:        return (old > src) ? old : src;   //AMOMAXU_W
+    }
+}
+
+
+/*
+ * host address of the aligned word at addr for an LR (write false) or an
+ * SC/AMO, through the TLBs when both directions hit
+ * the slow path traps on unmapped/inaccessible pages, stops at watchpoints
+ * and flushes the code caches when the word is on a code page
+ * returns NULL if the access did not happen
+ * */
+uint32_t *SimpleRV32I::amoAccess(uint32_t addr, bool write) {
+    uint32_t index = (addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1);
+    uint32_t tag = addr & ~RV32I_PAGE_MASK;
+    if((tlb_rd[index].tag == tag) && (!write || (tlb_wr[index].tag == tag))) {
+        return (uint32_t*)((write ? tlb_wr[index].addend : tlb_rd[index].addend) + addr);
+    }
+    uint8_t *host = dmem->access(addr, write ? RV32I_PERM_RW : RV32I_PERM_R);
+    if(host == NULL) {
+        trap(write ? RV32I_CAUSE_STORE_FAULT : RV32I_CAUSE_LOAD_FAULT, addr);
+        return NULL;
+    }
+    bool watch = watched(addr, 4);
+    if(watch && hitWatchpoint(addr, 4, write ? RV32I_WATCH_ACCESS : RV32I_WATCH_READ)) return NULL;
+    uint8_t flags = dmem->getFlags(addr);
+    bool code = write && (flags & RV32I_PAGE_CODE);
+    if(write) markDirty(addr);
+    if(code) dmem->codeWrite(addr);
+    if(watch || code) {
+        tlb_rd[index].tag = RV32I_TLB_INVALID;
+    } else {
+        //a write access has copied a page shared with a fork, both directions can use it
+        tlb_rd[index].tag = tag;
+        tlb_rd[index].addend = (uintptr_t)host - tag;
+        if(write && !(flags & RV32I_PAGE_RESERVED)) tlb_wr[index] = tlb_rd[index];
+    }
+    return (uint32_t*)(host + (addr & RV32I_PAGE_MASK));
+}
+
+
+/*
+ * LR.W/SC.W and the AMOs, as sequentially consistent host atomics whatever
+ * their aq/rl bits
+ * LR reserves the word: the generation of its reservation set and the value
+ * read, SC stores if neither changed since (no SC/AMO/store to the set, the
+ * word still holds the value) and drops the reservation either way
+ * while concurrent, LR also takes the page out of the write TLBs, so that
+ * plain stores to it bump the generation (RV32I_MEM::reserve())
+ * returns true if memory was written: not for LR, a failed SC or a trap
+ * */
+bool SimpleRV32I::execAmo(const rv32i_decoded &inst) {
+    uint32_t addr = regs[inst.rs1];
+    uint32_t src = regs[inst.rs2];
+    uint32_t old;
+    bool write = inst.op != LR_W;
+    if(addr & 3) {
+        trap(write ? RV32I_CAUSE_STORE_MISALIGNED : RV32I_CAUSE_LOAD_MISALIGNED, addr);
+        return false;
+    }
+    if((inst.op == SC_W) && (resv_addr != addr)) {
+        resv_addr = RV32I_RESV_NONE;
+        regs[inst.rd] = 1;
+        PC = PC+4;
+        return false;
+    }
+    uint32_t *p = amoAccess(addr, write);
+    if(p == NULL) return false;
+    std::atomic<uint32_t> *set = dmem->resvSet(addr);
+    switch(inst.op) {
+        case LR_W:      dmem->reserve(addr);
+                        tlb_wr[(addr >> RV32I_PAGE_BITS) & (RV32I_TLB_SIZE - 1)].tag = RV32I_TLB_INVALID;
+                        resv_gen = set->load();
+                        old = __atomic_load_n(p, __ATOMIC_SEQ_CST);
+                        resv_addr = addr;
+                        resv_value = old;
+                        break;
+        case SC_W:      {
+                            uint32_t gen = resv_gen;
+                            uint32_t expect = resv_value;
+                            bool ok = set->compare_exchange_strong(gen, gen + 1) &&
+                                      __atomic_compare_exchange_n(p, &expect, src, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+                            old = ok ? 0 : 1;
+                            resv_addr = RV32I_RESV_NONE;
+                        }
+                        break;
+        case AMOSWAP_W: old = __atomic_exchange_n(p, src, __ATOMIC_SEQ_CST); break;
+        case AMOADD_W:  old = __atomic_fetch_add(p, src, __ATOMIC_SEQ_CST); break;
+        case AMOXOR_W:  old = __atomic_fetch_xor(p, src, __ATOMIC_SEQ_CST); break;
+        case AMOAND_W:  old = __atomic_fetch_and(p, src, __ATOMIC_SEQ_CST); break;
+        case AMOOR_W:   old = __atomic_fetch_or(p, src, __ATOMIC_SEQ_CST); break;
+        default:        old = __atomic_load_n(p, __ATOMIC_SEQ_CST);   //AMOMIN_W..AMOMAXU_W
+                        while(!__atomic_compare_exchange_n(p, &old, amoResult(inst.op, old, src), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+                        break;
+    }
+    if((inst.op != LR_W) && (inst.op != SC_W)) set->fetch_add(1);  //breaks the reservations on the set
+    regs[inst.rd] = old;
+    PC = PC+4;
+    return write && ((inst.op != SC_W) || (old == 0));
+}
+
+
+/*
+ * adds harts 1..n-1 to primary, hart 0, and makes their memory safe to share
+ * between threads
+ * */
+RV32I_SMP::RV32I_SMP(SimpleRV32I *primary, uint32_t n) {
+    quantum = 0;
+    harts.push_back(primary);
+    for(uint32_t h=1; h<n; h++) {
+        harts.push_back(new SimpleRV32I(primary, h));
+    }
+    primary->imem->setConcurrent(true);
+    primary->dmem->setConcurrent(true);
+    debug_printf(DEBUG_LOW,"RV32I_SMP::RV32I_SMP> %u harts %s:%d\n",n,__FILE__, __LINE__);
+}
+
+
+RV32I_SMP::~RV32I_SMP() {
+    for(size_t h=1; h<harts.size(); h++) {
+        delete harts[h];
+    }
+    harts[0]->imem->setConcurrent(false);
+    harts[0]->dmem->setConcurrent(false);
+}
+
+
+uint64_t RV32I_SMP::retired() {
+    uint64_t n = 0;
+    for(size_t h=0; h<harts.size(); h++) {
+        n += harts[h]->instret;
+    }
+    return n;
+}
+
+
+/*
+ * runs the harts until hart 0 stops, each for at most maxInstructions
+ * instructions, free running or a quantum at a time (see setQuantum())
+ * returns the instructions retired by all of them
+ * */
+uint64_t RV32I_SMP::run(uint64_t maxInstructions) {
+    uint64_t start = retired();
+    uint32_t n = harts.size();
+    std::vector<uint64_t> done(n, 0);
+
+    if(quantum) {
+        while(!harts[0]->status && (done[0] < maxInstructions)) {
+            for(uint32_t h=0; h<n; h++) {
+                SimpleRV32I *cpu = harts[h];
+                if(cpu->status || (done[h] >= maxInstructions)) continue;
+                uint64_t before = cpu->instret;
+                cpu->run(std::min(quantum, maxInstructions - done[h]));
+                done[h] += cpu->instret - before;
+                cpu->resv_addr = RV32I_RESV_NONE;   //the other harts run next
+            }
+        }
+    } else {
+        std::atomic<bool> stopping(false);
+        std::vector<std::thread> threads;
+        for(uint32_t h=0; h<n; h++) {
+            threads.push_back(std::thread([this, h, maxInstructions, &done, &stopping]() {
+                SimpleRV32I *cpu = harts[h];
+                while(!stopping.load(std::memory_order_relaxed) && !cpu->status && (done[h] < maxInstructions)) {
+                    uint64_t before = cpu->instret;
+                    cpu->run(std::min((uint64_t)RV32I_SMP_SLICE, maxInstructions - done[h]));
+                    done[h] += cpu->instret - before;
+                }
+                if(h == 0) stopping = true;
+            }));
+        }
+        for(uint32_t h=0; h<n; h++) {
+            threads[h].join();
+        }
+    }
+    debug_printf(DEBUG_LOW,"RV32I_SMP::run> %lu instructions %s:%d\n",retired() - start,__FILE__, __LINE__);
+    return retired() - start;
+}
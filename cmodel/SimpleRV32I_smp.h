@@ -0,0 +1,50 @@
+#ifndef __SIMPLERV32I_SMP_H__
+#define __SIMPLERV32I_SMP_H__
+#include <stdint.h>
+#include <vector>
+#include "SimpleRV32I.h"
+
+/*
+ * SMP system: harts sharing the memory of a primary model
+ *
+ * Hart 0 is the primary model, harts 1..n-1 are created from it with their
+ * own registers, PC, CSRs (mhartid is the hart number) and code caches, on
+ * the primary's engine, starting at its PC. The guest tells them apart with
+ * mhartid.
+ * run() runs them either free running, each on its own host thread, or, with
+ * a quantum, deterministically: round robin in the calling thread, quantum
+ * instructions per hart per turn, hart 0 first. A hart's LR reservation does
+ * not survive the end of its turn, so a deterministic run is reproducible
+ * and an SC fails whenever another hart ran since its LR.
+ * Either way the run ends when hart 0 stops (halt, trap, instruction limit),
+ * the other harts are left where they are.
+ * Free running, LR/SC and the AMOs are host atomics on guest memory, the
+ * harts see each other's plain loads/stores as the host orders them (x86:
+ * TSO, stronger than RVWMO). An SC fails if another SC/AMO/store to the same
+ * reservation set got in since the LR, or if the word no longer holds the
+ * value loaded. Stores see a reservation through the page it is on, which
+ * the first LR to it takes out of the write TLBs: like writes to code pages,
+ * the other harts notice it at their next block, so only a store through a
+ * write TLB entry filled before that first LR can slip by unnoticed.
+ * */
+
+#define RV32I_SMP_MAX_HARTS 64
+#define RV32I_SMP_SLICE     65536   //instructions a free running hart runs between checks of the stop flag
+
+class RV32I_SMP {
+    private:
+        std::vector<SimpleRV32I*> harts;
+        uint64_t quantum;   //0: free running
+
+        uint64_t retired();
+
+    public:
+        RV32I_SMP(SimpleRV32I *primary, uint32_t n);
+        ~RV32I_SMP();
+        SimpleRV32I *hart(uint32_t h) { return harts[h]; }
+        uint32_t size() { return harts.size(); }
+        void setQuantum(uint64_t quantum) { this->quantum = quantum; }
+        uint64_t run(uint64_t maxInstructions=UINT64_MAX);
+};
+
+#endif
@@ -0,0 +1,382 @@
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_syscall.h"
+#include "SimpleRV32I_utils.h"
+
+//errno values seen by the guest (newlib numbering)
+#define RV32I_ENOENT        2
+#define RV32I_EIO           5
+#define RV32I_EBADF         9
+#define RV32I_EACCES        13
+#define RV32I_EFAULT        14
+#define RV32I_EINVAL        22
+#define RV32I_EMFILE        24
+#define RV32I_ENOSYS        88
+
+//open() flags (newlib sys/_default_fcntl.h), the access mode is the same as the host's
+#define RV32I_O_ACCMODE     0x0003
+#define RV32I_O_APPEND      0x0008
+#define RV32I_O_CREAT       0x0200
+#define RV32I_O_TRUNC       0x0400
+#define RV32I_O_EXCL        0x0800
+
+#define RV32I_AT_FDCWD      ((uint32_t)-100)
+#define RV32I_PATH_MAX      4096
+#define RV32I_IO_MAX        (1024*1024)     //bytes moved by one read()/write(), a short count for more
+#define RV32I_STAT_SIZE     128             //struct kernel_stat of libgloss
+
+
+RV32I_SYSCALLS::RV32I_SYSCALLS() {
+    sandbox_fd = -1;
+    for(int i=0; i<RV32I_SYSCALL_FDS; i++) {
+        fds[i] = (i < 3) ? i : -1;
+    }
+    brk_base = 0;
+    brk = 0;
+    brk_mapped = 0;
+    brk_limit = 0;
+    exited = false;
+    exit_code = 0;
+    calls = 0;
+}
+
+RV32I_SYSCALLS::~RV32I_SYSCALLS() {
+    finish();
+    for(int i=3; i<RV32I_SYSCALL_FDS; i++) {
+        if(fds[i] >= 0) close(fds[i]);
+    }
+    if(sandbox_fd >= 0) close(sandbox_fd);
+}
+
+
+/*
+ * lets open() reach the files below dir, false if it is not a directory
+ * */
+bool RV32I_SYSCALLS::setSandbox(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        std::cerr << "Unable to open directory: " << dir << std::endl;
+        return false;
+    }
+    if(sandbox_fd >= 0) close(sandbox_fd);
+    sandbox_fd = fd;
+    return true;
+}
+
+
+/*
+ * maps the stack and lays out argc, argv (args), an empty envp and auxv on
+ * it the way crt0 expects them at sp
+ * */
+bool RV32I_SYSCALLS::setupStack(SimpleRV32I *cpu, const std::vector<std::string> &args) {
+    uint32_t sp = RV32I_STACK_TOP;
+    std::vector<uint32_t> words;
+
+    if(!cpu->mapMemory(RV32I_STACK_TOP - RV32I_STACK_SIZE, RV32I_STACK_SIZE, RV32I_PERM_RW)) return false;
+    words.push_back(args.size());
+    for(size_t i=0; i<args.size(); i++) {
+        sp -= args[i].size() + 1;
+        if(!cpu->writeMemory(sp, args[i].c_str(), args[i].size() + 1)) return false;
+        words.push_back(sp);
+    }
+    words.push_back(0);     //argv[argc]
+    words.push_back(0);     //envp[0]
+    words.push_back(0);     //AT_NULL
+    words.push_back(0);
+    sp = (sp - 4*words.size()) & ~0xf;
+    if(!cpu->writeMemory(sp, &words[0], 4*words.size())) return false;
+    cpu->setReg(2, sp);
+    debug_printf(DEBUG_LOW,"RV32I_SYSCALLS::setupStack> sp(%08x) argc(%d) %s:%d\n",sp,(int)args.size(),__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * handles the ECALL at the model's PC, returns false if the program exited
+ * (the model then halts), true if it goes on with a0 holding the result
+ * */
+bool RV32I_SYSCALLS::call(SimpleRV32I *cpu) {
+    uint32_t a0 = cpu->getReg(10);
+    uint32_t a1 = cpu->getReg(11);
+    uint32_t a2 = cpu->getReg(12);
+    uint32_t a3 = cpu->getReg(13);
+    uint32_t n = cpu->getReg(17);
+    int32_t ret;
+
+    calls++;
+    debug_printf(DEBUG_MEDIUM,"RV32I_SYSCALLS::call> %d(%08x, %08x, %08x) %s:%d\n",n,a0,a1,a2,__FILE__, __LINE__);
+    switch(n) {
+        case RV32I_SYS_EXIT:
+        case RV32I_SYS_EXIT_GROUP:  finish();
+                                    exited = true;
+                                    exit_code = (int32_t)a0;
+                                    return false;
+        case RV32I_SYS_OPENAT:      ret = (a0 == RV32I_AT_FDCWD) ? sysOpen(cpu, a1, a2, a3) : -RV32I_EBADF; break;
+        case RV32I_SYS_OPEN:        ret = sysOpen(cpu, a0, a1, a2); break;
+        case RV32I_SYS_CLOSE:       ret = sysClose(a0); break;
+        case RV32I_SYS_LSEEK:       ret = sysLseek(a0, a1, a2); break;
+        case RV32I_SYS_READ:        ret = sysRead(cpu, a0, a1, a2); break;
+        case RV32I_SYS_WRITE:       ret = sysWrite(cpu, a0, a1, a2); break;
+        case RV32I_SYS_FSTAT:       ret = sysFstat(cpu, a0, a1); break;
+        case RV32I_SYS_GETTIMEOFDAY: ret = sysGettimeofday(cpu, a0); break;
+        case RV32I_SYS_BRK:         ret = sysBrk(cpu, a0); break;
+        default:                    debug_printf(DEBUG_LOW,"RV32I_SYSCALLS::call> unsupported syscall %d %s:%d\n",n,__FILE__, __LINE__);
+                                    ret = -RV32I_ENOSYS;
+                                    break;
+    }
+    cpu->setReg(10, ret);
+    return true;
+}
+
+
+/*
+ * writes out everything still buffered
+ * */
+void RV32I_SYSCALLS::finish() {
+    for(int i=0; i<RV32I_SYSCALL_FDS; i++) {
+        flush(i);
+    }
+}
+
+bool RV32I_SYSCALLS::flush(int fd) {
+    std::string &buf = out[fd];
+    size_t done = 0;
+    while(done < buf.size()) {
+        ssize_t n = write(fds[fd], buf.data() + done, buf.size() - done);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            buf.clear();
+            return false;
+        }
+        done += n;
+    }
+    buf.clear();
+    return true;
+}
+
+
+/*
+ * -errno of the last failed host call, as the guest numbers it
+ * (the classic values up to ERANGE are the same in newlib)
+ * */
+int32_t RV32I_SYSCALLS::hostError() {
+    return -(((errno > 0) && (errno <= ERANGE)) ? errno : RV32I_EIO);
+}
+
+
+/*
+ * opens name below the sandbox directory, through no symbolic link at all:
+ * openat2() confines the lookup, on kernels without it the path is walked
+ * one directory at a time
+ * */
+int RV32I_SYSCALLS::openBeneath(const std::string &name, int flags, mode_t mode) {
+#ifdef SYS_openat2
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = flags;
+    how.mode = (flags & O_CREAT) ? mode : 0;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+    int host = syscall(SYS_openat2, sandbox_fd, name.c_str(), &how, sizeof(how));
+    if((host >= 0) || (errno != ENOSYS)) return host;
+#endif
+    int dir = sandbox_fd;
+    size_t start = 0, end;
+    while((end = name.find('/', start)) != std::string::npos) {
+        std::string comp = name.substr(start, end - start);
+        start = end + 1;
+        if(comp.empty() || (comp == ".")) continue;
+        int next = openat(dir, comp.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if(next < 0) {
+            struct stat st;
+            int err = errno;
+            if((fstatat(dir, comp.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISLNK(st.st_mode)) err = ELOOP; //not ENOTDIR
+            if(dir != sandbox_fd) close(dir);
+            errno = err;
+            return -1;
+        }
+        if(dir != sandbox_fd) close(dir);
+        dir = next;
+    }
+    int fd = openat(dir, name.c_str() + start, flags | O_NOFOLLOW, mode);
+    if(dir != sandbox_fd) {
+        int err = errno;
+        close(dir);
+        errno = err;
+    }
+    return fd;
+}
+
+
+/*
+ * opens a file below the sandbox directory: relative paths only, without
+ * .. components, and through no symbolic link (EACCES)
+ * */
+int32_t RV32I_SYSCALLS::sysOpen(SimpleRV32I *cpu, uint32_t path, uint32_t flags, uint32_t mode) {
+    std::string name;
+    int guest, host;
+
+    for(;; path++) {
+        char c;
+        if(!cpu->readMemory(path, &c, 1)) return -RV32I_EFAULT;
+        if(!c) break;
+        if(name.size() == RV32I_PATH_MAX) return -RV32I_EINVAL;
+        name += c;
+    }
+    if(name.empty()) return -RV32I_ENOENT;
+    if(sandbox_fd < 0) return -RV32I_EACCES;
+    if((name[0] == '/') || (("/" + name + "/").find("/../") != std::string::npos)) return -RV32I_EACCES;
+    for(guest = 3; (guest < RV32I_SYSCALL_FDS) && (fds[guest] >= 0); guest++);
+    if(guest == RV32I_SYSCALL_FDS) return -RV32I_EMFILE;
+
+    int hostFlags = (flags & RV32I_O_ACCMODE) | O_CLOEXEC;
+    if(flags & RV32I_O_APPEND) hostFlags |= O_APPEND;
+    if(flags & RV32I_O_CREAT) hostFlags |= O_CREAT;
+    if(flags & RV32I_O_TRUNC) hostFlags |= O_TRUNC;
+    if(flags & RV32I_O_EXCL) hostFlags |= O_EXCL;
+    host = openBeneath(name, hostFlags, mode & 0777);
+    if((host < 0) && ((errno == ELOOP) || (errno == EXDEV))) return -RV32I_EACCES; //a symbolic link on the way
+    if(host < 0) return hostError();
+    fds[guest] = host;
+    debug_printf(DEBUG_LOW,"RV32I_SYSCALLS::sysOpen> %s flags(%x) => fd %d %s:%d\n",name.c_str(),flags,guest,__FILE__, __LINE__);
+    return guest;
+}
+
+int32_t RV32I_SYSCALLS::sysClose(uint32_t fd) {
+    if((fd >= RV32I_SYSCALL_FDS) || (fds[fd] < 0)) return -RV32I_EBADF;
+    bool ok = flush(fd);
+    if(fd >= 3) close(fds[fd]);
+    fds[fd] = -1;
+    return ok ? 0 : -RV32I_EIO;
+}
+
+int32_t RV32I_SYSCALLS::sysRead(SimpleRV32I *cpu, uint32_t fd, uint32_t buf, uint32_t len) {
+    if((fd >= RV32I_SYSCALL_FDS) || (fds[fd] < 0)) return -RV32I_EBADF;
+    flush(fd);
+    if(fd == 0) flush(1); //prompts go out before the program waits for input
+    std::vector<uint8_t> data((len < RV32I_IO_MAX) ? len : RV32I_IO_MAX);
+    if(data.empty()) return 0;
+    ssize_t n = read(fds[fd], &data[0], data.size());
+    if(n < 0) return hostError();
+    if(!cpu->writeMemory(buf, &data[0], n)) return -RV32I_EFAULT;
+    return n;
+}
+
+int32_t RV32I_SYSCALLS::sysWrite(SimpleRV32I *cpu, uint32_t fd, uint32_t buf, uint32_t len) {
+    if((fd >= RV32I_SYSCALL_FDS) || (fds[fd] < 0)) return -RV32I_EBADF;
+    std::string &pending = out[fd];
+    size_t old = pending.size();
+    if(len > RV32I_IO_MAX) len = RV32I_IO_MAX;
+    pending.resize(old + len);
+    if(len && !cpu->readMemory(buf, &pending[old], len)) {
+        pending.resize(old);
+        return -RV32I_EFAULT;
+    }
+    if(fd == 2) {
+        flush(1);
+        if(!flush(2)) return -RV32I_EIO;
+    } else if((pending.size() >= RV32I_SYSCALL_BUFFER) && !flush(fd)) {
+        return -RV32I_EIO;
+    }
+    return len;
+}
+
+int32_t RV32I_SYSCALLS::sysLseek(uint32_t fd, int32_t offset, uint32_t whence) {
+    if((fd >= RV32I_SYSCALL_FDS) || (fds[fd] < 0)) return -RV32I_EBADF;
+    if(whence > SEEK_END) return -RV32I_EINVAL;
+    flush(fd);
+    off_t pos = lseek(fds[fd], offset, whence);
+    if(pos < 0) return hostError();
+    if(pos > INT32_MAX) return -RV32I_EINVAL;
+    return pos;
+}
+
+
+/*
+ * fills the guest's struct kernel_stat (libgloss layout: 64bit dev/ino,
+ * 32bit mode/nlink/uid/gid, 64bit rdev, pad, 64bit size, 32bit blksize,
+ * pad, 64bit blocks, then times, left at 0)
+ * */
+int32_t RV32I_SYSCALLS::sysFstat(SimpleRV32I *cpu, uint32_t fd, uint32_t buf) {
+    struct stat st;
+    uint8_t ks[RV32I_STAT_SIZE];
+
+    if((fd >= RV32I_SYSCALL_FDS) || (fds[fd] < 0)) return -RV32I_EBADF;
+    flush(fd);
+    if(fstat(fds[fd], &st) < 0) return hostError();
+    uint64_t dev = st.st_dev, ino = st.st_ino, rdev = st.st_rdev;
+    int64_t size = st.st_size, blocks = st.st_blocks;
+    uint32_t mode = st.st_mode, nlink = st.st_nlink, uid = st.st_uid, gid = st.st_gid;
+    int32_t blksize = st.st_blksize;
+    memset(ks, 0, sizeof(ks));
+    memcpy(ks + 0, &dev, 8);
+    memcpy(ks + 8, &ino, 8);
+    memcpy(ks + 16, &mode, 4);
+    memcpy(ks + 20, &nlink, 4);
+    memcpy(ks + 24, &uid, 4);
+    memcpy(ks + 28, &gid, 4);
+    memcpy(ks + 32, &rdev, 8);
+    memcpy(ks + 48, &size, 8);
+    memcpy(ks + 56, &blksize, 4);
+    memcpy(ks + 64, &blocks, 8);
+    return cpu->writeMemory(buf, ks, sizeof(ks)) ? 0 : -RV32I_EFAULT;
+}
+
+
+/*
+ * host time of day, into a struct timeval with a 64bit time_t (newlib)
+ * */
+int32_t RV32I_SYSCALLS::sysGettimeofday(SimpleRV32I *cpu, uint32_t tv) {
+    struct timeval now;
+    uint8_t gtv[16];
+
+    gettimeofday(&now, NULL);
+    int64_t sec = now.tv_sec;
+    int32_t usec = now.tv_usec;
+    memset(gtv, 0, sizeof(gtv));
+    memcpy(gtv, &sec, 8);
+    memcpy(gtv + 8, &usec, 4);
+    return cpu->writeMemory(tv, gtv, sizeof(gtv)) ? 0 : -RV32I_EFAULT;
+}
+
+
+/*
+ * moves the program break to addr, returns the new break (the current one
+ * if addr is 0 or the heap cannot go there), heap pages are mapped as it grows
+ * */
+uint32_t RV32I_SYSCALLS::sysBrk(SimpleRV32I *cpu, uint32_t addr) {
+    if(!brk_base) {
+        uint32_t stack = RV32I_STACK_TOP - RV32I_STACK_SIZE;
+        brk_base = (cpu->getImageEnd() + RV32I_PAGE_MASK) & ~RV32I_PAGE_MASK;
+        brk = brk_base;
+        brk_mapped = brk_base;
+        brk_limit = (brk_base <= stack) ? stack : ~(uint32_t)RV32I_PAGE_MASK;
+    }
+    if((addr < brk_base) || (addr > brk_limit)) return brk;
+    if(addr > brk_mapped) {
+        uint32_t end = (addr + RV32I_PAGE_MASK) & ~RV32I_PAGE_MASK;
+        if(!cpu->mapMemory(brk_mapped, end - brk_mapped, RV32I_PERM_RW)) return brk;
+        brk_mapped = end;
+    }
+    brk = addr;
+    debug_printf(DEBUG_MEDIUM,"RV32I_SYSCALLS::sysBrk> %08x %s:%d\n",brk,__FILE__, __LINE__);
+    return brk;
+}
+
+
+/*
+ * ECALLs go to syscalls instead of halting the model (NULL: they halt)
+ * */
+void SimpleRV32I::attachSyscalls(RV32I_SYSCALLS *syscalls) {
+    flushBlocks(); //translated blocks end at an ECALL, they have to leave it to step()
+    this->syscalls = syscalls;
+}
@@ -0,0 +1,86 @@
+#ifndef __SIMPLERV32I_SYSCALL_H__
+#define __SIMPLERV32I_SYSCALL_H__
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Newlib syscall emulation
+ *
+ * With syscalls attached (SimpleRV32I::attachSyscalls()) ECALL no longer
+ * halts the model: the call number in a7 and its arguments in a0-a5 are
+ * handled on the host the way riscv-pk does for newlib/libgloss programs,
+ * the result (or -errno, newlib numbering) goes back in a0 and the program
+ * goes on. exit ends the run (RV32I_STATUS_HALT) with an exit code. EBREAK
+ * still halts.
+ *
+ * Files: guest fds 0-2 are the simulator's stdin/stdout/stderr, open()
+ * only reaches relative paths inside the sandbox directory, through no
+ * symbolic link (no sandbox: open fails with EACCES). Output is buffered
+ * per fd in large chunks and written when a buffer fills, before any
+ * other operation on the fd, and at the end of the run; stderr goes out at
+ * once (after stdout).
+ * Memory: brk grows the heap from the end of the loaded image, pages are
+ * mapped as it grows. setupStack() maps a stack and puts argc/argv on it,
+ * for crt0 code that expects them there.
+ * */
+
+//RISC-V syscall numbers (Linux generic table, as used by newlib/libgloss)
+#define RV32I_SYS_OPENAT        56
+#define RV32I_SYS_CLOSE         57
+#define RV32I_SYS_LSEEK         62
+#define RV32I_SYS_READ          63
+#define RV32I_SYS_WRITE         64
+#define RV32I_SYS_FSTAT         80
+#define RV32I_SYS_EXIT          93
+#define RV32I_SYS_EXIT_GROUP    94
+#define RV32I_SYS_GETTIMEOFDAY  169
+#define RV32I_SYS_BRK           214
+#define RV32I_SYS_OPEN          1024
+
+#define RV32I_SYSCALL_BUFFER    (64*1024)   //output buffered per fd before it is written
+#define RV32I_SYSCALL_FDS       64          //guest file descriptors
+
+#define RV32I_STACK_TOP         0x7ffff000  //setupStack(): stack [top - size, top)
+#define RV32I_STACK_SIZE        (1024*1024)
+
+class SimpleRV32I;
+
+class RV32I_SYSCALLS {
+    private:
+        int         sandbox_fd;     //directory open() resolves paths in, -1: none
+        int         fds[RV32I_SYSCALL_FDS];     //host fd of each guest fd, -1 if closed
+        std::string out[RV32I_SYSCALL_FDS];     //output not written yet
+        uint32_t    brk_base;       //start of the heap, 0 until the first brk
+        uint32_t    brk;            //current program break
+        uint32_t    brk_mapped;     //heap pages mapped so far end here
+        uint32_t    brk_limit;      //the heap stops below the stack
+        bool        exited;
+        int         exit_code;
+
+        bool flush(int fd);
+        int32_t hostError();
+        int openBeneath(const std::string &name, int flags, mode_t mode);
+        int32_t sysOpen(SimpleRV32I *cpu, uint32_t path, uint32_t flags, uint32_t mode);
+        int32_t sysClose(uint32_t fd);
+        int32_t sysRead(SimpleRV32I *cpu, uint32_t fd, uint32_t buf, uint32_t len);
+        int32_t sysWrite(SimpleRV32I *cpu, uint32_t fd, uint32_t buf, uint32_t len);
+        int32_t sysLseek(uint32_t fd, int32_t offset, uint32_t whence);
+        int32_t sysFstat(SimpleRV32I *cpu, uint32_t fd, uint32_t buf);
+        int32_t sysGettimeofday(SimpleRV32I *cpu, uint32_t tv);
+        uint32_t sysBrk(SimpleRV32I *cpu, uint32_t addr);
+
+    public:
+        uint64_t    calls;
+
+        RV32I_SYSCALLS();
+        ~RV32I_SYSCALLS();
+        bool setSandbox(const char *dir);
+        bool setupStack(SimpleRV32I *cpu, const std::vector<std::string> &args);
+        bool call(SimpleRV32I *cpu);
+        void finish();
+        bool hasExited() { return exited; }
+        int getExitCode() { return exit_code; }
+};
+
+#endif
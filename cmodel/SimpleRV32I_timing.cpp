@@ -0,0 +1,309 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include "SimpleRV32I_timing.h"
+#include "SimpleRV32I_utils.h"
+
+#define RV32I_CONFIDENCE_Z  1.96    //95% confidence interval of the CPI estimate
+
+//source registers an operation reads, bit 0: rs1, bit 1: rs2
+static uint8_t sources(rv32i_operation op) {
+    switch(op) {
+        case LUI:
+        case AUIPC:
+        case JAL:
+        case FENCE:
+        case FENCE_I:
+        case ECALL:
+        case EBREAK:
+        case CSRRWI:
+        case CSRRSI:
+        case CSRRCI:    return 0;
+        case BEQ:
+        case BNE:
+        case BLT:
+        case BGE:
+        case BLTU:
+        case BGEU:
+        case SB:
+        case SH:
+        case SW:
+        case ADD:
+        case SUB:
+        case SLL:
+        case SLT:
+        case SLTU:
+        case XOR:
+        case SRL:
+        case SRA:
+        case OR:
+        case AND:
+        case MUL:
+        case MULH:
+        case MULHSU:
+        case MULHU:
+        case DIV:
+        case DIVU:
+        case REM:
+        case REMU:
+        case SC_W:
+        case AMOSWAP_W:
+        case AMOADD_W:
+        case AMOXOR_W:
+        case AMOAND_W:
+        case AMOOR_W:
+        case AMOMIN_W:
+        case AMOMAX_W:
+        case AMOMINU_W:
+        case AMOMAXU_W: return 3;
+        default:        return 1;
+    }
+}
+
+
+/*
+ * parses <penalty>=<cycles>[,...], penalties: load-use, branch, jump,
+ * l1i-miss, l1d-miss
+ * */
+bool parseTimingConfig(const char *arg, rv32i_timing_config *config) {
+    static const char * const names[STALL_CAUSES] = { "load-use", "branch", "jump", "l1i-miss", "l1d-miss" };
+    uint32_t *values[STALL_CAUSES] = { &config->load_use, &config->branch, &config->jump, &config->l1i_miss, &config->l1d_miss };
+    std::stringstream fields(arg);
+    std::string field;
+    while(std::getline(fields, field, ',')) {
+        size_t eq = field.find('=');
+        int c;
+        for(c=0; c<STALL_CAUSES; c++) {
+            if(field.substr(0, eq) == names[c]) break;
+        }
+        if((eq == std::string::npos) || (c == STALL_CAUSES)) return false;
+        *values[c] = strtoul(field.c_str() + eq + 1, NULL, 0);
+    }
+    return true;
+}
+
+
+/*
+ * parses <period>[:<window>[:<warmup>]], a window and its warm-up have to fit
+ * in the period (0: no sampling)
+ * */
+bool parseSampling(const char *arg, uint64_t *period, uint64_t *window, uint64_t *warmup) {
+    char *end;
+    *period = strtoull(arg, &end, 0);
+    if(*end == ':') *window = strtoull(end + 1, &end, 0);
+    if(*end == ':') *warmup = strtoull(end + 1, &end, 0);
+    if(*end) return false;
+    return !*period || (*window && (*window + *warmup <= *period));
+}
+
+
+RV32I_TIMING::RV32I_TIMING(const rv32i_timing_config &config, uint64_t period, uint64_t window, uint64_t warmup)
+    : icache(config.l1i), dcache(config.l1d) {
+    this->config = config;
+    this->period = period;
+    this->window = period ? window : UINT64_MAX;
+    this->warmup = period ? warmup : 0;
+    load_rd = 0;
+    instructions = 0;
+    detailed = 0;
+    timed = 0;
+    timed_cycles = 0;
+    for(int i=0; i<STALL_CAUSES; i++) {
+        stalls[i] = 0;
+    }
+}
+
+
+/*
+ * runs one instruction on the model and through the pipeline model,
+ * adding its stall cycles to stall
+ * returns its cycles, 0 if it did not retire (trap)
+ * */
+uint32_t RV32I_TIMING::step(SimpleRV32I *cpu, uint64_t *stall) {
+    uint32_t pc = cpu->PC;
+    cpu->syncMemory();
+    const rv32i_decoded *d = cpu->decodeAt(pc);
+    if(d == NULL) {
+        cpu->step();    //fetch fault
+        return 0;
+    }
+    rv32i_decoded inst = *d;
+    uint32_t addr = cpu->regs[inst.rs1] + inst.imm;
+    uint8_t reads = sources(inst.op);
+    cpu->step();
+    if(RV32I_STATUS_STOPPED(cpu->status)) return 0;
+
+    uint32_t cycles = 1;
+    uint32_t size = 0;
+    if(!icache.access(pc, 4)) {
+        stall[STALL_L1I] += config.l1i_miss;
+        cycles += config.l1i_miss;
+    }
+    if(load_rd && (((reads & 1) && (inst.rs1 == load_rd)) || ((reads & 2) && (inst.rs2 == load_rd)))) {
+        stall[STALL_LOAD_USE] += config.load_use;
+        cycles += config.load_use;
+    }
+    load_rd = 0;
+    switch(inst.op) {
+        case LB:
+        case LBU:
+        case SB:        size = 1; break;
+        case LH:
+        case LHU:
+        case SH:        size = 2; break;
+        case LW:
+        case SW:
+        case LR_W:
+        case SC_W:
+        case AMOSWAP_W:
+        case AMOADD_W:
+        case AMOXOR_W:
+        case AMOAND_W:
+        case AMOOR_W:
+        case AMOMIN_W:
+        case AMOMAX_W:
+        case AMOMINU_W:
+        case AMOMAXU_W: size = 4; break;
+        case BEQ:
+        case BNE:
+        case BLT:
+        case BGE:
+        case BLTU:
+        case BGEU:      if(cpu->PC != pc + 4) {
+                            stall[STALL_BRANCH] += config.branch;
+                            cycles += config.branch;
+                        }
+                        break;
+        case JAL:
+        case JALR:      stall[STALL_JUMP] += config.jump;
+                        cycles += config.jump;
+                        break;
+        default:        break;
+    }
+    if(size) {
+        if((inst.op == LB) || (inst.op == LBU) || (inst.op == LH) || (inst.op == LHU) || (inst.op == LW) || (inst.op >= LR_W)) load_rd = inst.rd;
+        if(!dcache.access(addr, size)) {
+            stall[STALL_L1D] += config.l1d_miss;
+            cycles += config.l1d_miss;
+        }
+    }
+    return cycles;
+}
+
+
+/*
+ * runs the program like SimpleRV32I::run(), on the model's engine between
+ * windows, until it completes or maxInstructions instructions have been
+ * retired
+ * a window cut short by the end of the program is not a sample (they are
+ * all the same length), unless every instruction is timed
+ * */
+int RV32I_TIMING::run(SimpleRV32I *cpu, uint64_t maxInstructions) {
+    uint64_t done = 0;
+    uint64_t scratch[STALL_CAUSES];
+    while(!cpu->status && (done < maxInstructions)) {
+        if(period) {
+            uint64_t start = cpu->instret;
+            cpu->run(std::min(period - window - warmup, maxInstructions - done));
+            done += cpu->instret - start;
+            icache.flush();
+            dcache.flush();
+            for(uint64_t i=0; (i < warmup) && !cpu->status && (done < maxInstructions); i++) {
+                if(step(cpu, scratch)) {
+                    done++;
+                    detailed++;
+                }
+            }
+        }
+        uint64_t cycles = 0;
+        uint64_t n = 0;
+        uint64_t stall[STALL_CAUSES] = { 0 };
+        while((n < window) && !cpu->status && (done < maxInstructions)) {
+            uint32_t c = step(cpu, stall);
+            if(c == 0) break;
+            cycles += c;
+            n++;
+            done++;
+        }
+        detailed += n;
+        if(n && ((n == window) || !period)) {
+            samples.push_back((double)cycles / n);
+            timed += n;
+            timed_cycles += cycles;
+            for(int i=0; i<STALL_CAUSES; i++) {
+                stalls[i] += stall[i];
+            }
+        }
+        debug_printf(DEBUG_MEDIUM,"RV32I_TIMING::run> window of %lu instructions, %lu cycles %s:%d\n",n,cycles,__FILE__, __LINE__);
+    }
+    instructions += done;
+    return cpu->status;
+}
+
+
+/*
+ * the CPI estimate (mean of the windows' CPI) and the half width of its
+ * confidence interval (0 if every instruction was timed)
+ * returns false if there is no sample yet
+ * */
+bool RV32I_TIMING::estimate(double *cpi, double *halfWidth) {
+    size_t n = samples.size();
+    if(n == 0) return false;
+    if(!period) {
+        *cpi = (double)timed_cycles / timed;
+        *halfWidth = 0;
+        return true;
+    }
+    double sum = 0;
+    double squares = 0;
+    for(size_t i=0; i<n; i++) {
+        sum += samples[i];
+    }
+    *cpi = sum / n;
+    for(size_t i=0; i<n; i++) {
+        squares += (samples[i] - *cpi) * (samples[i] - *cpi);
+    }
+    *halfWidth = (n > 1) ? RV32I_CONFIDENCE_Z * sqrt(squares / (n - 1)) / sqrt((double)n) : INFINITY;
+    return true;
+}
+
+
+void RV32I_TIMING::report(std::ostream &out) {
+    static const char * const names[STALL_CAUSES] = { "load-use", "branch", "jump", "L1I", "L1D" };
+    double cpi, half;
+    out << std::dec;
+    out << "timing: 5-stage in-order pipeline, stalls: load-use " << config.load_use << ", taken branch " << config.branch
+        << ", jump " << config.jump << ", L1I miss " << config.l1i_miss << ", L1D miss " << config.l1d_miss << std::endl;
+    out << "L1I " << icache.describe() << ", L1D " << dcache.describe() << std::endl;
+    if(period) {
+        out << "sampling: " << samples.size() << " windows of " << window << " instructions (warm-up " << warmup << ") every "
+            << period << ", " << detailed << " of " << instructions << " instructions in detail ("
+            << std::fixed << std::setprecision(2) << (instructions ? 100.0 * detailed / instructions : 0) << "%)" << std::endl;
+    } else {
+        out << "detailed: all " << instructions << " instructions timed" << std::endl;
+    }
+    if(!estimate(&cpi, &half)) {
+        out << "CPI: no complete window, the run is shorter than a sampling period" << std::endl;
+        return;
+    }
+    out << std::fixed << std::setprecision(4) << "CPI " << cpi;
+    if(period) {
+        out << " +- " << half << " (95% confidence, +-" << std::setprecision(2) << 100 * half / cpi << "%)";
+    }
+    out << ", estimated cycles " << std::setprecision(0) << cpi * instructions;
+    if(period) out << " +- " << half * instructions;
+    out << std::endl;
+    out << "stall cycles per instruction:" << std::setprecision(4);
+    for(int i=0; i<STALL_CAUSES; i++) {
+        out << (i ? ", " : " ") << names[i] << " " << (double)stalls[i] / timed;
+    }
+    out << std::endl;
+    if(period && (samples.size() > 1)) {
+        //windows needed for +-3% at 99.7% confidence: (3 V / 0.03)^2, V the coefficient of variation
+        double v = half / RV32I_CONFIDENCE_Z * sqrt((double)samples.size()) / cpi;
+        out << std::setprecision(3) << "coefficient of variation " << v << ", windows for +-3% at 99.7% confidence: "
+            << (uint64_t)ceil((3 * v / 0.03) * (3 * v / 0.03)) << std::endl;
+    }
+}
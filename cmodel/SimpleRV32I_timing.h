@@ -0,0 +1,87 @@
+#ifndef __SIMPLERV32I_TIMING_H__
+#define __SIMPLERV32I_TIMING_H__
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_cache.h"
+
+/*
+ * Sampled pipeline timing (SMARTS style)
+ *
+ * Estimates the CPI of a classic 5-stage in-order pipeline (IF ID EX MEM
+ * WB, full forwarding, branches predicted not taken and resolved in EX)
+ * without timing every instruction: the program runs on the model's own
+ * engine, and once every period instructions a window of them is stepped
+ * through the pipeline model, after a warm-up whose cycles are not counted
+ * (pipeline state and caches catch up with the fast forwarded code). Each
+ * window is a sample of the CPI, the estimate is their mean with a
+ * confidence interval from their spread.
+ * The fast forwarded code does not go through the caches, so they are
+ * flushed before each warm-up rather than left with lines the code may have
+ * evicted since (stale hits): the warm-up has to be long enough to bring in
+ * what the window uses. A period of 0 times every instruction, the
+ * reference the samples estimate.
+ *
+ * Cycles of an instruction: 1, plus
+ *   load-use: it reads the rd of the load just before it
+ *   taken branch / jump: the fetch is redirected
+ *   L1 miss: its fetch or data access misses the L1I/L1D (RV32I_CACHE)
+ * */
+
+typedef struct {
+    uint32_t    load_use;   //stall cycles of each penalty
+    uint32_t    branch;     //taken conditional branch
+    uint32_t    jump;       //JAL/JALR
+    uint32_t    l1i_miss;   //next level latency of a fetch missing the L1I
+    uint32_t    l1d_miss;   //and of a load/store missing the L1D
+    rv32i_cache_config l1i;
+    rv32i_cache_config l1d;
+} rv32i_timing_config;
+
+#define RV32I_TIMING_DEFAULT    { 1, 2, 2, 10, 10, RV32I_L1I_DEFAULT, RV32I_L1D_DEFAULT }
+
+#define RV32I_SAMPLE_PERIOD     200000  //default instructions from one window to the next
+#define RV32I_SAMPLE_WINDOW     1000    //default instructions timed per window
+#define RV32I_SAMPLE_WARMUP     10000   //default detailed instructions before a window, not counted
+
+//stall cycles by cause, for the instructions timed in windows
+typedef enum {
+    STALL_LOAD_USE,
+    STALL_BRANCH,
+    STALL_JUMP,
+    STALL_L1I,
+    STALL_L1D,
+    STALL_CAUSES
+} rv32i_stall_cause;
+
+class RV32I_TIMING {
+    private:
+        rv32i_timing_config config;
+        uint64_t    period;
+        uint64_t    window;
+        uint64_t    warmup;
+        RV32I_CACHE icache;
+        RV32I_CACHE dcache;
+        uint8_t     load_rd;    //rd of the previous instruction if it was a load, else 0
+        std::vector<double> samples;    //CPI of each window
+        uint64_t    instructions;   //retired by run()
+        uint64_t    detailed;       //of which stepped through the pipeline model
+        uint64_t    timed;          //of which in windows
+        uint64_t    timed_cycles;
+        uint64_t    stalls[STALL_CAUSES];
+
+        uint32_t step(SimpleRV32I *cpu, uint64_t *stall);
+
+    public:
+        RV32I_TIMING(const rv32i_timing_config &config, uint64_t period=RV32I_SAMPLE_PERIOD,
+                     uint64_t window=RV32I_SAMPLE_WINDOW, uint64_t warmup=RV32I_SAMPLE_WARMUP);
+        int run(SimpleRV32I *cpu, uint64_t maxInstructions=UINT64_MAX);
+        bool estimate(double *cpi, double *halfWidth);
+        void report(std::ostream &out);
+};
+
+bool parseTimingConfig(const char *arg, rv32i_timing_config *config);
+bool parseSampling(const char *arg, uint64_t *period, uint64_t *window, uint64_t *warmup);
+
+#endif
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+
+/*
+ * the ring holds at least records entries (rounded up to a power of two)
+ * */
+RV32I_TRACE::RV32I_TRACE(uint64_t records) {
+    size = 1;
+    while(size < records) size <<= 1;
+    ring = new rv32i_trace_record[size];
+    count = 0;
+}
+
+RV32I_TRACE::~RV32I_TRACE() {
+    delete [] ring;
+}
+
+
+/*
+ * writes the records in the ring, oldest first
+ * */
+bool RV32I_TRACE::save(std::string file) {
+    std::ofstream out(file.c_str(), std::ios::binary);
+    rv32i_trace_header h;
+
+    if(!out.is_open()) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return false;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RV32I_TRACE_MAGIC, sizeof(h.magic));
+    h.version = RV32I_TRACE_VERSION;
+    h.record_size = sizeof(rv32i_trace_record);
+    h.records = (count < size) ? count : size;
+    h.first = count - h.records;
+    out.write((const char*)&h, sizeof(h));
+    //the oldest record is at first, the ring may wrap once
+    uint64_t start = h.first & (size - 1);
+    uint64_t n = (start + h.records <= size) ? h.records : size - start;
+    out.write((const char*)&ring[start], n * sizeof(rv32i_trace_record));
+    out.write((const char*)ring, (h.records - n) * sizeof(rv32i_trace_record));
+    out.close();
+    if(out.fail()) {
+        std::cerr << "Unable to write trace: " << file << std::endl;
+        return false;
+    }
+    debug_printf(DEBUG_LOW,"RV32I_TRACE::save> %llu records from %llu %s:%d\n",(unsigned long long)h.records,(unsigned long long)h.first,__FILE__, __LINE__);
+    return true;
+}
+
+
+/*
+ * records the next instructions into a ring of (at least) records entries,
+ * 0 turns tracing off
+ * */
+void SimpleRV32I::enableTrace(uint64_t records) {
+    delete trace;
+    trace = records ? new RV32I_TRACE(records) : NULL;
+}
+
+
+/*
+ * writes the instructions traced so far (the last ones if the ring wrapped)
+ * */
+bool SimpleRV32I::saveTrace(std::string file) {
+    if(trace == NULL) {
+        std::cerr << "Tracing is not enabled" << std::endl;
+        return false;
+    }
+    return trace->save(file);
+}
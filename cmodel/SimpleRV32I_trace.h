@@ -0,0 +1,64 @@
+#ifndef __SIMPLERV32I_TRACE_H__
+#define __SIMPLERV32I_TRACE_H__
+#include <stdint.h>
+#include <string>
+
+/*
+ * Instruction trace
+ *
+ * Every instruction executed while tracing is enabled leaves a fixed size
+ * binary record in a ring buffer, so the last N instructions (e.g. before a
+ * guest trap) are always at hand for the price of a few stores. The ring is
+ * written to a file by save() and turned into text by rv32i_trace.
+ *
+ * File: a rv32i_trace_header, then the records, oldest first.
+ * */
+
+#define RV32I_TRACE_MAGIC       "RV32ITRC"
+#define RV32I_TRACE_VERSION     1
+#define RV32I_TRACE_SIZE        (1024*1024)     //default number of records kept
+
+/*
+ * one executed instruction, what the fields mean depends on the instruction
+ * (the decoder tells): rd_value for instructions writing rd, addr for loads
+ * and stores, data for stores (the rs2 value, the store size masks it)
+ * */
+typedef struct {
+    uint32_t    pc;
+    uint32_t    inst;       //raw instruction word
+    uint32_t    rd_value;   //rd after the instruction
+    uint32_t    addr;       //rs1 + imm
+    uint32_t    data;       //rs2
+    uint32_t    status;     //model status after the instruction (RV32I_STATUS_*)
+} rv32i_trace_record;
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    record_size;
+    uint64_t    first;      //index (instructions traced before it) of the first record in the file
+    uint64_t    records;    //records in the file
+} rv32i_trace_header;
+
+class RV32I_TRACE {
+    private:
+        rv32i_trace_record *ring;
+        uint64_t    size;   //records, a power of two
+        uint64_t    count;  //records written so far
+
+    public:
+        RV32I_TRACE(uint64_t records=RV32I_TRACE_SIZE);
+        ~RV32I_TRACE();
+        void clear() { count = 0; }
+        bool save(std::string file);
+
+        /*
+         * returns the record to fill for the next instruction, overwriting
+         * the oldest one once the ring is full
+         * */
+        inline rv32i_trace_record *next() {
+            return &ring[count++ & (size - 1)];
+        }
+};
+
+#endif
@@ -1,10 +1,16 @@
 #include "SimpleRV32I_utils.h"
-//a super dumb version of debug printing using environment variable
-void debug_printf(uint8_t debugLevel, const char * format, ... ) {
+
+static uint8_t debugLevelFromEnv() {
+    const char *env = getenv("DEBUG");
+    return env ? atoi(env) : DEBUG_NONE;
+}
+
+uint8_t debug_level = debugLevelFromEnv();
+
+//a super dumb version of debug printing, the level check is done by debug_printf()
+void debug_vprintf(const char * format, ... ) {
     va_list ap;
-    uint8_t debug_print_en = (getenv("DEBUG") != NULL) && atoi((getenv("DEBUG")));
-    uint8_t debug_level_cmd = debug_print_en ? atoi(getenv("DEBUG")) : 0;
     va_start(ap,format);
-    if(debug_print_en & (debugLevel <= debug_level_cmd)) vprintf(format,ap);
+    vprintf(format,ap);
     va_end(ap);
 }
@@ -10,6 +10,23 @@
 #define DEBUG_MEDIUM 2
 #define DEBUG_HIGH 3
 
-void debug_printf(uint8_t debugLevel, const char * format, ... );
+/*
+ * highest level compiled in, debug_printf()s above it cost nothing
+ * (e.g. make CFLAGS="-O2 -DRV32I_DEBUG_MAX=0")
+ * */
+#ifndef RV32I_DEBUG_MAX
+#define RV32I_DEBUG_MAX DEBUG_HIGH
+#endif
+
+//level given by the DEBUG environment variable, read once at startup
+extern uint8_t debug_level;
+
+void debug_vprintf(const char * format, ... );
+
+//prints if debugLevel is enabled, a disabled call is one compare
+#define debug_printf(debugLevel, ...) \
+    do { \
+        if(((debugLevel) <= RV32I_DEBUG_MAX) && ((debugLevel) <= debug_level)) debug_vprintf(__VA_ARGS__); \
+    } while(0)
 
 #endif
@@ -0,0 +1,190 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_batch.h"
+#include "SimpleRV32I_utils.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Benchmark harness: runs each benchmark image on each execution engine and
+ * reports instructions retired, wall time, MIPS and host cycles (TSC ticks)
+ * per guest instruction. Against a baseline, a result is WRONG if instret or
+ * the a0 checksum differ. MIPS depend on the host the baseline was recorded
+ * on, they are only compared with a tolerance given (-t): a result is SLOWER
+ * if its MIPS dropped by more than that.
+ * */
+
+typedef struct {
+    uint64_t    instret;
+    uint32_t    a0;
+    double      mips;
+} rv32i_bench_result;
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [-e interp|block|jit]... [-r <runs>] [-b <baseline>] [-w <baseline>] [-t <percent>] <image>..." << std::endl;
+    std::cerr << "  -e <engine>     engine to measure, may be repeated (default: all)" << std::endl;
+    std::cerr << "  -r <runs>       runs per benchmark and engine, at least 1s worth of them, the fastest one counts (default: 5)" << std::endl;
+    std::cerr << "  -b <baseline>   compare instret and a0 with a baseline, exit status 1 on a wrong (or with -t slower) result" << std::endl;
+    std::cerr << "  -w <baseline>   write the results as the new baseline" << std::endl;
+    std::cerr << "  -t <percent>    also compare MIPS, tolerating a drop of percent (baselines from the same host only)" << std::endl;
+}
+
+static inline uint64_t hostCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static std::string benchName(const char *image) {
+    std::string name = image;
+    if(name.rfind('/') != std::string::npos) name = name.substr(name.rfind('/') + 1);
+    if(name.find('.') != std::string::npos) name = name.substr(0, name.find('.'));
+    return name;
+}
+
+int main(int argc, char **argv) {
+    static const char * const engineNames[] = { "interp", "block", "jit" };
+    std::vector<rv32i_engine> engines;
+    std::vector<const char*> images;
+    const char *baselineFile = NULL;
+    const char *writeFile = NULL;
+    double tolerance = -1;     //no MIPS comparison
+    int runs = 5;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-e") && (i+1 < argc)) {
+            i++;
+            if(!strcmp(argv[i], "interp")) engines.push_back(ENGINE_INTERP);
+            else if(!strcmp(argv[i], "block")) engines.push_back(ENGINE_BLOCK);
+            else if(!strcmp(argv[i], "jit")) engines.push_back(ENGINE_JIT);
+            else { usage(argv[0]); return 1; }
+        } else if(!strcmp(argv[i], "-r") && (i+1 < argc)) {
+            runs = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "-b") && (i+1 < argc)) {
+            baselineFile = argv[++i];
+        } else if(!strcmp(argv[i], "-w") && (i+1 < argc)) {
+            writeFile = argv[++i];
+        } else if(!strcmp(argv[i], "-t") && (i+1 < argc)) {
+            tolerance = atof(argv[++i]);
+        } else if(argv[i][0] != '-') {
+            images.push_back(argv[i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(images.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(engines.empty()) {
+        engines.push_back(ENGINE_INTERP);
+        engines.push_back(ENGINE_BLOCK);
+        engines.push_back(ENGINE_JIT);
+    }
+    if(runs < 1) runs = 1;
+
+    //baseline: "<benchmark> <engine> <instret> <a0> <mips>" per line
+    std::map<std::string, rv32i_bench_result> baseline;
+    if(baselineFile) {
+        std::ifstream in(baselineFile);
+        std::string line;
+        if(!in.is_open()) {
+            std::cerr << "Unable to open file: " << baselineFile << std::endl;
+            return 1;
+        }
+        while(std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string name, engine;
+            rv32i_bench_result r;
+            if((line[0] == '#') || !(fields >> name >> engine >> r.instret >> std::hex >> r.a0 >> std::dec >> r.mips)) continue;
+            baseline[name + " " + engine] = r;
+        }
+    }
+
+    std::ostringstream results;
+    bool pass = true;
+    std::cout << std::left << std::setw(10) << "benchmark" << std::setw(8) << "engine" << std::right << std::setw(12) << "instret"
+              << std::setw(10) << "seconds" << std::setw(10) << "MIPS" << std::setw(10) << "cyc/inst" << std::setw(10) << "a0"
+              << "  baseline" << std::endl;
+    for(size_t i=0; i<images.size(); i++) {
+        std::string name = benchName(images[i]);
+        for(size_t e=0; e<engines.size(); e++) {
+            rv32i_bench_result r;
+            double best = 0, total = 0;
+            uint64_t cycles = 0;
+            //short runs are repeated for at least a second, the fastest one is the least disturbed
+            for(int run=0; (run < runs) || ((total < 1.0) && (run < 100)); run++) {
+                SimpleRV32I cpu(4000, engines[e]);
+                if(!loadImage(cpu, images[i], "")) {
+                    std::cerr << "Unable to open file: " << images[i] << std::endl;
+                    return 1;
+                }
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                uint64_t c = hostCycles();
+                cpu.run();
+                c = hostCycles() - c;
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                total += seconds;
+                if((run == 0) || (seconds < best)) {
+                    best = seconds;
+                    cycles = c;
+                }
+                r.instret = cpu.getInstret();
+                r.a0 = cpu.getReg(10);
+            }
+            r.mips = (best > 0) ? r.instret / best / 1e6 : 0;
+
+            std::string key = name + " " + engineNames[engines[e]];
+            std::ostringstream verdict;
+            if(baseline.count(key)) {
+                const rv32i_bench_result &b = baseline[key];
+                if((b.instret != r.instret) || (b.a0 != r.a0)) {
+                    verdict << "WRONG (instret " << b.instret << " a0 " << std::hex << b.a0 << ")";
+                    pass = false;
+                } else if(tolerance < 0) {
+                    verdict << "ok";
+                } else {
+                    double delta = (r.mips - b.mips) / b.mips * 100;
+                    verdict << std::showpos << std::fixed << std::setprecision(1) << delta << "%";
+                    if(delta < -tolerance) {
+                        verdict << " SLOWER";
+                        pass = false;
+                    }
+                }
+            } else if(baselineFile) {
+                verdict << "-";
+            }
+
+            std::cout << std::left << std::setw(10) << name << std::setw(8) << engineNames[engines[e]] << std::right
+                      << std::setw(12) << r.instret << std::fixed << std::setw(10) << std::setprecision(3) << best
+                      << std::setw(10) << std::setprecision(1) << r.mips << std::setw(10) << std::setprecision(2);
+            if(cycles) std::cout << (double)cycles / r.instret;
+            else std::cout << "-";
+            std::cout << "  " << std::hex << std::setw(8) << std::setfill('0') << r.a0 << std::setfill(' ') << std::dec
+                      << "  " << verdict.str() << std::endl;
+            results << name << " " << engineNames[engines[e]] << " " << r.instret << " " << std::hex << std::setw(8)
+                    << std::setfill('0') << r.a0 << std::setfill(' ') << std::dec << " " << std::fixed << std::setprecision(1)
+                    << r.mips << std::endl;
+        }
+    }
+
+    if(writeFile) {
+        std::ofstream out(writeFile);
+        if(!out.is_open()) {
+            std::cerr << "Unable to open file: " << writeFile << std::endl;
+            return 1;
+        }
+        out << "# benchmark engine instret a0 mips (rv32i_bench -w, make bench-baseline)" << std::endl << results.str();
+    }
+    return pass ? 0 : 1;
+}
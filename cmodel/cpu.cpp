@@ -1,14 +1,412 @@
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
 #include "SimpleRV32I.h"
+#include "SimpleRV32I_batch.h"
+#include "SimpleRV32I_cache.h"
+#include "SimpleRV32I_diff.h"
+#include "SimpleRV32I_smp.h"
+#include "SimpleRV32I_syscall.h"
+#include "SimpleRV32I_timing.h"
 #include "SimpleRV32I_utils.h"
 
 
-int main() {
-    SimpleRV32I cpuModel = SimpleRV32I();
-    cpuModel.loadProgram();
-    cpuModel.loadData();
-    while(!cpuModel.step()); //step through the program until the model indicates execution complete
-    cpuModel.dumpData();
-    cpuModel.dumpRegs();
-    return 0;
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [-p <program>] [-d <data>] [-u] [-m <base>:<size>[:rwx]]..." << std::endl;
+    std::cerr << "       [-e interp|block|jit] [--jit-cache <KiB>] [--jit-threshold <n>] [--max <n>]" << std::endl;
+    std::cerr << "       [--harts <n>] [--quantum <n>]" << std::endl;
+    std::cerr << "       [--isa rv32i[m][a]] [--cpi <class>=<n>[,...]] [--time-div <n>] [--trace <file>] [--trace-size <n>]" << std::endl;
+    std::cerr << "       [--cache] [--l1i <KiB>:<ways>:<line>] [--l1d <KiB>:<ways>:<line>]" << std::endl;
+    std::cerr << "       [--timing] [--timing-lat <stall>=<n>[,...]] [--sample <period>[:<window>[:<warmup>]]]" << std::endl;
+    std::cerr << "       [--diff] [--diff-interval <n>[:<snapshot>]]" << std::endl;
+    std::cerr << "       [--break <pc>]... [--watch <addr>[:<len>[:r|w|rw]]]..." << std::endl;
+    std::cerr << "       [--syscalls] [--sandbox <dir>] [-- <guest arguments>...]" << std::endl;
+    std::cerr << "       [--profile <file>] [--flamegraph <file>] [--symbols <elf>]" << std::endl;
+    std::cerr << "       [--data-out <file>] [--regs-out <file>] [--dump <file>] [--dump-interval <n>]" << std::endl;
+    std::cerr << "       [--checkpoint <file>] [--restore <file>]" << std::endl;
+    std::cerr << "       " << prog << " -b <manifest> [-j <threads>] [--report <file>] [--out-dir <dir>] [--lockstep] [-e ...] [-m ...]" << std::endl;
+    std::cerr << "  -p <program>          ELF executable, raw .bin image or hex text (default: code.txt)" << std::endl;
+    std::cerr << "  -d <data>             hex text data memory image (default: data.txt, not read for ELF programs)" << std::endl;
+    std::cerr << "  -u                    one address space for instructions and data (default: split)" << std::endl;
+    std::cerr << "  -m <base>:<size>[:p]  map an extra data region, p is any of r/w/x (default: rw)" << std::endl;
+    std::cerr << "  -e <engine>           execution engine (default: interp, the reference step() path)" << std::endl;
+    std::cerr << "  --jit-cache <KiB>     size of the native code cache used by the jit engine" << std::endl;
+    std::cerr << "  --jit-threshold <n>   executions before a block is compiled by the jit engine" << std::endl;
+    std::cerr << "  --max <n>             stop after n instructions" << std::endl;
+    std::cerr << "  --isa <isa>           instruction set: rv32i followed by the extensions, m and/or a (default: rv32i)" << std::endl;
+    std::cerr << "  --harts <n>           SMP: n harts sharing memory, each on its own thread (default: 1)" << std::endl;
+    std::cerr << "  --quantum <n>         SMP: run the harts in turn, n instructions each, on one thread (reproducible)" << std::endl;
+    std::cerr << "  --cpi <class>=<n>,... cycles per instruction of a class: alu, load, store, branch, jump, system (default: 1)" << std::endl;
+    std::cerr << "  --time-div <n>        cycles per tick of the time CSR (default: 1)" << std::endl;
+    std::cerr << "  --trace <file>        record the last instructions executed, written when the run stops (see rv32i_trace)" << std::endl;
+    std::cerr << "  --trace-size <n>      instructions kept by --trace (default: 1M)" << std::endl;
+    std::cerr << "  --cache               model L1 caches on a separate thread and report hit/miss statistics" << std::endl;
+    std::cerr << "  --l1i, --l1d <geom>   L1 instruction/data cache geometry (default: 32:4:64, 32:8:64), implies --cache without --timing" << std::endl;
+    std::cerr << "  --timing              estimate the CPI of a 5-stage in-order pipeline from sampled windows" << std::endl;
+    std::cerr << "  --timing-lat <s>=<n>  stall cycles: load-use, branch, jump, l1i-miss, l1d-miss (default: 1,2,2,10,10)" << std::endl;
+    std::cerr << "  --sample <p>[:<w>[:<u>]] a window of w instructions after u of warm-up every p (default: 200000:1000:10000," << std::endl;
+    std::cerr << "                        0: time every instruction), implies --timing" << std::endl;
+    std::cerr << "  --diff                check the engine against the reference interpreter as it runs, report the first" << std::endl;
+    std::cerr << "                        diverging instruction (exit code 2)" << std::endl;
+    std::cerr << "  --diff-interval <n>[:<s>] compare every n instructions (default 4096), snapshot every s (default 1M)," << std::endl;
+    std::cerr << "                        implies --diff" << std::endl;
+    std::cerr << "  --break <pc>          stop before the instruction at pc" << std::endl;
+    std::cerr << "  --watch <a>[:<n>[:k]] stop before an access (k: r, w or rw, default rw) to [a, a+n) (default n: 4)" << std::endl;
+    std::cerr << "  --syscalls            emulate newlib syscalls on ECALL (default: ECALL halts), exit with the guest's code" << std::endl;
+    std::cerr << "  --sandbox <dir>       directory the guest can open files in, implies --syscalls" << std::endl;
+    std::cerr << "  -- <args>...          guest argv[1...] (argv[0] is the program), with --syscalls" << std::endl;
+    std::cerr << "  --profile <file>      profile the run: hot functions, blocks and pcs" << std::endl;
+    std::cerr << "  --flamegraph <file>   profile the run: collapsed call stacks, for flamegraph.pl" << std::endl;
+    std::cerr << "  --symbols <elf>       symbols for the profile (default: the program, if it is an ELF file)" << std::endl;
+    std::cerr << "  --data-out <file>     data memory dump (default: data_out.txt)" << std::endl;
+    std::cerr << "  --regs-out <file>     register dump (default: regs_out.txt)" << std::endl;
+    std::cerr << "  --dump <file>         binary dump of the state when the run stops, only the pages holding data (see rv32i_dump)" << std::endl;
+    std::cerr << "  --dump-interval <n>   with --dump: a full dump at the start, then the pages written in between every n" << std::endl;
+    std::cerr << "                        instructions and when the run stops, appended" << std::endl;
+    std::cerr << "  --checkpoint <file>   save the machine state when the run stops (e.g. after --max <n>)" << std::endl;
+    std::cerr << "  --restore <file>      start from a checkpoint instead of -p/-d" << std::endl;
+    std::cerr << "  -b <manifest>         batch mode: run every job of the manifest (see SimpleRV32I_batch.h)" << std::endl;
+    std::cerr << "  -j <threads>          batch worker threads (default: one per cpu)" << std::endl;
+    std::cerr << "  --report <file>       batch report (default: stdout)" << std::endl;
+    std::cerr << "  --out-dir <dir>       write each batch job's dumps to <dir>/<name>.{data,regs}_out.txt" << std::endl;
+    std::cerr << "  --lockstep            run batch jobs that only differ in their data together, on vector lanes" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    rv32i_engine engine = ENGINE_INTERP;
+    rv32i_mem_layout layout = MEM_SPLIT;
+    const char *program = "code.txt";
+    const char *data = NULL;
+    const char *dataOut = "data_out.txt";
+    const char *regsOut = "regs_out.txt";
+    const char *dumpFile = NULL;
+    uint64_t dumpInterval = 0;
+    const char *manifest = NULL;
+    const char *reportFile = NULL;
+    const char *outDir = NULL;
+    bool lockstep = false;
+    const char *checkpoint = NULL;
+    const char *restore = NULL;
+    const char *traceFile = NULL;
+    uint64_t traceSize = RV32I_TRACE_SIZE;
+    bool cacheModel = false;
+    rv32i_cache_config l1i = RV32I_L1I_DEFAULT;
+    rv32i_cache_config l1d = RV32I_L1D_DEFAULT;
+    bool cacheGeometry = false;
+    bool timing = false;
+    rv32i_timing_config timingConfig = RV32I_TIMING_DEFAULT;
+    uint64_t samplePeriod = RV32I_SAMPLE_PERIOD;
+    uint64_t sampleWindow = RV32I_SAMPLE_WINDOW;
+    uint64_t sampleWarmup = RV32I_SAMPLE_WARMUP;
+    const char *profileFile = NULL;
+    const char *flameFile = NULL;
+    const char *symbols = NULL;
+    bool syscallEmulation = false;
+    const char *sandbox = NULL;
+    std::vector<std::string> guestArgs;
+    int threads = 0;
+    uint64_t maxInstructions = UINT64_MAX;
+    std::vector<const char*> regions;
+    std::vector<uint32_t> breaks;
+    std::vector<rv32i_watchpoint> watches;
+    uint32_t jitCacheSize = RV32I_JIT_CACHE_SIZE;
+    uint32_t jitThreshold = RV32I_JIT_THRESHOLD;
+    uint32_t costs[COST_CLASSES] = { 1, 1, 1, 1, 1, 1 };
+    uint32_t timeDiv = RV32I_TIME_DIVIDER;
+    uint32_t isaExt = 0;
+    uint32_t harts = 1;
+    uint64_t quantum = 0;
+    bool diffCheck = false;
+    uint64_t diffInterval = RV32I_DIFF_INTERVAL;
+    uint64_t diffSnapshot = RV32I_DIFF_SNAPSHOT;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-p") && (i+1 < argc)) {
+            program = argv[++i];
+        } else if(!strcmp(argv[i], "-d") && (i+1 < argc)) {
+            data = argv[++i];
+        } else if(!strcmp(argv[i], "-u")) {
+            layout = MEM_UNIFIED;
+        } else if(!strcmp(argv[i], "-m") && (i+1 < argc)) {
+            regions.push_back(argv[++i]);
+        } else if(!strcmp(argv[i], "-e") && (i+1 < argc)) {
+            i++;
+            if(!strcmp(argv[i], "interp")) engine = ENGINE_INTERP;
+            else if(!strcmp(argv[i], "block")) engine = ENGINE_BLOCK;
+            else if(!strcmp(argv[i], "jit")) engine = ENGINE_JIT;
+            else { usage(argv[0]); return 1; }
+        } else if(!strcmp(argv[i], "--jit-cache") && (i+1 < argc)) {
+            jitCacheSize = strtoul(argv[++i], NULL, 0) * 1024;
+        } else if(!strcmp(argv[i], "--jit-threshold") && (i+1 < argc)) {
+            jitThreshold = strtoul(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--cpi") && (i+1 < argc)) {
+            if(!parseCosts(argv[++i], costs)) { usage(argv[0]); return 1; }
+        } else if(!strcmp(argv[i], "--isa") && (i+1 < argc)) {
+            if(!parseIsa(argv[++i], &isaExt)) { usage(argv[0]); return 1; }
+        } else if(!strcmp(argv[i], "--harts") && (i+1 < argc)) {
+            harts = strtoul(argv[++i], NULL, 0);
+            if((harts < 1) || (harts > RV32I_SMP_MAX_HARTS)) { usage(argv[0]); return 1; }
+        } else if(!strcmp(argv[i], "--quantum") && (i+1 < argc)) {
+            quantum = strtoull(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--time-div") && (i+1 < argc)) {
+            timeDiv = strtoul(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--trace") && (i+1 < argc)) {
+            traceFile = argv[++i];
+        } else if(!strcmp(argv[i], "--trace-size") && (i+1 < argc)) {
+            traceSize = strtoull(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--cache")) {
+            cacheModel = true;
+        } else if(!strcmp(argv[i], "--l1i") && (i+1 < argc)) {
+            if(!parseCacheConfig(argv[++i], &l1i)) { usage(argv[0]); return 1; }
+            cacheGeometry = true;
+        } else if(!strcmp(argv[i], "--l1d") && (i+1 < argc)) {
+            if(!parseCacheConfig(argv[++i], &l1d)) { usage(argv[0]); return 1; }
+            cacheGeometry = true;
+        } else if(!strcmp(argv[i], "--timing")) {
+            timing = true;
+        } else if(!strcmp(argv[i], "--timing-lat") && (i+1 < argc)) {
+            if(!parseTimingConfig(argv[++i], &timingConfig)) { usage(argv[0]); return 1; }
+            timing = true;
+        } else if(!strcmp(argv[i], "--sample") && (i+1 < argc)) {
+            if(!parseSampling(argv[++i], &samplePeriod, &sampleWindow, &sampleWarmup)) { usage(argv[0]); return 1; }
+            timing = true;
+        } else if(!strcmp(argv[i], "--diff")) {
+            diffCheck = true;
+        } else if(!strcmp(argv[i], "--diff-interval") && (i+1 < argc)) {
+            if(!parseDiffConfig(argv[++i], &diffInterval, &diffSnapshot)) { usage(argv[0]); return 1; }
+            diffCheck = true;
+        } else if(!strcmp(argv[i], "--break") && (i+1 < argc)) {
+            breaks.push_back(strtoul(argv[++i], NULL, 0));
+        } else if(!strcmp(argv[i], "--watch") && (i+1 < argc)) {
+            rv32i_watchpoint w;
+            if(!parseWatchpoint(argv[++i], &w)) { usage(argv[0]); return 1; }
+            watches.push_back(w);
+        } else if(!strcmp(argv[i], "--syscalls")) {
+            syscallEmulation = true;
+        } else if(!strcmp(argv[i], "--sandbox") && (i+1 < argc)) {
+            sandbox = argv[++i];
+            syscallEmulation = true;
+        } else if(!strcmp(argv[i], "--")) {
+            guestArgs.assign(argv + i + 1, argv + argc);
+            break;
+        } else if(!strcmp(argv[i], "--profile") && (i+1 < argc)) {
+            profileFile = argv[++i];
+        } else if(!strcmp(argv[i], "--flamegraph") && (i+1 < argc)) {
+            flameFile = argv[++i];
+        } else if(!strcmp(argv[i], "--symbols") && (i+1 < argc)) {
+            symbols = argv[++i];
+        } else if(!strcmp(argv[i], "--max") && (i+1 < argc)) {
+            maxInstructions = strtoull(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--data-out") && (i+1 < argc)) {
+            dataOut = argv[++i];
+        } else if(!strcmp(argv[i], "--regs-out") && (i+1 < argc)) {
+            regsOut = argv[++i];
+        } else if(!strcmp(argv[i], "--dump") && (i+1 < argc)) {
+            dumpFile = argv[++i];
+        } else if(!strcmp(argv[i], "--dump-interval") && (i+1 < argc)) {
+            dumpInterval = strtoull(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--checkpoint") && (i+1 < argc)) {
+            checkpoint = argv[++i];
+        } else if(!strcmp(argv[i], "--restore") && (i+1 < argc)) {
+            restore = argv[++i];
+        } else if(!strcmp(argv[i], "-b") && (i+1 < argc)) {
+            manifest = argv[++i];
+        } else if(!strcmp(argv[i], "-j") && (i+1 < argc)) {
+            threads = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--report") && (i+1 < argc)) {
+            reportFile = argv[++i];
+        } else if(!strcmp(argv[i], "--out-dir") && (i+1 < argc)) {
+            outDir = argv[++i];
+        } else if(!strcmp(argv[i], "--lockstep")) {
+            lockstep = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(cacheGeometry && !timing) cacheModel = true;
+    timingConfig.l1i = l1i;
+    timingConfig.l1d = l1d;
+    if((harts > 1) && (manifest || traceFile || cacheModel || timing || profileFile || flameFile || syscallEmulation ||
+                       !breaks.empty() || !watches.empty() || checkpoint || restore)) {
+        std::cerr << "--harts runs without -b, --trace, --cache, --timing, --profile, --flamegraph, --syscalls, --break, --watch," << std::endl;
+        std::cerr << "--checkpoint and --restore" << std::endl;
+        return 1;
+    }
+    if((dumpInterval && !dumpFile) || (dumpFile && (manifest || (harts > 1))) || (dumpInterval && (timing || diffCheck))) {
+        std::cerr << "--dump-interval needs --dump, --dump runs without -b and --harts, --dump-interval without --timing" << std::endl;
+        std::cerr << "and --diff" << std::endl;
+        return 1;
+    }
+    if(syscallEmulation && (checkpoint || restore)) { //a checkpoint has no brk or open files
+        std::cerr << "--syscalls and --sandbox run without --checkpoint and --restore" << std::endl;
+        return 1;
+    }
+    if(diffCheck && (manifest || (harts > 1) || traceFile || cacheModel || timing || profileFile || flameFile || syscallEmulation ||
+                     !breaks.empty() || !watches.empty())) {
+        std::cerr << "--diff runs without -b, --harts, --trace, --cache, --timing, --profile, --flamegraph, --syscalls, --break" << std::endl;
+        std::cerr << "and --watch" << std::endl;
+        return 1;
+    }
+
+    if(manifest) { //batch mode
+        rv32i_batch_options opts;
+        opts.engine = engine;
+        opts.jit_cache_size = jitCacheSize;
+        opts.jit_threshold = jitThreshold;
+        memcpy(opts.costs, costs, sizeof(opts.costs));
+        opts.time_div = timeDiv;
+        opts.isa_ext = isaExt;
+        opts.threads = threads;
+        if(outDir) opts.out_dir = outDir;
+        opts.lockstep = lockstep;
+        opts.regions.assign(regions.begin(), regions.end());
+        RV32I_BATCH batch(opts);
+        if(!batch.loadManifest(manifest)) return 1;
+        double seconds = batch.run();
+        bool pass;
+        if(reportFile) {
+            std::ofstream out(reportFile);
+            if(!out.is_open()) {
+                std::cerr << "Unable to open file: " << reportFile << std::endl;
+                return 1;
+            }
+            pass = batch.report(out, seconds);
+        } else {
+            pass = batch.report(std::cout, seconds);
+        }
+        return pass ? 0 : 2;
+    }
+
+    SimpleRV32I cpuModel = SimpleRV32I(4000, engine, layout);
+    cpuModel.configureJit(jitCacheSize, jitThreshold);
+    cpuModel.configureCounters(costs, timeDiv);
+    cpuModel.configureIsa(isaExt);
+    if(traceFile) cpuModel.enableTrace(traceSize);
+    for(size_t i=0; i<regions.size(); i++) {
+        uint32_t base, size;
+        uint8_t perms;
+        if(!parseRegion(regions[i], &base, &size, &perms) || !cpuModel.mapMemory(base, size, perms)) {
+            std::cerr << "Invalid memory region: " << regions[i] << std::endl;
+            return 1;
+        }
+    }
+    if(restore) {
+        if(!cpuModel.loadCheckpoint(restore)) return 1;
+    } else if(!loadImage(cpuModel, program, data ? data : (isElf(program) ? "" : "data.txt"))) {
+        //hex/raw programs come with a data image, data.txt unless given
+        std::cerr << "Unable to open program or data file" << std::endl;
+        return 1;
+    }
+    if(harts > 1) {
+        RV32I_SMP smp(&cpuModel, harts);
+        bool trapped = false;
+        smp.setQuantum(quantum);
+        smp.run(maxInstructions);
+        for(uint32_t h=0; h<harts; h++) {
+            SimpleRV32I *cpu = smp.hart(h);
+            if(cpu->getStatus() == RV32I_STATUS_TRAP) {
+                trapped = true;
+                std::cerr << "Guest trap: hart " << std::dec << h << " cause " << cpu->getTrapCause() << " value 0x" << std::hex
+                          << cpu->getTrapValue() << " pc 0x" << cpu->getPC() << std::endl;
+            }
+        }
+        if(!cpuModel.dumpData(dataOut)) return 1;
+        for(uint32_t h=0; h<harts; h++) {
+            //hart 0 to regsOut, the others to regsOut.<hart>
+            if(!smp.hart(h)->dumpRegs(h ? std::string(regsOut) + "." + std::to_string(h) : std::string(regsOut))) return 1;
+        }
+        return trapped ? 3 : 0;
+    }
+    RV32I_PROBE probe;
+    RV32I_CACHE_MODEL caches(l1i, l1d);
+    if(cacheModel) {
+        probe.addConsumer(&caches);
+        probe.start();
+        cpuModel.attachProbe(&probe);
+    }
+    RV32I_PROFILER profiler;
+    if(profileFile || flameFile) {
+        if(!symbols && !restore && isElf(program)) symbols = program;
+        if(symbols && !profiler.loadSymbols(symbols)) std::cerr << "No symbols in " << symbols << std::endl;
+        cpuModel.attachProfiler(&profiler);
+    }
+    RV32I_SYSCALLS syscalls;
+    if(syscallEmulation) {
+        if(sandbox && !syscalls.setSandbox(sandbox)) return 1;
+        guestArgs.insert(guestArgs.begin(), program);
+        if(!syscalls.setupStack(&cpuModel, guestArgs)) {
+            std::cerr << "Unable to set up the guest stack" << std::endl;
+            return 1;
+        }
+        cpuModel.attachSyscalls(&syscalls);
+    }
+    for(size_t i=0; i<breaks.size(); i++) {
+        cpuModel.addBreakpoint(breaks[i]);
+    }
+    for(size_t i=0; i<watches.size(); i++) {
+        cpuModel.addWatchpoint(watches[i].addr, watches[i].len, watches[i].kind);
+    }
+    RV32I_TIMING timingModel(timingConfig, samplePeriod, sampleWindow, sampleWarmup);
+    rv32i_stop stop;
+    bool diverged = false;
+    if(timing) {
+        timingModel.run(&cpuModel, maxInstructions);
+        stop.reason = (cpuModel.getStatus() == RV32I_STATUS_TRAP) ? STOP_FAULT : STOP_ECALL;
+    } else if(diffCheck) {
+        RV32I_DIFF checker(&cpuModel, diffInterval, diffSnapshot);
+        diverged = checker.run(maxInstructions).diverged;
+        checker.report(std::cout);
+        stop.reason = (cpuModel.getStatus() == RV32I_STATUS_TRAP) ? STOP_FAULT : STOP_ECALL;
+    } else if(dumpInterval) {
+        //the pages written in between every dumpInterval instructions, on top of a full dump
+        uint64_t start = cpuModel.getInstret();
+        if(!cpuModel.saveDump(dumpFile)) return 1;
+        do {
+            stop = cpuModel.runUntil(std::min(dumpInterval, maxInstructions - (cpuModel.getInstret() - start)));
+            if(!cpuModel.saveDump(dumpFile, true)) return 1;
+        } while((stop.reason == STOP_BUDGET) && (cpuModel.getInstret() - start < maxInstructions));
+    } else {
+        stop = cpuModel.runUntil(maxInstructions); //run the program until the model indicates execution complete
+    }
+    if(stop.reason == STOP_FAULT) {
+        std::cerr << "Guest trap: cause " << std::dec << cpuModel.getTrapCause() << " value 0x" << std::hex
+                  << cpuModel.getTrapValue() << " pc 0x" << cpuModel.getPC() << std::endl;
+    } else if(stop.reason == STOP_BREAKPOINT) {
+        std::cerr << "Breakpoint: pc 0x" << std::hex << stop.pc << " after " << std::dec << stop.retired << " instructions" << std::endl;
+    } else if(stop.reason == STOP_WATCHPOINT) {
+        std::cerr << "Watchpoint: address 0x" << std::hex << stop.addr << " pc 0x" << stop.pc << " after " << std::dec
+                  << stop.retired << " instructions" << std::endl;
+    }
+    syscalls.finish();
+    if(cacheModel) {
+        probe.finish();
+        probe.report(std::cout);
+    }
+    if(timing) timingModel.report(std::cout);
+    if(profileFile) {
+        std::ofstream out(profileFile);
+        if(!out.is_open()) {
+            std::cerr << "Unable to open file: " << profileFile << std::endl;
+            return 1;
+        }
+        profiler.report(out);
+    }
+    if(flameFile) {
+        std::ofstream out(flameFile);
+        if(!out.is_open()) {
+            std::cerr << "Unable to open file: " << flameFile << std::endl;
+            return 1;
+        }
+        profiler.flamegraph(out);
+    }
+    if(traceFile && !cpuModel.saveTrace(traceFile)) return 1;
+    if(checkpoint && !cpuModel.saveCheckpoint(checkpoint)) return 1;
+    if(dumpFile && !dumpInterval && !cpuModel.saveDump(dumpFile)) return 1;
+    if(!cpuModel.dumpData(dataOut) || !cpuModel.dumpRegs(regsOut)) return 1;
+    if(diverged) return 2;
+    if(stop.reason == STOP_FAULT) return 3;
+    return syscalls.hasExited() ? (syscalls.getExitCode() & 0xff) : 0;
 }
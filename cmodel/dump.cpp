@@ -0,0 +1,108 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <cstring>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_dump.h"
+
+/*
+ * Dump converter: applies the binary dumps of a file written by rv32i_sim
+ * --dump (SimpleRV32I::saveDump()) in order and writes the state they add
+ * up to as the text dumps rv32i_sim writes (--data-out/--regs-out)
+ * */
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [-l] [-n <dumps>] [--data-out <file>] [--regs-out <file>] <dump>" << std::endl;
+    std::cerr << "  -l                  list the dumps in the file" << std::endl;
+    std::cerr << "  -n <dumps>          only apply the first n dumps (default: all)" << std::endl;
+    std::cerr << "  --data-out <file>   data memory dump (default: data_out.txt)" << std::endl;
+    std::cerr << "  --regs-out <file>   register dump (default: regs_out.txt)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const char *file = NULL;
+    const char *dataOut = "data_out.txt";
+    const char *regsOut = "regs_out.txt";
+    uint64_t last = UINT64_MAX;
+    bool list = false;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-l")) {
+            list = true;
+        } else if(!strcmp(argv[i], "-n") && (i+1 < argc)) {
+            last = strtoull(argv[++i], NULL, 0);
+        } else if(!strcmp(argv[i], "--data-out") && (i+1 < argc)) {
+            dataOut = argv[++i];
+        } else if(!strcmp(argv[i], "--regs-out") && (i+1 < argc)) {
+            regsOut = argv[++i];
+        } else if((argv[i][0] != '-') && (file == NULL)) {
+            file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(file == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(file, std::ios::binary);
+    if(!in.is_open()) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return 1;
+    }
+    std::map<uint32_t, std::vector<uint32_t> > pages;   //address to contents, pages not there are zero
+    rv32i_dump_header h;
+    uint64_t n = 0;
+    while((n < last) && (in.peek() != EOF)) {
+        if(!in.read((char*)&h, sizeof(h)) || memcmp(h.magic, RV32I_DUMP_MAGIC, sizeof(h.magic)) || (h.version != RV32I_DUMP_VERSION) ||
+           ((n == 0) && (h.flags & RV32I_DUMP_DIFF))) {
+            std::cerr << "Not a dump: " << file << std::endl;
+            return 1;
+        }
+        if(!(h.flags & RV32I_DUMP_DIFF)) pages.clear();
+        for(uint32_t i=0; i<h.pages; i++) {
+            rv32i_dump_page rec;
+            std::vector<uint32_t> data(RV32I_PAGE_SIZE / 4);
+            if(!in.read((char*)&rec, sizeof(rec)) ||
+               (!(rec.flags & RV32I_DUMP_ZERO) && !in.read((char*)&data[0], RV32I_PAGE_SIZE))) {
+                std::cerr << "Truncated dump: " << file << std::endl;
+                return 1;
+            }
+            if(rec.flags & RV32I_DUMP_ZERO) pages.erase(rec.addr);
+            else pages[rec.addr].swap(data);
+        }
+        if(list) {
+            std::cout << std::dec << n << " " << ((h.flags & RV32I_DUMP_DIFF) ? "diff" : "full") << " instret " << h.instret
+                      << " pc 0x" << std::hex << h.pc << std::dec << " pages " << h.pages << std::endl;
+        }
+        n++;
+    }
+    if(n == 0) {
+        std::cerr << "Not a dump: " << file << std::endl;
+        return 1;
+    }
+
+    std::ofstream data(dataOut);
+    std::ofstream regs(regsOut);
+    if(!data.is_open() || !regs.is_open()) {
+        std::cerr << "Unable to open file: " << (data.is_open() ? regsOut : dataOut) << std::endl;
+        return 1;
+    }
+    static const uint32_t zeros[RV32I_PAGE_SIZE / 4] = { 0 };
+    for(uint32_t a=0; a + 4 <= h.mem_size; a+=RV32I_PAGE_SIZE) {
+        std::map<uint32_t, std::vector<uint32_t> >::const_iterator p = pages.find(a);
+        uint32_t words = ((h.mem_size - a < RV32I_PAGE_SIZE) ? h.mem_size - a : RV32I_PAGE_SIZE) / 4;
+        writeHexWords(data, (p == pages.end()) ? zeros : &p->second[0], words);
+    }
+    writeHexWords(regs, h.regs, 32);
+    data.close();
+    regs.close();
+    if(data.fail() || regs.fail()) {
+        std::cerr << "Unable to write the text dumps" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <new>
+#include "librv32i.h"
+#include "SimpleRV32I.h"
+
+/*
+ * librv32i: the C API (librv32i.h) over SimpleRV32I
+ *
+ * Every entry point checks its arguments and turns host allocation failures
+ * (std::bad_alloc, the only exception the model throws) into error codes,
+ * nothing propagates to the C caller.
+ * */
+
+static_assert((RV32I_ENGINE_INTERP == ENGINE_INTERP) && (RV32I_ENGINE_BLOCK == ENGINE_BLOCK) &&
+              (RV32I_ENGINE_JIT == ENGINE_JIT), "RV32I_ENGINE_* must match rv32i_engine");
+static_assert((RV32I_STOP_ECALL == STOP_ECALL) && (RV32I_STOP_EBREAK == STOP_EBREAK) && (RV32I_STOP_BUDGET == STOP_BUDGET) &&
+              (RV32I_STOP_BREAKPOINT == STOP_BREAKPOINT) && (RV32I_STOP_WATCHPOINT == STOP_WATCHPOINT) &&
+              (RV32I_STOP_FAULT == STOP_FAULT), "RV32I_STOP_* must match rv32i_stop_reason");
+static_assert((RV32I_MAP_R == RV32I_PERM_R) && (RV32I_MAP_W == RV32I_PERM_W) && (RV32I_MAP_X == RV32I_PERM_X),
+              "RV32I_MAP_* must match RV32I_PERM_*");
+
+struct rv32i_model {
+    SimpleRV32I *cpu;
+    rv32i_stop_info stop;   //of the last run
+};
+
+
+/*
+ * runs f (returning an error code) with allocation failures reported as RV32I_ERR_NOMEM
+ * */
+template<typename F> static int guard(rv32i_model *m, F f) {
+    if(m == NULL) return RV32I_ERR_ARG;
+    try {
+        return f(m->cpu);
+    } catch(std::bad_alloc &) {
+        return RV32I_ERR_NOMEM;
+    }
+}
+
+
+rv32i_model *rv32i_create(int engine, uint32_t mem_size, int flags) {
+    if((engine < RV32I_ENGINE_INTERP) || (engine > RV32I_ENGINE_JIT) || (mem_size > INT32_MAX) ||
+       (flags & ~(RV32I_UNIFIED | RV32I_EXT_M | RV32I_EXT_A))) return NULL;
+    rv32i_model *m = new (std::nothrow) rv32i_model;
+    if(m == NULL) return NULL;
+    try {
+        m->cpu = new SimpleRV32I(mem_size, (rv32i_engine)engine, (flags & RV32I_UNIFIED) ? MEM_UNIFIED : MEM_SPLIT);
+        m->cpu->configureIsa(((flags & RV32I_EXT_M) ? RV32I_MISA_M : 0) | ((flags & RV32I_EXT_A) ? RV32I_MISA_A : 0));
+    } catch(std::bad_alloc &) {
+        delete m;
+        return NULL;
+    }
+    m->stop.reason = RV32I_STOP_BUDGET;
+    m->stop.pc = 0;
+    m->stop.addr = 0;
+    m->stop.cause = 0;
+    m->stop.retired = 0;
+    return m;
+}
+
+void rv32i_destroy(rv32i_model *m) {
+    if(m == NULL) return;
+    delete m->cpu;
+    delete m;
+}
+
+int rv32i_reset(rv32i_model *m) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        cpu->reset();
+        return RV32I_OK;
+    });
+}
+
+
+int rv32i_map(rv32i_model *m, uint32_t base, uint32_t size, int perms) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        if(perms & ~(RV32I_MAP_R | RV32I_MAP_W | RV32I_MAP_X)) return RV32I_ERR_ARG;
+        return cpu->mapMemory(base, size, perms) ? RV32I_OK : RV32I_ERR_RANGE;
+    });
+}
+
+int rv32i_load_elf(rv32i_model *m, const void *image, size_t size) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        if(image == NULL) return RV32I_ERR_ARG;
+        return cpu->loadElf(image, size) ? RV32I_OK : RV32I_ERR_FORMAT;
+    });
+}
+
+int rv32i_load_binary(rv32i_model *m, const void *image, size_t size, uint32_t addr) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        if((image == NULL) && size) return RV32I_ERR_ARG;
+        return cpu->loadBinary(image, size, addr) ? RV32I_OK : RV32I_ERR_RANGE;
+    });
+}
+
+
+int rv32i_run(rv32i_model *m, uint64_t max_instructions, rv32i_stop_info *stop) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        rv32i_stop s = cpu->runUntil(max_instructions ? max_instructions : UINT64_MAX);
+        m->stop.reason = s.reason;
+        m->stop.pc = s.pc;
+        m->stop.addr = s.addr;
+        m->stop.cause = s.cause;
+        m->stop.retired = s.retired;
+        if(stop) *stop = m->stop;
+        return RV32I_OK;
+    });
+}
+
+int rv32i_get_stop(rv32i_model *m, rv32i_stop_info *stop) {
+    if((m == NULL) || (stop == NULL)) return RV32I_ERR_ARG;
+    *stop = m->stop;
+    return RV32I_OK;
+}
+
+
+int rv32i_get_reg(rv32i_model *m, int reg, uint32_t *value) {
+    if((m == NULL) || (value == NULL) || (reg < 0) || (reg > 31)) return RV32I_ERR_ARG;
+    *value = m->cpu->getReg(reg);
+    return RV32I_OK;
+}
+
+int rv32i_set_reg(rv32i_model *m, int reg, uint32_t value) {
+    if((m == NULL) || (reg < 0) || (reg > 31)) return RV32I_ERR_ARG;
+    m->cpu->setReg(reg, value);
+    return RV32I_OK;
+}
+
+int rv32i_get_pc(rv32i_model *m, uint32_t *pc) {
+    if((m == NULL) || (pc == NULL)) return RV32I_ERR_ARG;
+    *pc = m->cpu->getPC();
+    return RV32I_OK;
+}
+
+int rv32i_set_pc(rv32i_model *m, uint32_t pc) {
+    if(m == NULL) return RV32I_ERR_ARG;
+    m->cpu->setPC(pc);
+    return RV32I_OK;
+}
+
+int rv32i_read_mem(rv32i_model *m, uint32_t addr, void *buf, size_t len) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        if((buf == NULL) && len) return RV32I_ERR_ARG;
+        if(len > UINT32_MAX) return RV32I_ERR_RANGE;
+        return cpu->readMemory(addr, buf, len) ? RV32I_OK : RV32I_ERR_RANGE;
+    });
+}
+
+int rv32i_write_mem(rv32i_model *m, uint32_t addr, const void *buf, size_t len) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        if((buf == NULL) && len) return RV32I_ERR_ARG;
+        if(len > UINT32_MAX) return RV32I_ERR_RANGE;
+        return cpu->writeMemory(addr, buf, len) ? RV32I_OK : RV32I_ERR_RANGE;
+    });
+}
+
+int rv32i_get_counters(rv32i_model *m, uint64_t *instret, uint64_t *cycles) {
+    if(m == NULL) return RV32I_ERR_ARG;
+    if(instret) *instret = m->cpu->getInstret();
+    if(cycles) *cycles = m->cpu->getCycles();
+    return RV32I_OK;
+}
+
+
+int rv32i_add_breakpoint(rv32i_model *m, uint32_t pc) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        cpu->addBreakpoint(pc);
+        return RV32I_OK;
+    });
+}
+
+int rv32i_remove_breakpoint(rv32i_model *m, uint32_t pc) {
+    return guard(m, [&](SimpleRV32I *cpu) {
+        cpu->removeBreakpoint(pc);
+        return RV32I_OK;
+    });
+}
+
+
+const char *rv32i_strerror(int err) {
+    switch(err) {
+        case RV32I_OK:          return "success";
+        case RV32I_ERR_ARG:     return "invalid argument";
+        case RV32I_ERR_NOMEM:   return "out of host memory";
+        case RV32I_ERR_FORMAT:  return "not a loadable RV32I executable";
+        case RV32I_ERR_RANGE:   return "guest address range not mapped";
+        default:                return "unknown error";
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef __LIBRV32I_H__
+#define __LIBRV32I_H__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * librv32i: C API of the model, for hosting it inside another process
+ * (make librv32i.a librv32i.so)
+ *
+ * A model is created, loaded from memory buffers, run with an instruction
+ * budget and inspected/patched between runs, no file is involved. Calls
+ * never exit the process: every error is returned as a RV32I_ERR_* code
+ * (messages also go to stderr), guest errors (bad fetch, illegal
+ * instruction, access fault) stop the model with RV32I_STOP_FAULT.
+ * A model must only be used by one thread at a time, separate models are
+ * independent. After RV32I_ERR_NOMEM from a run the model must be reset or
+ * destroyed.
+ * */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define RV32I_API __attribute__((visibility("default")))
+#else
+#define RV32I_API
+#endif
+
+typedef struct rv32i_model rv32i_model;
+
+//error codes, returned by every call but rv32i_create/rv32i_destroy/rv32i_strerror
+#define RV32I_OK                0
+#define RV32I_ERR_ARG           -1  //invalid argument (NULL model/pointer, register number, engine)
+#define RV32I_ERR_NOMEM         -2  //host memory allocation failed
+#define RV32I_ERR_FORMAT        -3  //image is not a loadable RV32I executable
+#define RV32I_ERR_RANGE         -4  //address range not mapped or outside the 32bit guest address space
+
+//engines, see rv32i_engine
+#define RV32I_ENGINE_INTERP     0
+#define RV32I_ENGINE_BLOCK      1
+#define RV32I_ENGINE_JIT        2
+
+//rv32i_create() flags
+#define RV32I_UNIFIED           0x1 //one address space for instructions and data (default: split)
+#define RV32I_EXT_M             0x2 //RV32M multiply/divide (default: RV32I only, M encodings are illegal)
+#define RV32I_EXT_A             0x4 //RV32A atomics, LR/SC and AMOs
+
+//page permissions of rv32i_map()
+#define RV32I_MAP_R             0x1
+#define RV32I_MAP_W             0x2
+#define RV32I_MAP_X             0x4
+
+//why a run returned, see rv32i_stop_reason
+#define RV32I_STOP_ECALL        0
+#define RV32I_STOP_EBREAK       1
+#define RV32I_STOP_BUDGET       2   //max_instructions retired
+#define RV32I_STOP_BREAKPOINT   3   //pc reached a breakpoint, the instruction there has not run
+#define RV32I_STOP_WATCHPOINT   4
+#define RV32I_STOP_FAULT        5   //guest trap, cause (mcause code) and addr (trap value) are set
+
+typedef struct {
+    int         reason;     //RV32I_STOP_*
+    uint32_t    pc;         //where the model stopped
+    uint32_t    addr;       //RV32I_STOP_WATCHPOINT: address accessed, RV32I_STOP_FAULT: trap value
+    uint32_t    cause;      //RV32I_STOP_FAULT: trap cause
+    uint64_t    retired;    //instructions retired by the run
+} rv32i_stop_info;
+
+/*
+ * returns a new model with [0, mem_size) mapped (read/write data, read/execute
+ * instructions), NULL on error
+ * */
+RV32I_API rv32i_model *rv32i_create(int engine, uint32_t mem_size, int flags);
+RV32I_API void rv32i_destroy(rv32i_model *m);
+//back to the just created state, keeping allocated pages for reuse
+RV32I_API int rv32i_reset(rv32i_model *m);
+
+RV32I_API int rv32i_map(rv32i_model *m, uint32_t base, uint32_t size, int perms);
+//ELF32 RISC-V executable: segments mapped and loaded, pc set to the entry point
+RV32I_API int rv32i_load_elf(rv32i_model *m, const void *image, size_t size);
+//raw image copied to instruction memory at addr
+RV32I_API int rv32i_load_binary(rv32i_model *m, const void *image, size_t size, uint32_t addr);
+
+/*
+ * runs until the program stops or max_instructions have retired (0: no
+ * limit), stop (may be NULL) tells why; a run after a breakpoint or budget
+ * stop resumes, after ECALL/EBREAK or a fault the model stays stopped
+ * */
+RV32I_API int rv32i_run(rv32i_model *m, uint64_t max_instructions, rv32i_stop_info *stop);
+//why the last run returned
+RV32I_API int rv32i_get_stop(rv32i_model *m, rv32i_stop_info *stop);
+
+RV32I_API int rv32i_get_reg(rv32i_model *m, int reg, uint32_t *value);
+RV32I_API int rv32i_set_reg(rv32i_model *m, int reg, uint32_t value);   //writes to x0 are ignored
+RV32I_API int rv32i_get_pc(rv32i_model *m, uint32_t *pc);
+RV32I_API int rv32i_set_pc(rv32i_model *m, uint32_t pc);
+//data memory, ignoring page permissions
+RV32I_API int rv32i_read_mem(rv32i_model *m, uint32_t addr, void *buf, size_t len);
+RV32I_API int rv32i_write_mem(rv32i_model *m, uint32_t addr, const void *buf, size_t len);
+RV32I_API int rv32i_get_counters(rv32i_model *m, uint64_t *instret, uint64_t *cycles);
+
+RV32I_API int rv32i_add_breakpoint(rv32i_model *m, uint32_t pc);
+RV32I_API int rv32i_remove_breakpoint(rv32i_model *m, uint32_t pc);
+
+RV32I_API const char *rv32i_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
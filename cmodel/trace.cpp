@@ -0,0 +1,161 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include "SimpleRV32I.h"
+#include "SimpleRV32I_utils.h"
+
+/*
+ * Trace decoder: prints the records of a trace written by rv32i_sim --trace
+ * (SimpleRV32I::saveTrace()) as text, one instruction per line:
+ *   <index> <pc> <instruction word> <disassembly> [x<rd>=<value>] [memory access] [halt|trap]
+ * */
+
+//mnemonics, in rv32i_operation order
+static const char * const mnemonics[RV32I_NUM_OPS] = {
+    "lui", "auipc", "jal", "jalr",
+    "beq", "bne", "blt", "bge", "bltu", "bgeu",
+    "lb", "lh", "lw", "lbu", "lhu",
+    "sb", "sh", "sw",
+    "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+    "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+    "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    "lr.w", "sc.w", "amoswap.w", "amoadd.w", "amoxor.w", "amoand.w", "amoor.w",
+    "amomin.w", "amomax.w", "amominu.w", "amomaxu.w",
+    "fence", "fence.i",
+    "ecall", "ebreak",
+    "csrrw", "csrrs", "csrrc", "csrrwi", "csrrsi", "csrrci",
+    "illegal"
+};
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [-n <records>] <trace>" << std::endl;
+    std::cerr << "  -n <records>    only print the last n records (default: all)" << std::endl;
+}
+
+static void printRecord(std::ostream &out, uint64_t index, const rv32i_trace_record &r) {
+    RV32I_INST inst = RV32I_INST();
+    inst.decodeInst(r.inst);
+    rv32i_operation op = inst.getOperation();
+    bool writesRd = true;
+    std::ostringstream mem;
+
+    out << std::dec << index << " " << std::hex << std::setfill('0') << std::setw(8) << r.pc << " " << std::setw(8) << r.inst
+        << std::setfill(' ') << " " << std::left << std::setw(7) << mnemonics[op] << std::right
+        << ((strlen(mnemonics[op]) < 7) ? "" : " ");
+    switch(op) {
+        case LUI:
+        case AUIPC:     out << "x" << std::dec << (int)inst.rd << ", 0x" << std::hex << ((uint32_t)inst.imm >> 12); break;
+        case JAL:       out << "x" << std::dec << (int)inst.rd << ", 0x" << std::hex << r.pc + inst.imm; break;
+        case BEQ:
+        case BNE:
+        case BLT:
+        case BGE:
+        case BLTU:
+        case BGEU:      out << "x" << std::dec << (int)inst.rs1 << ", x" << (int)inst.rs2 << ", 0x" << std::hex << r.pc + inst.imm;
+                        writesRd = false;
+                        break;
+        case JALR:
+        case LB:
+        case LH:
+        case LW:
+        case LBU:
+        case LHU:       out << "x" << std::dec << (int)inst.rd << ", " << inst.imm << "(x" << (int)inst.rs1 << ")";
+                        if(op != JALR) mem << " [0x" << std::hex << r.addr << "]";
+                        break;
+        case SB:
+        case SH:
+        case SW:        {
+                            uint32_t mask = (op == SB) ? 0xff : ((op == SH) ? 0xffff : 0xffffffff);
+                            out << "x" << std::dec << (int)inst.rs2 << ", " << inst.imm << "(x" << (int)inst.rs1 << ")";
+                            mem << " [0x" << std::hex << r.addr << "]=0x" << (r.data & mask);
+                            writesRd = false;
+                        }
+                        break;
+        case SLLI:
+        case SRLI:
+        case SRAI:      out << "x" << std::dec << (int)inst.rd << ", x" << (int)inst.rs1 << ", " << (int)inst.shamt; break;
+        case LR_W:      out << "x" << std::dec << (int)inst.rd << ", (x" << (int)inst.rs1 << ")";
+                        mem << " [0x" << std::hex << r.addr << "]";
+                        break;
+        case SC_W:
+        case AMOSWAP_W:
+        case AMOADD_W:
+        case AMOXOR_W:
+        case AMOAND_W:
+        case AMOOR_W:
+        case AMOMIN_W:
+        case AMOMAX_W:
+        case AMOMINU_W:
+        case AMOMAXU_W: out << "x" << std::dec << (int)inst.rd << ", x" << (int)inst.rs2 << ", (x" << (int)inst.rs1 << ")";
+                        mem << " [0x" << std::hex << r.addr << "]=0x" << r.data;
+                        break;
+        case FENCE:
+        case FENCE_I:
+        case ECALL:
+        case EBREAK:
+        case ILLEGAL:   writesRd = false; break;
+        case CSRRW:
+        case CSRRS:
+        case CSRRC:     out << "x" << std::dec << (int)inst.rd << ", 0x" << std::hex << (r.inst >> 20) << ", x" << std::dec << (int)inst.rs1; break;
+        case CSRRWI:
+        case CSRRSI:
+        case CSRRCI:    out << "x" << std::dec << (int)inst.rd << ", 0x" << std::hex << (r.inst >> 20) << ", " << std::dec << (int)inst.rs1; break;
+        default:
+            if(inst.getType() == R_TYPE) out << "x" << std::dec << (int)inst.rd << ", x" << (int)inst.rs1 << ", x" << (int)inst.rs2;
+            else out << "x" << std::dec << (int)inst.rd << ", x" << (int)inst.rs1 << ", " << inst.imm;
+            break;
+    }
+    if(RV32I_STATUS_STOPPED(r.status)) {
+        out << mem.str() << ((r.status == RV32I_STATUS_TRAP) ? " trap" : " watchpoint");
+    } else {
+        if(writesRd && inst.rd) out << " x" << std::dec << (int)inst.rd << "=0x" << std::hex << r.rd_value;
+        out << mem.str();
+        if(r.status == RV32I_STATUS_HALT) out << " halt";
+    }
+    out << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const char *file = NULL;
+    uint64_t last = UINT64_MAX;
+
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-n") && (i+1 < argc)) {
+            last = strtoull(argv[++i], NULL, 0);
+        } else if((argv[i][0] != '-') && (file == NULL)) {
+            file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(file == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(file, std::ios::binary);
+    rv32i_trace_header h;
+    if(!in.is_open()) {
+        std::cerr << "Unable to open file: " << file << std::endl;
+        return 1;
+    }
+    if(!in.read((char*)&h, sizeof(h)) || memcmp(h.magic, RV32I_TRACE_MAGIC, sizeof(h.magic)) ||
+       (h.version != RV32I_TRACE_VERSION) || (h.record_size != sizeof(rv32i_trace_record))) {
+        std::cerr << "Not a trace: " << file << std::endl;
+        return 1;
+    }
+    uint64_t skip = (last < h.records) ? h.records - last : 0;
+    in.seekg(skip * sizeof(rv32i_trace_record), std::ios::cur);
+    for(uint64_t i=skip; i<h.records; i++) {
+        rv32i_trace_record r;
+        if(!in.read((char*)&r, sizeof(r))) {
+            std::cerr << "Truncated trace: " << file << std::endl;
+            return 1;
+        }
+        printRecord(std::cout, h.first + i, r);
+    }
+    return 0;
+}